@@ -27,12 +27,16 @@ struct AioHandler
     GPollFD pfd;
     IOHandler *io_read;
     IOHandler *io_write;
+    AioPollFn *io_poll;
     int deleted;
     void *opaque;
     bool is_external;
     QLIST_ENTRY(AioHandler) node;
 };
 
+/* Maximum number of events returned by one epoll_wait() */
+#define EPOLL_MAX_EVENTS 128
+
 #ifdef CONFIG_EPOLL_CREATE1
 
 /* The fd number threashold to switch to epoll */
@@ -107,12 +111,16 @@ static void aio_epoll_update(AioContext *ctx, AioHandler *node, bool is_new)
     }
 }
 
+/* Waits for events on the epoll fd and stores the handlers that are ready
+ * in @ready, which has room for EPOLL_MAX_EVENTS entries.  Returns the
+ * number of ready handlers.
+ */
 static int aio_epoll(AioContext *ctx, GPollFD *pfds,
-                     unsigned npfd, int64_t timeout)
+                     unsigned npfd, int64_t timeout, AioHandler **ready)
 {
     AioHandler *node;
     int i, ret = 0;
-    struct epoll_event events[128];
+    struct epoll_event events[EPOLL_MAX_EVENTS];
 
     assert(npfd == 1);
     assert(pfds[0].fd == ctx->epollfd);
@@ -133,6 +141,7 @@ static int aio_epoll(AioContext *ctx, GPollFD *pfds,
                 (ev & EPOLLOUT ? G_IO_OUT : 0) |
                 (ev & EPOLLHUP ? G_IO_HUP : 0) |
                 (ev & EPOLLERR ? G_IO_ERR : 0);
+            ready[i] = node;
         }
     }
 out:
@@ -171,7 +180,7 @@ static void aio_epoll_update(AioContext *ctx, AioHandler *node, bool is_new)
 }
 
 static int aio_epoll(AioContext *ctx, GPollFD *pfds,
-                     unsigned npfd, int64_t timeout)
+                     unsigned npfd, int64_t timeout, AioHandler **ready)
 {
     assert(false);
 }
@@ -220,10 +229,21 @@ void aio_set_fd_handler(AioContext *ctx,
         if (node) {
             g_source_remove_poll(&ctx->source, &node->pfd);
 
+            if (node->io_poll) {
+                ctx->poll_handlers--;
+                node->io_poll = NULL;
+            }
+
+            /* Make aio_epoll_update() remove the fd from the epoll set,
+             * so that epoll_wait() never returns a freed node.
+             */
+            node->pfd.events = 0;
+
             /* If the lock is held, just mark the node as deleted */
             if (ctx->walking_handlers) {
                 node->deleted = 1;
                 node->pfd.revents = 0;
+                ctx->deleted_handlers++;
             } else {
                 /* Otherwise, delete it for real.  We can't just mark it as
                  * deleted because deleted nodes are only cleaned up after
@@ -269,6 +289,25 @@ void aio_set_event_notifier(AioContext *ctx,
                        is_external, (IOHandler *)io_read, NULL, notifier);
 }
 
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll)
+{
+    AioHandler *node = find_aio_handler(ctx, fd);
+
+    if (!node) {
+        return;
+    }
+
+    ctx->poll_handlers += !!io_poll - !!node->io_poll;
+    node->io_poll = io_poll;
+}
+
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll)
+{
+    aio_set_fd_poll(ctx, event_notifier_get_fd(notifier), io_poll);
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     return false;
@@ -293,6 +332,37 @@ bool aio_pending(AioContext *ctx)
     return false;
 }
 
+/* Runs the callbacks of @node for the events in its revents.  The caller
+ * must hold walking_handlers.
+ */
+static bool aio_dispatch_handler(AioContext *ctx, AioHandler *node)
+{
+    bool progress = false;
+    int revents;
+
+    revents = node->pfd.revents & node->pfd.events;
+    node->pfd.revents = 0;
+
+    if (!node->deleted &&
+        (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) &&
+        node->io_read) {
+        node->io_read(node->opaque);
+
+        /* aio_notify() does not count as progress */
+        if (node->opaque != &ctx->notifier) {
+            progress = true;
+        }
+    }
+    if (!node->deleted &&
+        (revents & (G_IO_OUT | G_IO_ERR)) &&
+        node->io_write) {
+        node->io_write(node->opaque);
+        progress = true;
+    }
+
+    return progress;
+}
+
 bool aio_dispatch(AioContext *ctx)
 {
     AioHandler *node;
@@ -314,27 +384,10 @@ bool aio_dispatch(AioContext *ctx)
     node = QLIST_FIRST(&ctx->aio_handlers);
     while (node) {
         AioHandler *tmp;
-        int revents;
 
         ctx->walking_handlers++;
 
-        revents = node->pfd.revents & node->pfd.events;
-        node->pfd.revents = 0;
-
-        if (!node->deleted &&
-            (revents & (G_IO_IN | G_IO_HUP | G_IO_ERR)) &&
-            node->io_read) {
-            node->io_read(node->opaque);
-
-            /* aio_notify() does not count as progress */
-            if (node->opaque != &ctx->notifier) {
-                progress = true;
-            }
-        }
-        if (!node->deleted &&
-            (revents & (G_IO_OUT | G_IO_ERR)) &&
-            node->io_write) {
-            node->io_write(node->opaque);
+        if (aio_dispatch_handler(ctx, node)) {
             progress = true;
         }
 
@@ -345,6 +398,7 @@ bool aio_dispatch(AioContext *ctx)
 
         if (!ctx->walking_handlers && tmp->deleted) {
             QLIST_REMOVE(tmp, node);
+            ctx->deleted_handlers--;
             g_free(tmp);
         }
     }
@@ -355,6 +409,48 @@ bool aio_dispatch(AioContext *ctx)
     return progress;
 }
 
+/* Like aio_dispatch(), but only looks at the @nready handlers that epoll
+ * reported instead of walking the whole handler list.
+ */
+static bool aio_dispatch_ready(AioContext *ctx, AioHandler **ready,
+                               int nready)
+{
+    AioHandler *node, *tmp;
+    bool progress = false;
+    int i;
+
+    /* Nodes deleted by a callback, including bottom halves, stay in the
+     * list until we are done with @ready.
+     */
+    ctx->walking_handlers++;
+
+    if (aio_bh_poll(ctx)) {
+        progress = true;
+    }
+
+    for (i = 0; i < nready; i++) {
+        if (aio_dispatch_handler(ctx, ready[i])) {
+            progress = true;
+        }
+    }
+    ctx->walking_handlers--;
+
+    if (!ctx->walking_handlers && ctx->deleted_handlers) {
+        QLIST_FOREACH_SAFE(node, &ctx->aio_handlers, node, tmp) {
+            if (node->deleted) {
+                QLIST_REMOVE(node, node);
+                ctx->deleted_handlers--;
+                g_free(node);
+            }
+        }
+    }
+
+    /* Run our timers */
+    progress |= timerlistgroup_run_timers(&ctx->tlg);
+
+    return progress;
+}
+
 /* These thread-local variables are used only in a small part of aio_poll
  * around the call to the poll() system call.  In particular they are not
  * used while aio_poll is performing callbacks, which makes it much easier
@@ -401,12 +497,86 @@ static void add_pollfd(AioHandler *node)
     npfd++;
 }
 
+/* Calls every io_poll callback once.  Returns true if any of them found
+ * work; the callbacks have already processed it.
+ */
+static bool run_poll_handlers_once(AioContext *ctx)
+{
+    AioHandler *node;
+    bool progress = false;
+
+    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+        if (!node->deleted && node->io_poll &&
+            aio_node_check(ctx, node->is_external) &&
+            node->io_poll(node->opaque)) {
+            progress = true;
+        }
+    }
+
+    return progress;
+}
+
+/* Busy-waits on the io_poll callbacks for at most @max_ns nanoseconds.
+ * Stops early when a handler makes progress or when aio_notify() is called,
+ * e.g. because another thread scheduled a bottom half.
+ *
+ * Returns true if a handler made progress.
+ */
+static bool run_poll_handlers(AioContext *ctx, int64_t max_ns)
+{
+    int64_t end_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + max_ns;
+    bool progress;
+
+    ctx->poll_attempts++;
+    do {
+        progress = run_poll_handlers_once(ctx);
+    } while (!progress && !atomic_read(&ctx->notified) &&
+             qemu_clock_get_ns(QEMU_CLOCK_REALTIME) < end_time);
+
+    if (progress) {
+        ctx->poll_successes++;
+    }
+    return progress;
+}
+
+/* Adjusts poll_ns after a blocking wait of @block_ns nanoseconds, counted
+ * from the start of the polling phase.
+ */
+static void aio_adjust_poll_ns(AioContext *ctx, int64_t block_ns)
+{
+    if (block_ns <= ctx->poll_ns) {
+        /* This is the sweet spot, no adjustment needed */
+    } else if (block_ns > ctx->poll_max_ns) {
+        /* We'd have to poll for too long, poll less */
+        if (ctx->poll_shrink) {
+            ctx->poll_ns /= ctx->poll_shrink;
+        } else {
+            ctx->poll_ns = 0;
+        }
+    } else if (ctx->poll_ns < ctx->poll_max_ns) {
+        /* There is room to grow, poll longer */
+        int64_t grow = ctx->poll_grow ? ctx->poll_grow : 2;
+
+        if (ctx->poll_ns) {
+            ctx->poll_ns *= grow;
+        } else {
+            ctx->poll_ns = 4000; /* start polling at 4 microseconds */
+        }
+        if (ctx->poll_ns > ctx->poll_max_ns) {
+            ctx->poll_ns = ctx->poll_max_ns;
+        }
+    }
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandler *node;
+    AioHandler *ready[EPOLL_MAX_EVENTS];
     int i, ret;
     bool progress;
+    bool use_epoll = false;
     int64_t timeout;
+    int64_t start = 0;
 
     aio_context_acquire(ctx);
     progress = false;
@@ -426,17 +596,39 @@ bool aio_poll(AioContext *ctx, bool blocking)
 
     assert(npfd == 0);
 
-    /* fill pollfds */
-    QLIST_FOREACH(node, &ctx->aio_handlers, node) {
-        if (!node->deleted && node->pfd.events
-            && !aio_epoll_enabled(ctx)
-            && aio_node_check(ctx, node->is_external)) {
-            add_pollfd(node);
+    /* fill pollfds; with epoll the kernel already has the fd set */
+    if (!aio_epoll_enabled(ctx)) {
+        QLIST_FOREACH(node, &ctx->aio_handlers, node) {
+            if (!node->deleted && node->pfd.events
+                && aio_node_check(ctx, node->is_external)) {
+                add_pollfd(node);
+            }
         }
     }
 
     timeout = blocking ? aio_compute_timeout(ctx) : 0;
 
+    /* Poll for a while before giving up the CPU.  Work found here has
+     * been processed already, so only check the fds without blocking.
+     */
+    if (timeout && ctx->poll_max_ns && ctx->poll_handlers) {
+        start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+        if (ctx->poll_ns) {
+            int64_t max_ns = timeout < 0 ? ctx->poll_ns
+                                         : MIN(ctx->poll_ns, timeout);
+            if (run_poll_handlers(ctx, max_ns)) {
+                progress = true;
+                timeout = 0;
+            } else if (atomic_read(&ctx->notified)) {
+                timeout = 0;
+            } else if (timeout > 0) {
+                /* Keep timer deadlines */
+                timeout -= qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
+                timeout = MAX(timeout, 0);
+            }
+        }
+    }
+
     /* wait until next event */
     if (timeout) {
         aio_context_release(ctx);
@@ -448,7 +640,8 @@ bool aio_poll(AioContext *ctx, bool blocking)
         epoll_handler.pfd.events = G_IO_IN | G_IO_OUT | G_IO_HUP | G_IO_ERR;
         npfd = 0;
         add_pollfd(&epoll_handler);
-        ret = aio_epoll(ctx, pollfds, npfd, timeout);
+        ret = aio_epoll(ctx, pollfds, npfd, timeout, ready);
+        use_epoll = true;
     } else  {
         ret = qemu_poll_ns(pollfds, npfd, timeout);
     }
@@ -459,10 +652,14 @@ bool aio_poll(AioContext *ctx, bool blocking)
         aio_context_acquire(ctx);
     }
 
+    if (start) {
+        aio_adjust_poll_ns(ctx, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start);
+    }
+
     aio_notify_accept(ctx);
 
     /* if we have any readable fds, dispatch event */
-    if (ret > 0) {
+    if (ret > 0 && !use_epoll) {
         for (i = 0; i < npfd; i++) {
             nodes[i]->pfd.revents = pollfds[i].revents;
         }
@@ -472,7 +669,11 @@ bool aio_poll(AioContext *ctx, bool blocking)
     ctx->walking_handlers--;
 
     /* Run dispatch even if there were no readable fds to run timers */
-    if (aio_dispatch(ctx)) {
+    if (use_epoll) {
+        if (aio_dispatch_ready(ctx, ready, MAX(ret, 0))) {
+            progress = true;
+        }
+    } else if (aio_dispatch(ctx)) {
         progress = true;
     }
 
@@ -150,6 +150,17 @@ void aio_set_event_notifier(AioContext *ctx,
     aio_notify(ctx);
 }
 
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll)
+{
+    /* Adaptive polling is not implemented on Windows */
+}
+
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll)
+{
+}
+
 bool aio_prepare(AioContext *ctx)
 {
     static struct timeval tv0;
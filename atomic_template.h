@@ -0,0 +1,153 @@
+/*
+ * Atomic helper templates
+ *
+ * Generate the helpers used by TCG for the atomic_* ops.
+ *
+ * Included from cputlb.c and user-exec.c, which must first define
+ *
+ *   atomic_mmu_lookup(env, addr, oi, size, retaddr)
+ *     Return the host address of a naturally aligned guest access of
+ *     SIZE bytes that can be done with host atomic instructions, or
+ *     NULL if the access must go through atomic_slow_ld/st instead.
+ *     Any guest exception is raised from here.
+ *   atomic_mmu_cleanup()
+ *     Called once the host access is complete.
+ *   atomic_slow_ld(env, addr, oi, retaddr)
+ *   atomic_slow_st(env, addr, val, oi, retaddr)
+ *     Non-atomic accesses, which are only used for accesses that cannot
+ *     be done atomically by the host (e.g. MMIO in system emulation).
+ *   atomic_slow_lock()
+ *   atomic_slow_unlock(locked)
+ *     Bracket the slow path, so that it is atomic with respect to other
+ *     threads taking the slow path.  atomic_slow_lock returns a bool
+ *     that must be passed to atomic_slow_unlock.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if DATA_SIZE == 8
+#define SUFFIX q
+#define DATA_TYPE  uint64_t
+#define ABI_TYPE   uint64_t
+#define BSWAP(X)   bswap64(X)
+#elif DATA_SIZE == 4
+#define SUFFIX l
+#define DATA_TYPE  uint32_t
+#define ABI_TYPE   uint32_t
+#define BSWAP(X)   bswap32(X)
+#elif DATA_SIZE == 2
+#define SUFFIX w
+#define DATA_TYPE  uint16_t
+#define ABI_TYPE   uint32_t
+#define BSWAP(X)   bswap16(X)
+#elif DATA_SIZE == 1
+#define SUFFIX b
+#define DATA_TYPE  uint8_t
+#define ABI_TYPE   uint32_t
+#define BSWAP(X)   (X)
+#else
+#error unsupported data size
+#endif
+
+#define ATOMIC_NAME(X)  glue(glue(helper_atomic_, X), SUFFIX)
+
+/* Convert between host order and the guest memory order given by OI.  */
+static inline DATA_TYPE glue(atomic_swap, SUFFIX)(TCGMemOpIdx oi,
+                                                  DATA_TYPE val)
+{
+    return get_memop(oi) & MO_BSWAP ? BSWAP(val) : val;
+}
+#define SWAP(X)  glue(atomic_swap, SUFFIX)(oi, X)
+
+ABI_TYPE ATOMIC_NAME(cmpxchg)(CPUArchState *env, target_ulong addr,
+                              ABI_TYPE cmpv, ABI_TYPE newv, uint32_t oi)
+{
+    uintptr_t retaddr = GETPC();
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, oi, DATA_SIZE, retaddr);
+    DATA_TYPE ret;
+    bool locked;
+
+    if (likely(haddr)) {
+        ret = atomic_cmpxchg(haddr, SWAP((DATA_TYPE)cmpv),
+                             SWAP((DATA_TYPE)newv));
+        atomic_mmu_cleanup();
+        return SWAP(ret);
+    }
+    locked = atomic_slow_lock();
+    ret = atomic_slow_ld(env, addr, oi, retaddr);
+    if (ret == (DATA_TYPE)cmpv) {
+        atomic_slow_st(env, addr, newv, oi, retaddr);
+    }
+    atomic_slow_unlock(locked);
+    return ret;
+}
+
+ABI_TYPE ATOMIC_NAME(xchg)(CPUArchState *env, target_ulong addr,
+                           ABI_TYPE val, uint32_t oi)
+{
+    uintptr_t retaddr = GETPC();
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, oi, DATA_SIZE, retaddr);
+    DATA_TYPE ret;
+    bool locked;
+
+    if (likely(haddr)) {
+        ret = atomic_xchg(haddr, SWAP((DATA_TYPE)val));
+        atomic_mmu_cleanup();
+        return SWAP(ret);
+    }
+    locked = atomic_slow_lock();
+    ret = atomic_slow_ld(env, addr, oi, retaddr);
+    atomic_slow_st(env, addr, val, oi, retaddr);
+    atomic_slow_unlock(locked);
+    return ret;
+}
+
+ABI_TYPE ATOMIC_NAME(fetch_add)(CPUArchState *env, target_ulong addr,
+                                ABI_TYPE val, uint32_t oi)
+{
+    uintptr_t retaddr = GETPC();
+    DATA_TYPE *haddr = atomic_mmu_lookup(env, addr, oi, DATA_SIZE, retaddr);
+    DATA_TYPE ret;
+    bool locked;
+
+    if (likely(haddr)) {
+        if (!(get_memop(oi) & MO_BSWAP) || DATA_SIZE == 1) {
+            ret = atomic_fetch_add(haddr, (DATA_TYPE)val);
+        } else {
+            /* The host cannot add in the other byte order; loop on
+               compare-and-swap instead.  */
+            DATA_TYPE old, cmp = atomic_read(haddr);
+            do {
+                old = cmp;
+                cmp = atomic_cmpxchg(haddr, old, SWAP(SWAP(old) + val));
+            } while (cmp != old);
+            ret = SWAP(old);
+        }
+        atomic_mmu_cleanup();
+        return ret;
+    }
+    locked = atomic_slow_lock();
+    ret = atomic_slow_ld(env, addr, oi, retaddr);
+    atomic_slow_st(env, addr, (DATA_TYPE)(ret + val), oi, retaddr);
+    atomic_slow_unlock(locked);
+    return ret;
+}
+
+#undef SWAP
+#undef ATOMIC_NAME
+#undef BSWAP
+#undef ABI_TYPE
+#undef DATA_TYPE
+#undef SUFFIX
+#undef DATA_SIZE
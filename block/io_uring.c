@@ -0,0 +1,530 @@
+/*
+ * Linux io_uring support.
+ *
+ * Copyright (C) 2009 IBM, Corp.
+ * Copyright (C) 2009 Red Hat, Inc.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "block/aio.h"
+#include "qemu/queue.h"
+#include "block/block.h"
+#include "block/raw-aio.h"
+#include "qemu/event_notifier.h"
+
+#include <liburing.h>
+#include <linux/falloc.h>
+
+/*
+ * Ring size (per-device).  Requests beyond this are kept on the pending
+ * queue and submitted as completions free up room, so unlike linux-aio the
+ * guest never sees EAGAIN.
+ */
+#define MAX_ENTRIES 128
+
+typedef struct LuringState LuringState;
+
+typedef struct LuringAIOCB {
+    BlockAIOCB common;
+    LuringState *ctx;
+    int fd;
+    int type;
+    off_t offset;
+    size_t nbytes;
+    QEMUIOVector *qiov;
+    ssize_t ret;
+    bool submitted;
+
+    /* Short reads are resubmitted for the remainder of the request */
+    size_t total_read;
+    QEMUIOVector resubmit_qiov;
+
+    QSIMPLEQ_ENTRY(LuringAIOCB) next;
+} LuringAIOCB;
+
+typedef struct {
+    int plugged;
+    unsigned int in_queue;      /* requests on the pending queue */
+    unsigned int in_flight;     /* SQEs consumed by the kernel */
+    bool blocked;
+    QSIMPLEQ_HEAD(, LuringAIOCB) pending;
+
+    /* Requests that failed to submit, completed from the completion BH */
+    QSIMPLEQ_HEAD(, LuringAIOCB) failed;
+} LuringQueue;
+
+struct LuringState {
+    struct io_uring ring;
+    EventNotifier e;
+
+    /* io queue for submit at batch */
+    LuringQueue io_q;
+
+    /* I/O completion processing */
+    QEMUBH *completion_bh;
+
+    bool has_fallocate;
+};
+
+static void ioq_submit(LuringState *s);
+
+/*
+ * Completes an io_uring request (calls the callback and frees the ACB).
+ */
+static void luring_process_completion(LuringState *s, LuringAIOCB *luringcb)
+{
+    ssize_t ret = luringcb->ret;
+
+    switch (luringcb->type) {
+    case QEMU_AIO_READ:
+        if (ret >= 0) {
+            ret += luringcb->total_read;
+            if (ret == luringcb->nbytes) {
+                ret = 0;
+            } else {
+                /* Short reads mean EOF, pad with zeros. */
+                qemu_iovec_memset(luringcb->qiov, ret, 0,
+                                  luringcb->qiov->size - ret);
+                ret = 0;
+            }
+        }
+        break;
+    case QEMU_AIO_WRITE:
+        if (ret >= 0) {
+            ret = (ret == luringcb->nbytes) ? 0 : -EINVAL;
+        }
+        break;
+    case QEMU_AIO_DISCARD:
+        if (ret == -ENODEV || ret == -ENOSYS || ret == -EOPNOTSUPP) {
+            ret = -ENOTSUP;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (luringcb->resubmit_qiov.iov) {
+        qemu_iovec_destroy(&luringcb->resubmit_qiov);
+    }
+    luringcb->common.cb(luringcb->common.opaque, ret);
+
+    qemu_aio_unref(luringcb);
+}
+
+/*
+ * A short read that is not at EOF, or a request the kernel bounced with
+ * EAGAIN/EINTR, goes back on the pending queue.  The remainder of a short
+ * read is described by resubmit_qiov.
+ */
+static bool luring_resubmit(LuringState *s, LuringAIOCB *luringcb, int res)
+{
+    if (res == -EAGAIN || res == -EINTR) {
+        goto requeue;
+    }
+
+    if (luringcb->type != QEMU_AIO_READ || res <= 0 ||
+        luringcb->total_read + res == luringcb->nbytes) {
+        return false;
+    }
+
+    luringcb->total_read += res;
+    if (!luringcb->resubmit_qiov.iov) {
+        qemu_iovec_init(&luringcb->resubmit_qiov, luringcb->qiov->niov);
+    }
+    qemu_iovec_reset(&luringcb->resubmit_qiov);
+    qemu_iovec_concat(&luringcb->resubmit_qiov, luringcb->qiov,
+                      luringcb->total_read,
+                      luringcb->nbytes - luringcb->total_read);
+
+requeue:
+    luringcb->submitted = false;
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, luringcb, next);
+    s->io_q.in_queue++;
+    return true;
+}
+
+/* The completion BH reaps the completion queue and invokes the callbacks.
+ *
+ * As in linux-aio.c, request callbacks may run nested event loops.  The BH
+ * reschedules itself before processing so that a nested aio_poll() keeps
+ * reaping; it is cancelled once the completion queue is empty.
+ */
+static void luring_completion_bh(void *opaque)
+{
+    LuringState *s = opaque;
+    struct io_uring_cqe *cqe;
+    bool resubmit = false;
+
+    qemu_bh_schedule(s->completion_bh);
+
+    while (io_uring_peek_cqe(&s->ring, &cqe) == 0) {
+        LuringAIOCB *luringcb = io_uring_cqe_get_data(cqe);
+        int res = cqe->res;
+
+        io_uring_cqe_seen(&s->ring, cqe);
+        s->io_q.in_flight--;
+
+        /* No-op left behind by ioq_fail_ring() */
+        if (!luringcb) {
+            continue;
+        }
+
+        if (luring_resubmit(s, luringcb, res)) {
+            resubmit = true;
+            continue;
+        }
+        luringcb->ret = res;
+        luring_process_completion(s, luringcb);
+    }
+
+    while (!QSIMPLEQ_EMPTY(&s->io_q.failed)) {
+        LuringAIOCB *luringcb = QSIMPLEQ_FIRST(&s->io_q.failed);
+
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.failed, next);
+        luring_process_completion(s, luringcb);
+    }
+
+    qemu_bh_cancel(s->completion_bh);
+
+    /* SQEs left in the ring by an earlier EAGAIN go out now as well */
+    if (io_uring_sq_ready(&s->ring)) {
+        resubmit = true;
+    }
+    if (resubmit ||
+        (!s->io_q.plugged && !QSIMPLEQ_EMPTY(&s->io_q.pending))) {
+        ioq_submit(s);
+    }
+}
+
+/* Busy-poll hook for aio_poll(); the CQ ring is mapped into userspace */
+static bool luring_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    LuringState *s = container_of(e, LuringState, e);
+
+    if (!io_uring_cq_ready(&s->ring)) {
+        return false;
+    }
+
+    luring_completion_bh(s);
+    return true;
+}
+
+static void luring_completion_cb(EventNotifier *e)
+{
+    LuringState *s = container_of(e, LuringState, e);
+
+    if (event_notifier_test_and_clear(&s->e)) {
+        qemu_bh_schedule(s->completion_bh);
+    }
+}
+
+/*
+ * Only requests that have not reached the submission queue yet can be
+ * cancelled; once the kernel owns an SQE the request completes normally.
+ */
+static void luring_cancel(BlockAIOCB *blockacb)
+{
+    LuringAIOCB *luringcb = (LuringAIOCB *)blockacb;
+    LuringState *s = luringcb->ctx;
+
+    if (luringcb->ret != -EINPROGRESS || luringcb->submitted) {
+        return;
+    }
+
+    QSIMPLEQ_REMOVE(&s->io_q.pending, luringcb, LuringAIOCB, next);
+    s->io_q.in_queue--;
+    luringcb->ret = -ECANCELED;
+    luringcb->common.cb(luringcb->common.opaque, luringcb->ret);
+    qemu_aio_unref(luringcb);
+}
+
+static const AIOCBInfo luring_aiocb_info = {
+    .aiocb_size         = sizeof(LuringAIOCB),
+    .cancel_async       = luring_cancel,
+};
+
+static void ioq_init(LuringQueue *io_q)
+{
+    QSIMPLEQ_INIT(&io_q->pending);
+    QSIMPLEQ_INIT(&io_q->failed);
+    io_q->plugged = 0;
+    io_q->in_queue = 0;
+    io_q->in_flight = 0;
+    io_q->blocked = false;
+}
+
+static void luring_prep_sqe(struct io_uring_sqe *sqe, LuringAIOCB *luringcb)
+{
+    QEMUIOVector *qiov = luringcb->qiov;
+    off_t offset = luringcb->offset;
+
+    switch (luringcb->type) {
+    case QEMU_AIO_WRITE:
+        io_uring_prep_writev(sqe, luringcb->fd, qiov->iov, qiov->niov,
+                             offset);
+        break;
+    case QEMU_AIO_READ:
+        if (luringcb->resubmit_qiov.iov) {
+            qiov = &luringcb->resubmit_qiov;
+            offset += luringcb->total_read;
+        }
+        io_uring_prep_readv(sqe, luringcb->fd, qiov->iov, qiov->niov,
+                            offset);
+        break;
+    case QEMU_AIO_FLUSH:
+        io_uring_prep_fsync(sqe, luringcb->fd, IORING_FSYNC_DATASYNC);
+        break;
+    case QEMU_AIO_DISCARD:
+        io_uring_prep_fallocate(sqe, luringcb->fd,
+                                FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                                offset, luringcb->nbytes);
+        break;
+    default:
+        abort();
+    }
+    io_uring_sqe_set_data(sqe, luringcb);
+}
+
+/*
+ * io_uring_enter() failed with an error that retrying won't fix.  Fail the
+ * requests whose SQEs the kernel has not consumed yet, and turn those SQEs
+ * into no-ops so that they can't be submitted a second time.  Requests still
+ * on the pending queue are failed too, since the no-ops may never leave the
+ * ring and make room for them.
+ */
+static void ioq_fail_ring(LuringState *s, int ret)
+{
+    struct io_uring_sq *sq = &s->ring.sq;
+    unsigned head = *sq->khead;
+    unsigned n = io_uring_sq_ready(&s->ring);
+    unsigned i;
+
+    for (i = 0; i < n; i++) {
+        struct io_uring_sqe *sqe = &sq->sqes[(head + i) & *sq->kring_mask];
+        LuringAIOCB *luringcb = (LuringAIOCB *)(uintptr_t)sqe->user_data;
+
+        if (!luringcb) {
+            continue;
+        }
+        io_uring_prep_nop(sqe);
+        io_uring_sqe_set_data(sqe, NULL);
+
+        luringcb->ret = ret;
+        QSIMPLEQ_INSERT_TAIL(&s->io_q.failed, luringcb, next);
+    }
+
+    while (!QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        LuringAIOCB *luringcb = QSIMPLEQ_FIRST(&s->io_q.pending);
+
+        QSIMPLEQ_REMOVE_HEAD(&s->io_q.pending, next);
+        s->io_q.in_queue--;
+        luringcb->ret = ret;
+        QSIMPLEQ_INSERT_TAIL(&s->io_q.failed, luringcb, next);
+    }
+}
+
+/*
+ * Moves as many pending requests as fit into the submission queue and
+ * submits them with a single io_uring_enter().
+ *
+ * SQEs that the kernel doesn't consume stay in the ring and are counted by
+ * io_uring_sq_ready(); only consumed ones are in flight.
+ */
+static void ioq_submit(LuringState *s)
+{
+    int ret;
+    unsigned int queued;
+    LuringAIOCB *luringcb;
+
+    do {
+        while (s->io_q.in_flight + io_uring_sq_ready(&s->ring) < MAX_ENTRIES &&
+               !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+            struct io_uring_sqe *sqe = io_uring_get_sqe(&s->ring);
+            if (!sqe) {
+                break;
+            }
+            luringcb = QSIMPLEQ_FIRST(&s->io_q.pending);
+            QSIMPLEQ_REMOVE_HEAD(&s->io_q.pending, next);
+            s->io_q.in_queue--;
+            luring_prep_sqe(sqe, luringcb);
+            luringcb->submitted = true;
+        }
+
+        queued = io_uring_sq_ready(&s->ring);
+        if (queued == 0) {
+            break;
+        }
+
+        do {
+            ret = io_uring_submit(&s->ring);
+        } while (ret == -EINTR);
+        if (ret == -EAGAIN || ret == -EBUSY) {
+            /* Out of kernel resources, the SQEs stay in the ring */
+            ret = 0;
+        } else if (ret < 0) {
+            ioq_fail_ring(s, ret);
+            if (!QSIMPLEQ_EMPTY(&s->io_q.failed)) {
+                qemu_bh_schedule(s->completion_bh);
+            }
+            goto out;
+        }
+
+        s->io_q.in_flight += ret;
+    } while (ret == queued && !QSIMPLEQ_EMPTY(&s->io_q.pending));
+
+    /*
+     * Whatever is left in the ring is normally retried by the completion BH
+     * once a request completes.  With nothing in flight no completion will
+     * come, so retry from the BH right away.
+     */
+    if (io_uring_sq_ready(&s->ring) && s->io_q.in_flight == 0) {
+        qemu_bh_schedule(s->completion_bh);
+    }
+
+out:
+    s->io_q.blocked = !QSIMPLEQ_EMPTY(&s->io_q.pending);
+}
+
+void luring_io_plug(BlockDriverState *bs, void *aio_ctx)
+{
+    LuringState *s = aio_ctx;
+
+    s->io_q.plugged++;
+}
+
+void luring_io_unplug(BlockDriverState *bs, void *aio_ctx, bool unplug)
+{
+    LuringState *s = aio_ctx;
+
+    assert(s->io_q.plugged > 0 || !unplug);
+
+    if (unplug && --s->io_q.plugged > 0) {
+        return;
+    }
+
+    if (!s->io_q.blocked && !QSIMPLEQ_EMPTY(&s->io_q.pending)) {
+        ioq_submit(s);
+    }
+}
+
+/* Whether requests of @type can be handed to luring_submit() */
+bool luring_supports(void *aio_ctx, int type)
+{
+    LuringState *s = aio_ctx;
+
+    switch (type) {
+    case QEMU_AIO_READ:
+    case QEMU_AIO_WRITE:
+    case QEMU_AIO_FLUSH:
+        return true;
+    case QEMU_AIO_DISCARD:
+        return s->has_fallocate;
+    default:
+        return false;
+    }
+}
+
+BlockAIOCB *luring_submit(BlockDriverState *bs, void *aio_ctx, int fd,
+        int64_t sector_num, QEMUIOVector *qiov, int nb_sectors,
+        BlockCompletionFunc *cb, void *opaque, int type)
+{
+    LuringState *s = aio_ctx;
+    LuringAIOCB *luringcb;
+
+    if (!luring_supports(s, type)) {
+        fprintf(stderr, "%s: invalid AIO request type 0x%x.\n",
+                        __func__, type);
+        return NULL;
+    }
+
+    luringcb = qemu_aio_get(&luring_aiocb_info, bs, cb, opaque);
+    luringcb->ctx = s;
+    luringcb->fd = fd;
+    luringcb->type = type;
+    luringcb->offset = sector_num * BDRV_SECTOR_SIZE;
+    luringcb->nbytes = nb_sectors * BDRV_SECTOR_SIZE;
+    luringcb->qiov = qiov;
+    luringcb->ret = -EINPROGRESS;
+    luringcb->submitted = false;
+    luringcb->total_read = 0;
+    memset(&luringcb->resubmit_qiov, 0, sizeof(luringcb->resubmit_qiov));
+
+    QSIMPLEQ_INSERT_TAIL(&s->io_q.pending, luringcb, next);
+    s->io_q.in_queue++;
+    if (!s->io_q.blocked &&
+        (!s->io_q.plugged || s->io_q.in_queue >= MAX_ENTRIES)) {
+        ioq_submit(s);
+    }
+    return &luringcb->common;
+}
+
+void luring_detach_aio_context(void *s_, AioContext *old_context)
+{
+    LuringState *s = s_;
+
+    aio_set_event_notifier(old_context, &s->e, false, NULL);
+    qemu_bh_delete(s->completion_bh);
+}
+
+void luring_attach_aio_context(void *s_, AioContext *new_context)
+{
+    LuringState *s = s_;
+
+    s->completion_bh = aio_bh_new(new_context, luring_completion_bh, s);
+    aio_set_event_notifier(new_context, &s->e, false,
+                           luring_completion_cb);
+    aio_set_event_notifier_poll(new_context, &s->e, luring_poll_cb);
+}
+
+void *luring_init(void)
+{
+    LuringState *s;
+    struct io_uring_probe *probe;
+
+    s = g_malloc0(sizeof(*s));
+    if (event_notifier_init(&s->e, false) < 0) {
+        goto out_free_state;
+    }
+
+    if (io_uring_queue_init(MAX_ENTRIES, &s->ring, 0) < 0) {
+        goto out_close_efd;
+    }
+
+    /* CQEs are signalled through the eventfd polled by the AioContext */
+    if (io_uring_register_eventfd(&s->ring, event_notifier_get_fd(&s->e))) {
+        goto out_exit_ring;
+    }
+
+    probe = io_uring_get_probe_ring(&s->ring);
+    if (probe) {
+        s->has_fallocate = io_uring_opcode_supported(probe,
+                                                     IORING_OP_FALLOCATE);
+        io_uring_free_probe(probe);
+    }
+
+    ioq_init(&s->io_q);
+
+    return s;
+
+out_exit_ring:
+    io_uring_queue_exit(&s->ring);
+out_close_efd:
+    event_notifier_cleanup(&s->e);
+out_free_state:
+    g_free(s);
+    return NULL;
+}
+
+void luring_cleanup(void *s_)
+{
+    LuringState *s = s_;
+
+    io_uring_unregister_eventfd(&s->ring);
+    io_uring_queue_exit(&s->ring);
+    event_notifier_cleanup(&s->e);
+    g_free(s);
+}
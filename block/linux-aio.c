@@ -144,6 +144,43 @@ static void qemu_laio_completion_bh(void *opaque)
     }
 }
 
+/* Layout of the completion ring that the kernel maps at the address returned
+ * by io_setup() */
+struct aio_ring {
+    unsigned id;    /* kernel internal index number */
+    unsigned nr;    /* number of io_events */
+    unsigned head;  /* written to by userland or by kernel */
+    unsigned tail;
+
+    unsigned magic;
+    unsigned compat_features;
+    unsigned incompat_features;
+    unsigned header_length;  /* size of aio_ring */
+
+    struct io_event io_events[0];
+};
+
+#define AIO_RING_MAGIC 0xa10a10a1
+
+/* Busy-poll hook for aio_poll(): peek at the completion ring from
+ * userspace, and only enter the kernel if something has completed.
+ */
+static bool qemu_laio_poll_cb(void *opaque)
+{
+    EventNotifier *e = opaque;
+    struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
+    struct aio_ring *ring = (struct aio_ring *)s->ctx;
+
+    if (s->event_idx == s->event_max &&
+        (ring->magic != AIO_RING_MAGIC ||
+         atomic_read(&ring->head) == atomic_read(&ring->tail))) {
+        return false;
+    }
+
+    qemu_laio_completion_bh(s);
+    return true;
+}
+
 static void qemu_laio_completion_cb(EventNotifier *e)
 {
     struct qemu_laio_state *s = container_of(e, struct qemu_laio_state, e);
@@ -299,6 +336,7 @@ void laio_attach_aio_context(void *s_, AioContext *new_context)
     s->completion_bh = aio_bh_new(new_context, qemu_laio_completion_bh, s);
     aio_set_event_notifier(new_context, &s->e, false,
                            qemu_laio_completion_cb);
+    aio_set_event_notifier_poll(new_context, &s->e, qemu_laio_poll_cb);
 }
 
 void *laio_init(void)
@@ -32,13 +32,16 @@
 #include "block/block_int.h"
 #include "qemu-common.h"
 #include "qcow2.h"
+#include "qemu/host-utils.h"
 #include "trace.h"
 
 typedef struct Qcow2CachedTable {
     int64_t  offset;
-    uint64_t lru_counter;
     int      ref;
+    int      hash_next;     /* next entry in the same hash bucket, or -1 */
     bool     dirty;
+    bool     referenced;    /* CLOCK reference bit */
+    bool     used;          /* accessed since the last cache clean */
 } Qcow2CachedTable;
 
 struct Qcow2Cache {
@@ -47,8 +50,14 @@ struct Qcow2Cache {
     int                     size;
     bool                    depends_on_flush;
     void                   *table_array;
-    uint64_t                lru_counter;
-    uint64_t                cache_clean_lru_counter;
+
+    /* Chained hash table mapping a table offset to its entry index. Only
+     * entries with a non-zero offset are linked into it. */
+    int                    *buckets;
+    int                     hash_bits;
+
+    /* Next entry considered for eviction */
+    int                     clock_hand;
 };
 
 static inline void *qcow2_cache_get_table_addr(BlockDriverState *bs,
@@ -68,6 +77,57 @@ static inline int qcow2_cache_get_table_idx(BlockDriverState *bs,
     return idx;
 }
 
+static inline int qcow2_cache_hash(Qcow2Cache *c, uint64_t offset)
+{
+    return (offset * 0x9e3779b97f4a7c15ULL) >> (64 - c->hash_bits);
+}
+
+static void qcow2_cache_hash_reset(Qcow2Cache *c)
+{
+    int i;
+
+    for (i = 0; i < (1 << c->hash_bits); i++) {
+        c->buckets[i] = -1;
+    }
+}
+
+/* Returns the index of the entry caching @offset, or -1 */
+static int qcow2_cache_find(Qcow2Cache *c, uint64_t offset)
+{
+    int i = c->buckets[qcow2_cache_hash(c, offset)];
+
+    while (i >= 0 && c->entries[i].offset != offset) {
+        i = c->entries[i].hash_next;
+    }
+    return i;
+}
+
+/* Changes the offset of entry @i, keeping the hash table up to date. An
+ * offset of 0 marks the entry as empty. */
+static void qcow2_cache_set_offset(Qcow2Cache *c, int i, int64_t offset)
+{
+    Qcow2CachedTable *t = &c->entries[i];
+    int *p;
+
+    if (t->offset) {
+        p = &c->buckets[qcow2_cache_hash(c, t->offset)];
+        while (*p != i) {
+            assert(*p >= 0);
+            p = &c->entries[*p].hash_next;
+        }
+        *p = t->hash_next;
+        t->hash_next = -1;
+    }
+
+    t->offset = offset;
+
+    if (offset) {
+        p = &c->buckets[qcow2_cache_hash(c, offset)];
+        t->hash_next = *p;
+        *p = i;
+    }
+}
+
 static void qcow2_cache_table_release(BlockDriverState *bs, Qcow2Cache *c,
                                       int i, int num_tables)
 {
@@ -87,8 +147,7 @@ static void qcow2_cache_table_release(BlockDriverState *bs, Qcow2Cache *c,
 static inline bool can_clean_entry(Qcow2Cache *c, int i)
 {
     Qcow2CachedTable *t = &c->entries[i];
-    return t->ref == 0 && !t->dirty && t->offset != 0 &&
-        t->lru_counter <= c->cache_clean_lru_counter;
+    return t->ref == 0 && !t->dirty && t->offset != 0 && !t->used;
 }
 
 void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
@@ -104,8 +163,8 @@ void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
 
         /* And count how many we can clean in a row */
         while (i < c->size && can_clean_entry(c, i)) {
-            c->entries[i].offset = 0;
-            c->entries[i].lru_counter = 0;
+            qcow2_cache_set_offset(c, i, 0);
+            c->entries[i].referenced = false;
             i++;
             to_clean++;
         }
@@ -115,13 +174,16 @@ void qcow2_cache_clean_unused(BlockDriverState *bs, Qcow2Cache *c)
         }
     }
 
-    c->cache_clean_lru_counter = c->lru_counter;
+    for (i = 0; i < c->size; i++) {
+        c->entries[i].used = false;
+    }
 }
 
 Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables)
 {
     BDRVQcow2State *s = bs->opaque;
     Qcow2Cache *c;
+    int i;
 
     c = g_new0(Qcow2Cache, 1);
     c->size = num_tables;
@@ -129,11 +191,21 @@ Qcow2Cache *qcow2_cache_create(BlockDriverState *bs, int num_tables)
     c->table_array = qemu_try_blockalign(bs->file->bs,
                                          (size_t) num_tables * s->cluster_size);
 
-    if (!c->entries || !c->table_array) {
+    /* Keep the load factor of the hash table at or below 0.5 */
+    c->hash_bits = ctz64(pow2ceil((uint64_t) num_tables * 2));
+    c->buckets = g_try_new(int, 1 << c->hash_bits);
+
+    if (!c->entries || !c->table_array || !c->buckets) {
         qemu_vfree(c->table_array);
+        g_free(c->buckets);
         g_free(c->entries);
         g_free(c);
-        c = NULL;
+        return NULL;
+    }
+
+    qcow2_cache_hash_reset(c);
+    for (i = 0; i < num_tables; i++) {
+        c->entries[i].hash_next = -1;
     }
 
     return c;
@@ -148,6 +220,7 @@ int qcow2_cache_destroy(BlockDriverState *bs, Qcow2Cache *c)
     }
 
     qemu_vfree(c->table_array);
+    g_free(c->buckets);
     g_free(c->entries);
     g_free(c);
 
@@ -292,53 +365,72 @@ int qcow2_cache_empty(BlockDriverState *bs, Qcow2Cache *c)
     for (i = 0; i < c->size; i++) {
         assert(c->entries[i].ref == 0);
         c->entries[i].offset = 0;
-        c->entries[i].lru_counter = 0;
+        c->entries[i].hash_next = -1;
+        c->entries[i].referenced = false;
+        c->entries[i].used = false;
     }
 
+    qcow2_cache_hash_reset(c);
     qcow2_cache_table_release(bs, c, 0, c->size);
 
-    c->lru_counter = 0;
+    c->clock_hand = 0;
 
     return 0;
 }
 
+/*
+ * Picks an unreferenced entry to evict using the CLOCK algorithm: entries
+ * that were accessed since the hand last passed them get a second chance.
+ * Empty entries are taken right away. Returns -1 if all entries are in use.
+ */
+static int qcow2_cache_find_victim(Qcow2Cache *c)
+{
+    int n;
+
+    for (n = 0; n < 2 * c->size; n++) {
+        Qcow2CachedTable *t = &c->entries[c->clock_hand];
+        int i = c->clock_hand;
+
+        if (++c->clock_hand == c->size) {
+            c->clock_hand = 0;
+        }
+
+        if (t->ref) {
+            continue;
+        }
+        if (t->offset == 0 || !t->referenced) {
+            return i;
+        }
+        t->referenced = false;
+    }
+
+    return -1;
+}
+
 static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
     uint64_t offset, void **table, bool read_from_disk)
 {
     BDRVQcow2State *s = bs->opaque;
     int i;
     int ret;
-    int lookup_index;
-    uint64_t min_lru_counter = UINT64_MAX;
-    int min_lru_index = -1;
 
     trace_qcow2_cache_get(qemu_coroutine_self(), c == s->l2_table_cache,
                           offset, read_from_disk);
 
     /* Check if the table is already cached */
-    i = lookup_index = (offset / s->cluster_size * 4) % c->size;
-    do {
-        const Qcow2CachedTable *t = &c->entries[i];
-        if (t->offset == offset) {
-            goto found;
-        }
-        if (t->ref == 0 && t->lru_counter < min_lru_counter) {
-            min_lru_counter = t->lru_counter;
-            min_lru_index = i;
-        }
-        if (++i == c->size) {
-            i = 0;
-        }
-    } while (i != lookup_index);
+    i = qcow2_cache_find(c, offset);
+    if (i >= 0) {
+        goto found;
+    }
 
-    if (min_lru_index == -1) {
+    i = qcow2_cache_find_victim(c);
+    if (i < 0) {
         /* This can't happen in current synchronous code, but leave the check
          * here as a reminder for whoever starts using AIO with the cache */
         abort();
     }
 
     /* Cache miss: write a table back and replace it */
-    i = min_lru_index;
     trace_qcow2_cache_get_replace_entry(qemu_coroutine_self(),
                                         c == s->l2_table_cache, i);
 
@@ -349,7 +441,7 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
 
     trace_qcow2_cache_get_read(qemu_coroutine_self(),
                                c == s->l2_table_cache, i);
-    c->entries[i].offset = 0;
+    qcow2_cache_set_offset(c, i, 0);
     if (read_from_disk) {
         if (c == s->l2_table_cache) {
             BLKDBG_EVENT(bs->file, BLKDBG_L2_LOAD);
@@ -363,11 +455,13 @@ static int qcow2_cache_do_get(BlockDriverState *bs, Qcow2Cache *c,
         }
     }
 
-    c->entries[i].offset = offset;
+    qcow2_cache_set_offset(c, i, offset);
 
     /* And return the right table */
 found:
     c->entries[i].ref++;
+    c->entries[i].referenced = true;
+    c->entries[i].used = true;
     *table = qcow2_cache_get_table_addr(bs, c, i);
 
     trace_qcow2_cache_get_done(qemu_coroutine_self(),
@@ -388,6 +482,29 @@ int qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
     return qcow2_cache_do_get(bs, c, offset, table, false);
 }
 
+/*
+ * Like qcow2_cache_get(), but never performs any I/O and therefore never
+ * yields. Returns -ENOENT if the table is not cached. This does not require
+ * s->lock; the reference taken on the table keeps it from being evicted
+ * until it is released with qcow2_cache_put().
+ */
+int qcow2_cache_lookup(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
+    void **table)
+{
+    int i = qcow2_cache_find(c, offset);
+
+    if (i < 0) {
+        return -ENOENT;
+    }
+
+    c->entries[i].ref++;
+    c->entries[i].referenced = true;
+    c->entries[i].used = true;
+    *table = qcow2_cache_get_table_addr(bs, c, i);
+
+    return 0;
+}
+
 void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
 {
     int i = qcow2_cache_get_table_idx(bs, c, *table);
@@ -396,7 +513,8 @@ void qcow2_cache_put(BlockDriverState *bs, Qcow2Cache *c, void **table)
     *table = NULL;
 
     if (c->entries[i].ref == 0) {
-        c->entries[i].lru_counter = ++c->lru_counter;
+        c->entries[i].referenced = true;
+        c->entries[i].used = true;
     }
 
     assert(c->entries[i].ref >= 0);
@@ -470,11 +470,15 @@ out:
  *
  * on exit, *num is the number of contiguous sectors we can read.
  *
+ * If cached_only is true, the L2 table is only taken from the cache and
+ * -EAGAIN is returned if it isn't there or if the lookup hits a corrupted
+ * entry; the function then doesn't yield.
+ *
  * Returns the cluster type (QCOW2_CLUSTER_*) on success, -errno in error
  * cases.
  */
-int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
-    int *num, uint64_t *cluster_offset)
+static int get_cluster_offset(BlockDriverState *bs, uint64_t offset,
+    int *num, uint64_t *cluster_offset, bool cached_only)
 {
     BDRVQcow2State *s = bs->opaque;
     unsigned int l2_index;
@@ -521,6 +525,9 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
     }
 
     if (offset_into_cluster(s, l2_offset)) {
+        if (cached_only) {
+            return -EAGAIN;
+        }
         qcow2_signal_corruption(bs, true, -1, -1, "L2 table offset %#" PRIx64
                                 " unaligned (L1 index: %#" PRIx64 ")",
                                 l2_offset, l1_index);
@@ -529,9 +536,17 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
 
     /* load the l2 table in memory */
 
-    ret = l2_load(bs, l2_offset, &l2_table);
-    if (ret < 0) {
-        return ret;
+    if (cached_only) {
+        ret = qcow2_cache_lookup(bs, s->l2_table_cache, l2_offset,
+                                 (void **) &l2_table);
+        if (ret < 0) {
+            return -EAGAIN;
+        }
+    } else {
+        ret = l2_load(bs, l2_offset, &l2_table);
+        if (ret < 0) {
+            return ret;
+        }
     }
 
     /* find the cluster offset for the given disk offset */
@@ -551,6 +566,10 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
         break;
     case QCOW2_CLUSTER_ZERO:
         if (s->qcow_version < 3) {
+            if (cached_only) {
+                ret = -EAGAIN;
+                goto fail;
+            }
             qcow2_signal_corruption(bs, true, -1, -1, "Zero cluster entry found"
                                     " in pre-v3 image (L2 offset: %#" PRIx64
                                     ", L2 index: %#x)", l2_offset, l2_index);
@@ -573,6 +592,10 @@ int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
                 &l2_table[l2_index], QCOW_OFLAG_ZERO);
         *cluster_offset &= L2E_OFFSET_MASK;
         if (offset_into_cluster(s, *cluster_offset)) {
+            if (cached_only) {
+                ret = -EAGAIN;
+                goto fail;
+            }
             qcow2_signal_corruption(bs, true, -1, -1, "Data cluster offset %#"
                                     PRIx64 " unaligned (L2 offset: %#" PRIx64
                                     ", L2 index: %#x)", *cluster_offset,
@@ -602,6 +625,23 @@ fail:
     return ret;
 }
 
+int qcow2_get_cluster_offset(BlockDriverState *bs, uint64_t offset,
+    int *num, uint64_t *cluster_offset)
+{
+    return get_cluster_offset(bs, offset, num, cluster_offset, false);
+}
+
+/*
+ * Same as qcow2_get_cluster_offset(), but only succeeds if the L2 table is
+ * already cached, and returns -EAGAIN otherwise. It never yields, so it can be
+ * called without holding s->lock.
+ */
+int qcow2_get_cluster_offset_cached(BlockDriverState *bs, uint64_t offset,
+    int *num, uint64_t *cluster_offset)
+{
+    return get_cluster_offset(bs, offset, num, cluster_offset, true);
+}
+
 /*
  * get_cluster_table
  *
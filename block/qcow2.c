@@ -1378,6 +1378,44 @@ static coroutine_fn int qcow2_co_readv(BlockDriverState *bs, int64_t sector_num,
 
     qemu_iovec_init(&hd_qiov, qiov->niov);
 
+    /*
+     * Fast path: as long as the L2 tables are cached and no data needs to be
+     * decrypted, decompressed or read from the backing file, the request can
+     * be served without taking s->lock. The lookup doesn't yield, and its
+     * reference on the L2 table keeps it from being evicted meanwhile, so this
+     * doesn't wait behind requests that hold the lock across metadata I/O.
+     */
+    while (remaining_sectors != 0 && !bs->encrypted) {
+        cur_nr_sectors = remaining_sectors;
+        ret = qcow2_get_cluster_offset_cached(bs, sector_num << 9,
+            &cur_nr_sectors, &cluster_offset);
+
+        index_in_cluster = sector_num & (s->cluster_sectors - 1);
+
+        qemu_iovec_reset(&hd_qiov);
+        qemu_iovec_concat(&hd_qiov, qiov, bytes_done,
+            cur_nr_sectors * 512);
+
+        if (ret == QCOW2_CLUSTER_NORMAL && (cluster_offset & 511) == 0) {
+            BLKDBG_EVENT(bs->file, BLKDBG_READ_AIO);
+            ret = bdrv_co_readv(bs->file->bs,
+                                (cluster_offset >> 9) + index_in_cluster,
+                                cur_nr_sectors, &hd_qiov);
+            if (ret < 0) {
+                goto fail_unlocked;
+            }
+        } else if (ret == QCOW2_CLUSTER_ZERO ||
+                   (ret == QCOW2_CLUSTER_UNALLOCATED && !bs->backing)) {
+            qemu_iovec_memset(&hd_qiov, 0, 0, 512 * cur_nr_sectors);
+        } else {
+            break;
+        }
+
+        remaining_sectors -= cur_nr_sectors;
+        sector_num += cur_nr_sectors;
+        bytes_done += cur_nr_sectors * 512;
+    }
+
     qemu_co_mutex_lock(&s->lock);
 
     while (remaining_sectors != 0) {
@@ -1519,6 +1557,7 @@ static coroutine_fn int qcow2_co_readv(BlockDriverState *bs, int64_t sector_num,
 fail:
     qemu_co_mutex_unlock(&s->lock);
 
+fail_unlocked:
     qemu_iovec_destroy(&hd_qiov);
     qemu_vfree(cluster_data);
 
@@ -139,6 +139,10 @@ typedef struct BDRVRawState {
     int use_aio;
     void *aio_ctx;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_linux_io_uring;
+    void *io_uring_ctx;
+#endif
 #ifdef CONFIG_XFS
     bool is_xfs:1;
 #endif
@@ -155,6 +159,9 @@ typedef struct BDRVRawReopenState {
 #ifdef CONFIG_LINUX_AIO
     int use_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    bool use_linux_io_uring;
+#endif
 } BDRVRawReopenState;
 
 static int fd_open(BlockDriverState *bs);
@@ -374,25 +381,39 @@ static void raw_parse_flags(int bdrv_flags, int *open_flags)
 
 static void raw_detach_aio_context(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
 
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_detach_aio_context(s->aio_ctx, bdrv_get_aio_context(bs));
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_detach_aio_context(s->io_uring_ctx, bdrv_get_aio_context(bs));
+    }
+#endif
 }
 
 static void raw_attach_aio_context(BlockDriverState *bs,
                                    AioContext *new_context)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
 
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_attach_aio_context(s->aio_ctx, new_context);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_attach_aio_context(s->io_uring_ctx, new_context);
+    }
+#endif
 }
 
 #ifdef CONFIG_LINUX_AIO
@@ -427,6 +448,32 @@ error:
 }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+static int raw_set_io_uring(void **io_uring_ctx, bool *use_linux_io_uring,
+                            int bdrv_flags)
+{
+    assert(io_uring_ctx != NULL);
+    assert(use_linux_io_uring != NULL);
+
+    /* Unlike linux-aio, io_uring is asynchronous with the host page cache
+     * too, so no need to require cache.direct=on */
+    if (bdrv_flags & BDRV_O_IO_URING) {
+        /* if non-NULL, luring_init() has already been run */
+        if (*io_uring_ctx == NULL) {
+            *io_uring_ctx = luring_init();
+            if (!*io_uring_ctx) {
+                return -1;
+            }
+        }
+        *use_linux_io_uring = true;
+    } else {
+        *use_linux_io_uring = false;
+    }
+
+    return 0;
+}
+#endif
+
 static void raw_parse_filename(const char *filename, QDict *options,
                                Error **errp)
 {
@@ -513,6 +560,23 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (raw_set_io_uring(&s->io_uring_ctx, &s->use_linux_io_uring,
+                         bdrv_flags)) {
+        qemu_close(fd);
+        ret = -errno;
+        error_setg_errno(errp, -ret, "Could not set up io_uring");
+        goto fail;
+    }
+#else
+    if (bdrv_flags & BDRV_O_IO_URING) {
+        error_setg(errp, "aio=io_uring was specified, but is not supported "
+                         "in this build.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif /* !defined(CONFIG_LINUX_IO_URING) */
+
     s->has_discard = true;
     s->has_write_zeroes = true;
     if ((bs->open_flags & BDRV_O_NOCACHE) != 0) {
@@ -618,6 +682,18 @@ static int raw_reopen_prepare(BDRVReopenState *state,
     }
 #endif
 
+#ifdef CONFIG_LINUX_IO_URING
+    raw_s->use_linux_io_uring = s->use_linux_io_uring;
+
+    /* as above, s->io_uring_ctx is kept around even if io_uring ends up
+     * disabled by the reopen */
+    if (raw_set_io_uring(&s->io_uring_ctx, &raw_s->use_linux_io_uring,
+                         state->flags)) {
+        error_setg(errp, "Could not set up io_uring");
+        return -1;
+    }
+#endif
+
     if (s->type == FTYPE_CD) {
         raw_s->open_flags |= O_NONBLOCK;
     }
@@ -703,6 +779,9 @@ static void raw_reopen_commit(BDRVReopenState *state)
 #ifdef CONFIG_LINUX_AIO
     s->use_aio = raw_s->use_aio;
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    s->use_linux_io_uring = raw_s->use_linux_io_uring;
+#endif
 
     g_free(state->opaque);
     state->opaque = NULL;
@@ -1324,38 +1403,66 @@ static BlockAIOCB *raw_aio_submit(BlockDriverState *bs,
         }
     }
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring && !(type & QEMU_AIO_MISALIGNED)) {
+        return luring_submit(bs, s->io_uring_ctx, s->fd, sector_num, qiov,
+                             nb_sectors, cb, opaque, type);
+    }
+#endif
+
     return paio_submit(bs, s->fd, sector_num, qiov, nb_sectors,
                        cb, opaque, type);
 }
 
 static void raw_aio_plug(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_plug(bs, s->aio_ctx);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_io_plug(bs, s->io_uring_ctx);
+    }
+#endif
 }
 
 static void raw_aio_unplug(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_unplug(bs, s->aio_ctx, true);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_io_unplug(bs, s->io_uring_ctx, true);
+    }
+#endif
 }
 
 static void raw_aio_flush_io_queue(BlockDriverState *bs)
 {
-#ifdef CONFIG_LINUX_AIO
+#if defined(CONFIG_LINUX_AIO) || defined(CONFIG_LINUX_IO_URING)
     BDRVRawState *s = bs->opaque;
+#endif
+#ifdef CONFIG_LINUX_AIO
     if (s->use_aio) {
         laio_io_unplug(bs, s->aio_ctx, false);
     }
 #endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_io_unplug(bs, s->io_uring_ctx, false);
+    }
+#endif
 }
 
 static BlockAIOCB *raw_aio_readv(BlockDriverState *bs,
@@ -1382,6 +1489,13 @@ static BlockAIOCB *raw_aio_flush(BlockDriverState *bs,
     if (fd_open(bs) < 0)
         return NULL;
 
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        return luring_submit(bs, s->io_uring_ctx, s->fd, 0, NULL, 0,
+                             cb, opaque, QEMU_AIO_FLUSH);
+    }
+#endif
+
     return paio_submit(bs, s->fd, 0, NULL, 0, cb, opaque, QEMU_AIO_FLUSH);
 }
 
@@ -1395,6 +1509,11 @@ static void raw_close(BlockDriverState *bs)
     if (s->use_aio) {
         laio_cleanup(s->aio_ctx);
     }
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_linux_io_uring) {
+        luring_cleanup(s->io_uring_ctx);
+    }
 #endif
     if (s->fd >= 0) {
         qemu_close(s->fd);
@@ -1871,6 +1990,20 @@ static coroutine_fn BlockAIOCB *raw_aio_discard(BlockDriverState *bs,
 {
     BDRVRawState *s = bs->opaque;
 
+#if defined(CONFIG_LINUX_IO_URING) && defined(CONFIG_FALLOCATE_PUNCH_HOLE)
+    /* Only plain hole punching is done by io_uring; XFS goes through
+     * xfsctl() in the thread pool.  A file system that cannot punch holes
+     * fails each request with -ENOTSUP instead of clearing has_discard. */
+    if (s->use_linux_io_uring && s->has_discard &&
+#ifdef CONFIG_XFS
+        !s->is_xfs &&
+#endif
+        luring_supports(s->io_uring_ctx, QEMU_AIO_DISCARD)) {
+        return luring_submit(bs, s->io_uring_ctx, s->fd, sector_num, NULL,
+                             nb_sectors, cb, opaque, QEMU_AIO_DISCARD);
+    }
+#endif
+
     return paio_submit(bs, s->fd, sector_num, NULL, nb_sectors,
                        cb, opaque, QEMU_AIO_DISCARD);
 }
@@ -24,6 +24,7 @@
 
 bool exit_request;
 CPUState *tcg_current_cpu;
+bool mttcg_enabled;
 
 /* exit the current TB from a signal handler. The host registers are
    restored in a state compatible with the CPU emulator
@@ -28,6 +28,8 @@
 #include "qemu/rcu.h"
 #include "exec/tb-hash.h"
 #include "exec/log.h"
+#include "exec/helper-proto.h"
+#include "qemu/main-loop.h"
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
 #include "hw/i386/apic.h"
 #endif
@@ -189,74 +191,88 @@ static void cpu_exec_nocache(CPUState *cpu, int max_cycles,
                              TranslationBlock *orig_tb, bool ignore_icount)
 {
     TranslationBlock *tb;
+    unsigned int gen;
 
     /* Should never happen.
        We only end up here when an existing TB is too long.  */
     if (max_cycles > CF_COUNT_MASK)
         max_cycles = CF_COUNT_MASK;
 
+    tb_lock();
+    gen = tcg_ctx.tb_ctx.tb_invalidated_gen;
     tb = tb_gen_code(cpu, orig_tb->pc, orig_tb->cs_base, orig_tb->flags,
                      max_cycles | CF_NOCACHE
                          | (ignore_icount ? CF_IGNORE_ICOUNT : 0));
-    tb->orig_tb = tcg_ctx.tb_ctx.tb_invalidated_flag ? NULL : orig_tb;
+    tb->orig_tb = tcg_ctx.tb_ctx.tb_invalidated_gen != gen ? NULL : orig_tb;
+    tb_unlock();
     cpu->current_tb = tb;
     /* execute the generated code */
     trace_exec_tb_nocache(tb, tb->pc);
     cpu_tb_exec(cpu, tb->tc_ptr);
     cpu->current_tb = NULL;
+    tb_lock();
     tb_phys_invalidate(tb, -1);
     tb_free(tb);
+    tb_unlock();
 }
 
-static TranslationBlock *tb_find_physical(CPUState *cpu,
-                                          target_ulong pc,
-                                          target_ulong cs_base,
-                                          uint64_t flags)
+struct tb_desc {
+    target_ulong pc;
+    target_ulong cs_base;
+    CPUArchState *env;
+    tb_page_addr_t phys_page1;
+    uint64_t flags;
+};
+
+static bool tb_cmp(const void *p, const void *d)
 {
-    CPUArchState *env = (CPUArchState *)cpu->env_ptr;
-    TranslationBlock *tb, **ptb1;
-    unsigned int h;
-    tb_page_addr_t phys_pc, phys_page1;
-    target_ulong virt_page2;
-
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
-
-    /* find translated block using physical mappings */
-    phys_pc = get_page_addr_code(env, pc);
-    phys_page1 = phys_pc & TARGET_PAGE_MASK;
-    h = tb_phys_hash_func(phys_pc);
-    ptb1 = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    for(;;) {
-        tb = *ptb1;
-        if (!tb) {
-            return NULL;
-        }
-        if (tb->pc == pc &&
-            tb->page_addr[0] == phys_page1 &&
-            tb->cs_base == cs_base &&
-            tb->flags == flags) {
-            /* check next page if needed */
-            if (tb->page_addr[1] != -1) {
-                tb_page_addr_t phys_page2;
-
-                virt_page2 = (pc & TARGET_PAGE_MASK) +
-                    TARGET_PAGE_SIZE;
-                phys_page2 = get_page_addr_code(env, virt_page2);
-                if (tb->page_addr[1] == phys_page2) {
-                    break;
-                }
-            } else {
-                break;
+    const TranslationBlock *tb = p;
+    const struct tb_desc *desc = d;
+
+    if (tb->pc == desc->pc &&
+        tb->page_addr[0] == desc->phys_page1 &&
+        tb->cs_base == desc->cs_base &&
+        tb->flags == desc->flags) {
+        /* check next page if needed */
+        if (tb->page_addr[1] == -1) {
+            return true;
+        } else {
+            tb_page_addr_t phys_page2;
+            target_ulong virt_page2;
+
+            virt_page2 = (desc->pc & TARGET_PAGE_MASK) + TARGET_PAGE_SIZE;
+            phys_page2 = get_page_addr_code(desc->env, virt_page2);
+            if (tb->page_addr[1] == phys_page2) {
+                return true;
             }
         }
-        ptb1 = &tb->phys_hash_next;
     }
+    return false;
+}
 
-    /* Move the TB to the head of the list */
-    *ptb1 = tb->phys_hash_next;
-    tb->phys_hash_next = tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tcg_ctx.tb_ctx.tb_phys_hash[h] = tb;
-    return tb;
+/* Lookups do not need tb_lock: the TB hash table is safe for concurrent
+ * readers.  A TB found here stays in place until its code region is
+ * evicted or tb_flush runs, and other vCPUs only do either while no vCPU
+ * is executing translated code (safe work under MTTCG, an exclusive
+ * section in multi-threaded user mode).  The TB can still be invalidated
+ * concurrently, or evicted by this thread's own tb_gen_code; both bump
+ * tb_invalidated_gen, which cpu_exec checks under tb_lock before chaining
+ * to a TB that it looked up earlier.  */
+TranslationBlock *tb_find_physical(CPUState *cpu, target_ulong pc,
+                                   target_ulong cs_base, uint64_t flags)
+{
+    tb_page_addr_t phys_pc;
+    struct tb_desc desc;
+    uint32_t h;
+
+    desc.env = (CPUArchState *)cpu->env_ptr;
+    desc.cs_base = cs_base;
+    desc.flags = flags;
+    desc.pc = pc;
+    phys_pc = get_page_addr_code(desc.env, pc);
+    desc.phys_page1 = phys_pc & TARGET_PAGE_MASK;
+    h = tb_hash_func(phys_pc, pc, flags);
+    return qht_lookup(&tcg_ctx.tb_ctx.htable, tb_cmp, &desc, h);
 }
 
 static TranslationBlock *tb_find_slow(CPUState *cpu,
@@ -271,32 +287,29 @@ static TranslationBlock *tb_find_slow(CPUState *cpu,
         goto found;
     }
 
-#ifdef CONFIG_USER_ONLY
     /* mmap_lock is needed by tb_gen_code, and mmap_lock must be
-     * taken outside tb_lock.  Since we're momentarily dropping
-     * tb_lock, there's a chance that our desired tb has been
-     * translated.
+     * taken outside tb_lock.  As system emulation is currently
+     * single threaded the locks are NOPs.
      */
-    tb_unlock();
     mmap_lock();
     tb_lock();
+
+    /* There's a chance that our desired tb has been translated while
+     * taking the locks so we check again inside the lock.
+     */
     tb = tb_find_physical(cpu, pc, cs_base, flags);
-    if (tb) {
-        mmap_unlock();
-        goto found;
+    if (!tb) {
+        /* if no translated code available, then translate it now */
+        tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
     }
-#endif
 
-    /* if no translated code available, then translate it now */
-    tb = tb_gen_code(cpu, pc, cs_base, flags, 0);
-
-#ifdef CONFIG_USER_ONLY
+    tb_unlock();
     mmap_unlock();
-#endif
 
 found:
-    /* we add the TB in the virtual pc hash table */
-    cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)] = tb;
+    /* we add the TB in the virtual pc hash table; other threads may
+     * concurrently clear entries of this cache in tb_phys_invalidate */
+    atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
     return tb;
 }
 
@@ -311,7 +324,7 @@ static inline TranslationBlock *tb_find_fast(CPUState *cpu)
        always be the same before a given translated block
        is executed. */
     cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
-    tb = cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)];
+    tb = atomic_rcu_read(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)]);
     if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
                  tb->flags != flags)) {
         tb = tb_find_slow(cpu, pc, cs_base, flags);
@@ -319,6 +332,31 @@ static inline TranslationBlock *tb_find_fast(CPUState *cpu)
     return tb;
 }
 
+/* Called from generated code at the end of a TB whose PC was set
+ * dynamically (see tcg_gen_lookup_and_goto_ptr).  Return the host code
+ * of the TB matching the current CPU state so that execution can carry
+ * on there without a round trip through the main loop, or the epilogue
+ * if it has not been translated yet.  */
+void *HELPER(lookup_tb_ptr)(CPUArchState *env)
+{
+    CPUState *cpu = ENV_GET_CPU(env);
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    int flags;
+
+    cpu_get_tb_cpu_state(env, &pc, &cs_base, &flags);
+    tb = atomic_rcu_read(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)]);
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        tb = tb_find_physical(cpu, pc, cs_base, flags);
+        if (!tb) {
+            return tcg_ctx.code_gen_epilogue;
+        }
+        atomic_set(&cpu->tb_jmp_cache[tb_jmp_cache_hash_func(pc)], tb);
+    }
+    return tb->tc_ptr;
+}
+
 static void cpu_handle_debug_exception(CPUState *cpu)
 {
     CPUClass *cc = CPU_GET_CLASS(cpu);
@@ -333,6 +371,22 @@ static void cpu_handle_debug_exception(CPUState *cpu)
     cc->debug_excp_handler(cpu);
 }
 
+/* With multi-threaded TCG the BQL is not held while running guest code;
+   take it around the parts of the main loop that touch device state.  */
+static inline void cpu_exec_lock_iothread(void)
+{
+    if (qemu_tcg_mttcg_enabled()) {
+        qemu_mutex_lock_iothread();
+    }
+}
+
+static inline void cpu_exec_unlock_iothread(void)
+{
+    if (qemu_tcg_mttcg_enabled()) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 /* main execution loop */
 
 int cpu_exec(CPUState *cpu)
@@ -346,6 +400,7 @@ int cpu_exec(CPUState *cpu)
     TranslationBlock *tb;
     uint8_t *tc_ptr;
     uintptr_t next_tb;
+    unsigned int tb_gen, last_tb_gen = 0;
     SyncClocks sc;
 
     /* replay_interrupt may need current_cpu */
@@ -355,8 +410,10 @@ int cpu_exec(CPUState *cpu)
 #if defined(TARGET_I386) && !defined(CONFIG_USER_ONLY)
         if ((cpu->interrupt_request & CPU_INTERRUPT_POLL)
             && replay_interrupt()) {
+            cpu_exec_lock_iothread();
             apic_poll_irq(x86_cpu->apic_state);
             cpu_reset_interrupt(cpu, CPU_INTERRUPT_POLL);
+            cpu_exec_unlock_iothread();
         }
 #endif
         if (!cpu_has_work(cpu)) {
@@ -409,7 +466,9 @@ int cpu_exec(CPUState *cpu)
                     break;
 #else
                     if (replay_exception()) {
+                        cpu_exec_lock_iothread();
                         cc->do_interrupt(cpu);
+                        cpu_exec_unlock_iothread();
                         cpu->exception_index = -1;
                     } else if (!replay_has_interrupt()) {
                         /* give a chance to iothread in replay mode */
@@ -430,6 +489,12 @@ int cpu_exec(CPUState *cpu)
             for(;;) {
                 interrupt_request = cpu->interrupt_request;
                 if (unlikely(interrupt_request)) {
+                    /* Interrupt delivery pokes at device state (e.g. the
+                       APIC or GIC), so it needs the BQL.  Any
+                       cpu_loop_exit below drops it again in the
+                       siglongjmp path.  */
+                    cpu_exec_lock_iothread();
+                    interrupt_request = cpu->interrupt_request;
                     if (unlikely(cpu->singlestep_enabled & SSTEP_NOIRQ)) {
                         /* Mask out external interrupts for this step. */
                         interrupt_request &= ~CPU_INTERRUPT_SSTEP_MASK;
@@ -482,6 +547,7 @@ int cpu_exec(CPUState *cpu)
                            the program flow was changed */
                         next_tb = 0;
                     }
+                    cpu_exec_unlock_iothread();
                 }
                 if (unlikely(cpu->exit_request
                              || replay_has_interrupt())) {
@@ -489,30 +555,29 @@ int cpu_exec(CPUState *cpu)
                     cpu->exception_index = EXCP_INTERRUPT;
                     cpu_loop_exit(cpu);
                 }
-                tb_lock();
+                tb_gen = atomic_mb_read(&tcg_ctx.tb_ctx.tb_invalidated_gen);
                 tb = tb_find_fast(cpu);
-                /* Note: we do it here to avoid a gcc bug on Mac OS X when
-                   doing it in tb_find_slow */
-                if (tcg_ctx.tb_ctx.tb_invalidated_flag) {
-                    /* as some TB could have been invalidated because
-                       of memory exceptions while generating the code, we
-                       must recompute the hash index here */
-                    next_tb = 0;
-                    tcg_ctx.tb_ctx.tb_invalidated_flag = 0;
-                }
                 if (qemu_loglevel_mask(CPU_LOG_EXEC)) {
                     qemu_log("Trace %p [" TARGET_FMT_lx "] %s\n",
                              tb->tc_ptr, tb->pc, lookup_symbol(tb->pc));
                 }
                 /* see if we can patch the calling TB. When the TB
                    spans two pages, we cannot safely do a direct
-                   jump. */
+                   jump.  Only this needs tb_lock; if any TB was
+                   invalidated since the calling TB was looked up
+                   (possibly by memory exceptions while generating
+                   the code), it may be gone and we must not chain. */
                 if (next_tb != 0 && tb->page_addr[1] == -1
                     && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
-                    tb_add_jump((TranslationBlock *)(next_tb & ~TB_EXIT_MASK),
-                                next_tb & TB_EXIT_MASK, tb);
+                    tb_lock();
+                    if (tcg_ctx.tb_ctx.tb_invalidated_gen == last_tb_gen) {
+                        tb_add_jump((TranslationBlock *)
+                                    (next_tb & ~TB_EXIT_MASK),
+                                    next_tb & TB_EXIT_MASK, tb);
+                    }
+                    tb_unlock();
                 }
-                tb_unlock();
+                last_tb_gen = tb_gen;
                 if (likely(!cpu->exit_request)) {
                     trace_exec_tb(tb, tb->pc);
                     tc_ptr = tb->tc_ptr;
@@ -533,6 +598,16 @@ int cpu_exec(CPUState *cpu)
                          * or cpu->interrupt_request.
                          */
                         smp_rmb();
+                        tb = (TranslationBlock *)(next_tb & ~TB_EXIT_MASK);
+                        if (tb_hot_counted(tb) &&
+                            atomic_read(&tb->hot_count) <= 0) {
+                            /* The exit came from the execution counter */
+                            mmap_lock();
+                            tb_lock();
+                            tb_gen_trace(cpu, tb);
+                            tb_unlock();
+                            mmap_unlock();
+                        }
                         next_tb = 0;
                         break;
                     case TB_EXIT_ICOUNT_EXPIRED:
@@ -591,6 +666,12 @@ int cpu_exec(CPUState *cpu)
 #endif /* buggy compiler */
             cpu->can_do_io = 1;
             tb_lock_reset();
+            /* tb_gen_code may leave with mmap_lock held too, when a full
+               code region can only be evicted outside cpu_exec */
+            mmap_lock_reset();
+            if (qemu_tcg_mttcg_enabled() && qemu_mutex_iothread_locked()) {
+                qemu_mutex_unlock_iothread();
+            }
         }
     } /* for(;;) */
 
@@ -25,10 +25,15 @@
 #include "exec/cpu_ldst.h"
 
 #include "exec/cputlb.h"
+#include "exec/helper-proto.h"
+#include "exec/tb-hash.h"
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "tcg/tcg.h"
+#include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qmp-commands.h"
 
 //#define DEBUG_TLB
 //#define DEBUG_TLB_CHECK
@@ -48,10 +53,92 @@ int tlb_flush_count;
  * entries from the TLB at any time, so flushing more entries than
  * required is only an efficiency issue, not a correctness issue.
  */
-void tlb_flush(CPUState *cpu, int flush_global)
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* Length of the window over which the TLB use of an MMU mode is sampled
+   before it may be shrunk.  */
+#define TLB_RESIZE_WINDOW_NS (100 * 1000 * 1000)
+
+/* Pick a new size for the TLB of MMU_IDX, based on the largest number of
+ * entries that were in use at the time of a flush during the current
+ * window.  Grow as soon as the TLB is more than 70% full; shrink only
+ * once a whole window has gone by with it less than 30% full, so that a
+ * guest that flushes often does not end up thrashing a tiny TLB.
+ *
+ * Only called on a full flush, when the entries are about to be thrown
+ * away anyway.
+ */
+static void tlb_mmu_resize(CPUState *cpu, int mmu_idx)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    size_t old_size = tlb_n_entries(env, mmu_idx);
+    size_t new_size = old_size;
+    size_t rate;
+    int64_t now = get_clock();
+    bool window_expired = now > desc->window_begin_ns + TLB_RESIZE_WINDOW_NS;
+
+    if (env->tlb_mask[mmu_idx] == 0) {
+        /* Not set up yet, or cleared by a CPU reset.  */
+        new_size = 1 << CPU_TLB_DYN_DEFAULT_BITS;
+        goto resize;
+    }
+
+    desc->window_max_entries = MAX(desc->window_max_entries,
+                                   desc->n_used_entries);
+    rate = desc->window_max_entries * 100 / old_size;
+
+    if (rate > 70) {
+        new_size = MIN(old_size << 1, 1 << CPU_TLB_DYN_MAX_BITS);
+    } else if (rate < 30 && window_expired) {
+        size_t ceil = pow2ceil(desc->window_max_entries);
+        size_t expected_rate = desc->window_max_entries * 100 / ceil;
+
+        /* Avoid shrinking to a size that would immediately be grown
+           again.  */
+        if (expected_rate > 70) {
+            ceil *= 2;
+        }
+        new_size = MAX(ceil, 1 << CPU_TLB_DYN_MIN_BITS);
+    }
+
+    if (new_size == old_size) {
+        if (window_expired) {
+            desc->window_begin_ns = now;
+            desc->window_max_entries = 0;
+        }
+        return;
+    }
+    cpu->tlb_stats.resizes++;
+
+resize:
+    env->tlb_mask[mmu_idx] = (new_size - 1) << CPU_TLB_ENTRY_BITS;
+    desc->window_begin_ns = now;
+    desc->window_max_entries = 0;
+}
+#endif
+
+/* Flush every entry of the TLB of MMU_IDX, resizing it first if the
+   backend allows that.  */
+static void tlb_flush_one_mmuidx(CPUState *cpu, int mmu_idx)
 {
     CPUArchState *env = cpu->env_ptr;
 
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    tlb_mmu_resize(cpu, mmu_idx);
+#endif
+    memset(env->tlb_table[mmu_idx], -1,
+           tlb_n_entries(env, mmu_idx) * sizeof(CPUTLBEntry));
+    memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+    env->tlb_d[mmu_idx].n_used_entries = 0;
+    env->tlb_d[mmu_idx].large_page_addr = -1;
+    env->tlb_d[mmu_idx].large_page_mask = 0;
+}
+
+static void tlb_flush_nocheck(CPUState *cpu)
+{
+    CPUArchState *env = cpu->env_ptr;
+    int mmu_idx;
+
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
 #endif
@@ -59,19 +146,177 @@ void tlb_flush(CPUState *cpu, int flush_global)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    memset(env->tlb_table, -1, sizeof(env->tlb_table));
-    memset(env->tlb_v_table, -1, sizeof(env->tlb_v_table));
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        tlb_flush_one_mmuidx(cpu, mmu_idx);
+    }
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
 
     env->vtlb_index = 0;
-    env->tlb_flush_addr = -1;
-    env->tlb_flush_mask = 0;
-    tlb_flush_count++;
+    atomic_inc(&tlb_flush_count);
+    cpu->tlb_stats.full_flushes++;
 }
 
-static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
+/* With multi-threaded TCG a vCPU's TLB is only ever modified by its own
+ * thread, so flushes targeting another vCPU are deferred to it as
+ * asynchronous work.
+ */
+static bool tlb_flush_is_remote(CPUState *cpu)
 {
-    CPUArchState *env = cpu->env_ptr;
+    return qemu_tcg_mttcg_enabled() && cpu->created &&
+           !qemu_cpu_is_self(cpu);
+}
+
+#define ALL_MMUIDX_BITS ((1UL << NB_MMU_MODES) - 1)
+
+static void tlb_flush_by_mmuidx_nocheck(CPUState *cpu, unsigned long idxmap);
+static void tlb_flush_page_nocheck(CPUState *cpu, target_ulong addr);
+static void tlb_flush_page_by_mmuidx_nocheck(CPUState *cpu, target_ulong addr,
+                                             unsigned long idxmap);
+
+/* Run by the vCPU itself: take everything queued so far and do it.  */
+static void tlb_flush_queue_work(void *opaque)
+{
+    CPUState *cpu = opaque;
+    CPUTLBFlushQueue *q = &cpu->tlb_flush_queue;
+    target_ulong addrs[TLB_FLUSH_QUEUE_PAGES];
+    unsigned long idxmaps[TLB_FLUSH_QUEUE_PAGES];
+    unsigned long full;
+    int i, n;
+
+    qemu_spin_lock(&q->lock);
+    full = q->full_idxmap;
+    n = q->nb_pages;
+    for (i = 0; i < n; i++) {
+        addrs[i] = q->pages[i].addr;
+        idxmaps[i] = q->pages[i].idxmap;
+    }
+    q->full_idxmap = 0;
+    q->nb_pages = 0;
+    q->scheduled = false;
+    qemu_spin_unlock(&q->lock);
+
+    /* Flushes only ever drop entries, so their order does not matter */
+    if (full == ALL_MMUIDX_BITS) {
+        tlb_flush_nocheck(cpu);
+    } else if (full) {
+        tlb_flush_by_mmuidx_nocheck(cpu, full);
+    }
+    for (i = 0; i < n; i++) {
+        unsigned long idxmap = idxmaps[i] & ~full;
+
+        if (idxmap == ALL_MMUIDX_BITS) {
+            tlb_flush_page_nocheck(cpu, addrs[i]);
+        } else if (idxmap) {
+            tlb_flush_page_by_mmuidx_nocheck(cpu, addrs[i], idxmap);
+        }
+    }
+}
+
+/* Queue a flush of page ADDR (or of everything, if FULL) from the MMU
+   indexes in IDXMAP of CPU.  Requests made before the vCPU gets round to
+   it are merged, so that a burst of broadcast invalidations costs the
+   target one work item, and at most one full flush.  Returns true if
+   the caller must schedule tlb_flush_queue_work.  */
+static bool tlb_flush_queue_push(CPUState *cpu, target_ulong addr,
+                                 unsigned long idxmap, bool full)
+{
+    CPUTLBFlushQueue *q = &cpu->tlb_flush_queue;
+    bool schedule;
+    int i;
+
+    qemu_spin_lock(&q->lock);
+    if (full) {
+        q->full_idxmap |= idxmap;
+    } else if ((q->full_idxmap & idxmap) == idxmap) {
+        /* already covered by a pending full flush */
+    } else if (q->nb_pages == TLB_FLUSH_QUEUE_PAGES) {
+        for (i = 0; i < q->nb_pages; i++) {
+            q->full_idxmap |= q->pages[i].idxmap;
+        }
+        q->full_idxmap |= idxmap;
+        q->nb_pages = 0;
+    } else {
+        q->pages[q->nb_pages].addr = addr;
+        q->pages[q->nb_pages].idxmap = idxmap;
+        q->nb_pages++;
+    }
+    schedule = !q->scheduled;
+    q->scheduled = true;
+    qemu_spin_unlock(&q->lock);
+
+    return schedule;
+}
+
+static void tlb_flush_queue_add(CPUState *cpu, target_ulong addr,
+                                unsigned long idxmap, bool full)
+{
+    if (tlb_flush_queue_push(cpu, addr, idxmap, full)) {
+        async_run_on_cpu(cpu, tlb_flush_queue_work, cpu);
+    }
+}
+
+/* Queue SRC_CPU's own part of a synced broadcast.  The queue is drained
+   as safe work: by the time it runs every other vCPU has left guest
+   code, and they do not re-enter it before draining their own queues,
+   where the rest of the broadcast already sits.  A work item is always
+   scheduled, because one that is already pending may be a plain
+   asynchronous one.  */
+static void tlb_flush_queue_add_synced(CPUState *src_cpu, target_ulong addr,
+                                       unsigned long idxmap, bool full)
+{
+    tlb_flush_queue_push(src_cpu, addr, idxmap, full);
+    async_safe_run_on_cpu(src_cpu, tlb_flush_queue_work, src_cpu);
+}
+
+void tlb_flush(CPUState *cpu, int flush_global)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        tlb_flush_queue_add(cpu, 0, ALL_MMUIDX_BITS, true);
+    } else {
+        tlb_flush_nocheck(cpu);
+    }
+}
+
+void tlb_flush_all_cpus(CPUState *src_cpu)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        tlb_flush(cpu, 1);
+    }
+}
+
+void tlb_flush_all_cpus_synced(CPUState *src_cpu)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush(cpu, 1);
+        }
+    }
+    tlb_flush_queue_add_synced(src_cpu, 0, ALL_MMUIDX_BITS, true);
+}
+
+/* Collect a -1 terminated list of MMU indexes into a bitmap.  */
+static unsigned long tlb_idxmap_from_va(va_list argp)
+{
+    unsigned long idxmap = 0;
+
+    for (;;) {
+        int mmu_idx = va_arg(argp, int);
+
+        if (mmu_idx < 0) {
+            break;
+        }
+        idxmap |= 1UL << mmu_idx;
+    }
+    return idxmap;
+}
+
+static void tlb_flush_by_mmuidx_nocheck(CPUState *cpu, unsigned long idxmap)
+{
+    int mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush_by_mmuidx:");
@@ -80,19 +325,16 @@ static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    for (;;) {
-        int mmu_idx = va_arg(argp, int);
-
-        if (mmu_idx < 0) {
-            break;
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+        if (!(idxmap & (1UL << mmu_idx))) {
+            continue;
         }
 
 #if defined(DEBUG_TLB)
         printf(" %d", mmu_idx);
 #endif
 
-        memset(env->tlb_table[mmu_idx], -1, sizeof(env->tlb_table[0]));
-        memset(env->tlb_v_table[mmu_idx], -1, sizeof(env->tlb_v_table[0]));
+        tlb_flush_one_mmuidx(cpu, mmu_idx);
     }
 
 #if defined(DEBUG_TLB)
@@ -100,17 +342,65 @@ static inline void v_tlb_flush_by_mmuidx(CPUState *cpu, va_list argp)
 #endif
 
     memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
+    cpu->tlb_stats.full_flushes++;
+}
+
+static void tlb_flush_by_idxmap(CPUState *cpu, unsigned long idxmap)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        tlb_flush_queue_add(cpu, 0, idxmap, true);
+    } else {
+        tlb_flush_by_mmuidx_nocheck(cpu, idxmap);
+    }
 }
 
 void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 {
+    unsigned long idxmap;
     va_list argp;
+
     va_start(argp, cpu);
-    v_tlb_flush_by_mmuidx(cpu, argp);
+    idxmap = tlb_idxmap_from_va(argp);
+    va_end(argp);
+
+    tlb_flush_by_idxmap(cpu, idxmap);
+}
+
+void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, ...)
+{
+    CPUState *cpu;
+    unsigned long idxmap;
+    va_list argp;
+
+    va_start(argp, src_cpu);
+    idxmap = tlb_idxmap_from_va(argp);
+    va_end(argp);
+
+    CPU_FOREACH(cpu) {
+        tlb_flush_by_idxmap(cpu, idxmap);
+    }
+}
+
+void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, ...)
+{
+    CPUState *cpu;
+    unsigned long idxmap;
+    va_list argp;
+
+    va_start(argp, src_cpu);
+    idxmap = tlb_idxmap_from_va(argp);
     va_end(argp);
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_by_idxmap(cpu, idxmap);
+        }
+    }
+    tlb_flush_queue_add_synced(src_cpu, 0, idxmap, true);
 }
 
-static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
+/* Return true if the entry was for ADDR and has been flushed.  */
+static inline bool tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
     if (addr == (tlb_entry->addr_read &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
@@ -119,103 +409,297 @@ static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
         addr == (tlb_entry->addr_code &
                  (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
     }
+    return false;
 }
 
-void tlb_flush_page(CPUState *cpu, target_ulong addr)
+static inline bool tlb_hit_range(target_ulong tlb_addr, target_ulong addr,
+                                 target_ulong last)
 {
-    CPUArchState *env = cpu->env_ptr;
-    int i;
-    int mmu_idx;
+    return !(tlb_addr & TLB_INVALID_MASK) &&
+           (tlb_addr & TARGET_PAGE_MASK) - addr <= last - addr;
+}
 
+/* Return true if the entry was for a page in [ADDR, LAST] and has been
+   flushed.  */
+static inline bool tlb_flush_entry_range(CPUTLBEntry *tlb_entry,
+                                         target_ulong addr, target_ulong last)
+{
+    if (tlb_hit_range(tlb_entry->addr_read, addr, last) ||
+        tlb_hit_range(tlb_entry->addr_write, addr, last) ||
+        tlb_hit_range(tlb_entry->addr_code, addr, last)) {
+        memset(tlb_entry, -1, sizeof(*tlb_entry));
+        return true;
+    }
+    return false;
+}
+
+static inline void tlb_flush_main_entry(CPUArchState *env, int mmu_idx,
+                                        target_ulong addr)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+
+    /* The count can be off before the first full flush, as a CPU reset
+       zeroes the table rather than invalidating it.  */
+    if (tlb_flush_entry(tlb_entry(env, mmu_idx, addr), addr)
+        && desc->n_used_entries) {
+        desc->n_used_entries--;
+    }
+}
+
+/* The TLB only holds TARGET_PAGE_SIZE entries, so a large page is
+ * entered one small page at a time, wherever the guest touched it.  A
+ * flush of any address in a large page must drop all of them, so widen
+ * [*PADDR, *PLAST] to the large page region of MMU_IDX if they overlap.
+ * The region is forgotten, as everything in it is about to be flushed.
+ */
+static void tlb_flush_range_add_large_page(CPUArchState *env, int mmu_idx,
+                                           target_ulong *paddr,
+                                           target_ulong *plast)
+{
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    target_ulong lp_addr = desc->large_page_addr;
+    target_ulong lp_last = lp_addr | ~desc->large_page_mask;
+
+    if (lp_addr == (target_ulong)-1 || lp_addr > *plast || lp_last < *paddr) {
+        return;
+    }
 #if defined(DEBUG_TLB)
-    printf("tlb_flush_page: " TARGET_FMT_lx "\n", addr);
-#endif
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
-#if defined(DEBUG_TLB)
-        printf("tlb_flush_page: forced full flush ("
-               TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-               env->tlb_flush_addr, env->tlb_flush_mask);
+    printf("tlb_flush: large page region " TARGET_FMT_lx "/" TARGET_FMT_lx
+           " in mmu_idx %d\n", lp_addr, desc->large_page_mask, mmu_idx);
 #endif
-        tlb_flush(cpu, 1);
+    *paddr = MIN(*paddr, lp_addr);
+    *plast = MAX(*plast, lp_last);
+    desc->large_page_addr = -1;
+    desc->large_page_mask = 0;
+}
+
+/* Flush the entries of MMU_IDX for pages in [ADDR, LAST], which are page
+   aligned.  Look up each page if there are fewer of them than TLB
+   entries, otherwise scan the whole TLB.  */
+static void tlb_flush_range_one_mmuidx(CPUState *cpu, int mmu_idx,
+                                       target_ulong addr, target_ulong last)
+{
+    CPUArchState *env = cpu->env_ptr;
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
+    target_ulong npages_m1 = (last - addr) >> TARGET_PAGE_BITS;
+    size_t n = tlb_n_entries(env, mmu_idx);
+    target_ulong i;
+    int k;
+
+    if (addr == 0 && last == (target_ulong)-1) {
+        tlb_flush_one_mmuidx(cpu, mmu_idx);
+        return;
+    }
+
+    if (npages_m1 < n) {
+        for (i = 0; i <= npages_m1; i++) {
+            tlb_flush_main_entry(env, mmu_idx, addr + (i << TARGET_PAGE_BITS));
+        }
+    } else {
+        for (i = 0; i < n; i++) {
+            if (tlb_flush_entry_range(&env->tlb_table[mmu_idx][i], addr, last)
+                && desc->n_used_entries) {
+                desc->n_used_entries--;
+            }
+        }
+    }
+
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        tlb_flush_entry_range(&env->tlb_v_table[mmu_idx][k], addr, last);
+    }
+}
+
+/* Discard the jump cache entries of TBs that may overlap [ADDR, LAST].  */
+static void tlb_flush_jmp_cache_range(CPUState *cpu, target_ulong addr,
+                                      target_ulong last)
+{
+    target_ulong npages_m1 = (last - addr) >> TARGET_PAGE_BITS;
+    target_ulong i;
+
+    /* Past this many pages every bucket of the cache has been hit.  */
+    if (npages_m1 >= TB_JMP_CACHE_SIZE / TB_JMP_PAGE_SIZE) {
+        memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
         return;
     }
+    for (i = 0; i <= npages_m1; i++) {
+        tb_flush_jmp_cache(cpu, addr + (i << TARGET_PAGE_BITS));
+    }
+}
+
+static void tlb_flush_range_by_mmuidx_nocheck(CPUState *cpu, target_ulong addr,
+                                              target_ulong last,
+                                              unsigned long idxmap)
+{
+    CPUArchState *env = cpu->env_ptr;
+    target_ulong jmp_addr = addr, jmp_last = last;
+    int mmu_idx;
+
+#if defined(DEBUG_TLB)
+    printf("tlb_flush_range: " TARGET_FMT_lx "-" TARGET_FMT_lx " idxmap %lx\n",
+           addr, last, idxmap);
+#endif
     /* must reset current TB so that interrupts cannot modify the
        links while we are modifying them */
     cpu->current_tb = NULL;
 
-    addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        target_ulong flush_addr = addr, flush_last = last;
+
+        if (!(idxmap & (1UL << mmu_idx))) {
+            continue;
+        }
+        tlb_flush_range_add_large_page(env, mmu_idx, &flush_addr, &flush_last);
+        tlb_flush_range_one_mmuidx(cpu, mmu_idx, flush_addr, flush_last);
+        jmp_addr = MIN(jmp_addr, flush_addr);
+        jmp_last = MAX(jmp_last, flush_last);
     }
 
-    /* check whether there are entries that need to be flushed in the vtlb */
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+    tlb_flush_jmp_cache_range(cpu, jmp_addr, jmp_last);
+    cpu->tlb_stats.page_flushes++;
+}
+
+static void tlb_flush_page_nocheck(CPUState *cpu, target_ulong addr)
+{
+    addr &= TARGET_PAGE_MASK;
+    tlb_flush_range_by_mmuidx_nocheck(cpu, addr, addr | ~TARGET_PAGE_MASK,
+                                      ALL_MMUIDX_BITS);
+}
+
+void tlb_flush_page(CPUState *cpu, target_ulong addr)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        tlb_flush_queue_add(cpu, addr & TARGET_PAGE_MASK, ALL_MMUIDX_BITS,
+                            false);
+    } else {
+        tlb_flush_page_nocheck(cpu, addr);
+    }
+}
+
+void tlb_flush_page_all_cpus(CPUState *src_cpu, target_ulong addr)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        tlb_flush_page(cpu, addr);
+    }
+}
+
+void tlb_flush_page_all_cpus_synced(CPUState *src_cpu, target_ulong addr)
+{
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_page(cpu, addr);
         }
     }
+    tlb_flush_queue_add_synced(src_cpu, addr & TARGET_PAGE_MASK,
+                               ALL_MMUIDX_BITS, false);
+}
 
-    tb_flush_jmp_cache(cpu, addr);
+static void tlb_flush_page_by_mmuidx_nocheck(CPUState *cpu, target_ulong addr,
+                                             unsigned long idxmap)
+{
+    addr &= TARGET_PAGE_MASK;
+    tlb_flush_range_by_mmuidx_nocheck(cpu, addr, addr | ~TARGET_PAGE_MASK,
+                                      idxmap);
+}
+
+static void tlb_flush_page_by_idxmap(CPUState *cpu, target_ulong addr,
+                                     unsigned long idxmap)
+{
+    if (tlb_flush_is_remote(cpu)) {
+        tlb_flush_queue_add(cpu, addr & TARGET_PAGE_MASK, idxmap, false);
+    } else {
+        tlb_flush_page_by_mmuidx_nocheck(cpu, addr, idxmap);
+    }
 }
 
 void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...)
 {
-    CPUArchState *env = cpu->env_ptr;
-    int i, k;
+    unsigned long idxmap;
     va_list argp;
 
     va_start(argp, addr);
+    idxmap = tlb_idxmap_from_va(argp);
+    va_end(argp);
 
-#if defined(DEBUG_TLB)
-    printf("tlb_flush_page_by_mmu_idx: " TARGET_FMT_lx, addr);
-#endif
-    /* Check if we need to flush due to large pages.  */
-    if ((addr & env->tlb_flush_mask) == env->tlb_flush_addr) {
-#if defined(DEBUG_TLB)
-        printf(" forced full flush ("
-               TARGET_FMT_lx "/" TARGET_FMT_lx ")\n",
-               env->tlb_flush_addr, env->tlb_flush_mask);
-#endif
-        v_tlb_flush_by_mmuidx(cpu, argp);
-        va_end(argp);
-        return;
+    tlb_flush_page_by_idxmap(cpu, addr, idxmap);
+}
+
+void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                       ...)
+{
+    CPUState *cpu;
+    unsigned long idxmap;
+    va_list argp;
+
+    va_start(argp, addr);
+    idxmap = tlb_idxmap_from_va(argp);
+    va_end(argp);
+
+    CPU_FOREACH(cpu) {
+        tlb_flush_page_by_idxmap(cpu, addr, idxmap);
     }
-    /* must reset current TB so that interrupts cannot modify the
-       links while we are modifying them */
-    cpu->current_tb = NULL;
+}
 
-    addr &= TARGET_PAGE_MASK;
-    i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                              target_ulong addr, ...)
+{
+    CPUState *cpu;
+    unsigned long idxmap;
+    va_list argp;
 
-    for (;;) {
-        int mmu_idx = va_arg(argp, int);
+    va_start(argp, addr);
+    idxmap = tlb_idxmap_from_va(argp);
+    va_end(argp);
 
-        if (mmu_idx < 0) {
-            break;
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            tlb_flush_page_by_idxmap(cpu, addr, idxmap);
         }
+    }
+    tlb_flush_queue_add_synced(src_cpu, addr & TARGET_PAGE_MASK, idxmap,
+                               false);
+}
 
-#if defined(DEBUG_TLB)
-        printf(" %d", mmu_idx);
-#endif
+static void tlb_flush_range_by_idxmap(CPUState *cpu, target_ulong addr,
+                                      target_ulong len, unsigned long idxmap)
+{
+    target_ulong last;
 
-        tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+    if (len == 0) {
+        return;
+    }
+    last = addr + len - 1;
+    if (last < addr) {
+        last = -1;
+    }
+    addr &= TARGET_PAGE_MASK;
+    last |= ~TARGET_PAGE_MASK;
 
-        /* check whether there are vltb entries that need to be flushed */
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
-            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+    if (tlb_flush_is_remote(cpu)) {
+        target_ulong npages_m1 = (last - addr) >> TARGET_PAGE_BITS;
+        target_ulong i;
+
+        if (npages_m1 >= TLB_FLUSH_QUEUE_PAGES) {
+            tlb_flush_queue_add(cpu, 0, idxmap, true);
+            return;
         }
+        for (i = 0; i <= npages_m1; i++) {
+            tlb_flush_queue_add(cpu, addr + (i << TARGET_PAGE_BITS), idxmap,
+                                false);
+        }
+    } else {
+        tlb_flush_range_by_mmuidx_nocheck(cpu, addr, last, idxmap);
     }
-    va_end(argp);
-
-#if defined(DEBUG_TLB)
-    printf("\n");
-#endif
+}
 
-    tb_flush_jmp_cache(cpu, addr);
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len)
+{
+    tlb_flush_range_by_idxmap(cpu, addr, len, ALL_MMUIDX_BITS);
 }
 
 /* update the TLBs so that writes to code in the virtual page 'addr'
@@ -243,10 +727,19 @@ void tlb_reset_dirty_range(CPUTLBEntry *tlb_entry, uintptr_t start,
 {
     uintptr_t addr;
 
+    /* This may race with the owning vCPU refilling the entry when TCG
+       is multi-threaded, so only set the flag if the entry is unchanged.  */
     if (tlb_is_dirty_ram(tlb_entry)) {
-        addr = (tlb_entry->addr_write & TARGET_PAGE_MASK) + tlb_entry->addend;
+        target_ulong orig_addr = atomic_read(&tlb_entry->addr_write);
+
+        addr = (orig_addr & TARGET_PAGE_MASK) + tlb_entry->addend;
         if ((addr - start) < length) {
+#if TCG_OVERSIZED_GUEST
             tlb_entry->addr_write |= TLB_NOTDIRTY;
+#else
+            atomic_cmpxchg(&tlb_entry->addr_write, orig_addr,
+                           orig_addr | TLB_NOTDIRTY);
+#endif
         }
     }
 }
@@ -272,7 +765,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         unsigned int i;
 
-        for (i = 0; i < CPU_TLB_SIZE; i++) {
+        for (i = 0; i < tlb_n_entries(env, mmu_idx); i++) {
             tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                   start1, length);
         }
@@ -296,13 +789,11 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
 void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 {
     CPUArchState *env = cpu->env_ptr;
-    int i;
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
-    i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
-        tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        tlb_set_dirty1(tlb_entry(env, mmu_idx, vaddr), vaddr);
     }
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
@@ -314,31 +805,33 @@ void tlb_set_dirty(CPUState *cpu, target_ulong vaddr)
 }
 
 /* Our TLB does not support large pages, so remember the area covered by
-   large pages and trigger a full TLB flush if these are invalidated.  */
-static void tlb_add_large_page(CPUArchState *env, target_ulong vaddr,
-                               target_ulong size)
+   large pages in each MMU mode, and flush all of it when any page in it
+   is invalidated.  */
+static void tlb_add_large_page(CPUArchState *env, int mmu_idx,
+                               target_ulong vaddr, target_ulong size)
 {
+    CPUTLBDesc *desc = &env->tlb_d[mmu_idx];
     target_ulong mask = ~(size - 1);
 
-    if (env->tlb_flush_addr == (target_ulong)-1) {
-        env->tlb_flush_addr = vaddr & mask;
-        env->tlb_flush_mask = mask;
+    if (desc->large_page_addr == (target_ulong)-1) {
+        desc->large_page_addr = vaddr & mask;
+        desc->large_page_mask = mask;
         return;
     }
     /* Extend the existing region to include the new page.
        This is a compromise between unnecessary flushes and the cost
        of maintaining a full variable size TLB.  */
-    mask &= env->tlb_flush_mask;
-    while (((env->tlb_flush_addr ^ vaddr) & mask) != 0) {
+    mask &= desc->large_page_mask;
+    while (((desc->large_page_addr ^ vaddr) & mask) != 0) {
         mask <<= 1;
     }
-    env->tlb_flush_addr &= mask;
-    env->tlb_flush_mask = mask;
+    desc->large_page_addr &= mask;
+    desc->large_page_mask = mask;
 }
 
 /* Add a new TLB entry. At most one entry for a given virtual address
  * is permitted. Only a single TARGET_PAGE_SIZE region is mapped, the
- * supplied size is only used by tlb_flush_page.
+ * supplied size is only used by tlb_flush_page and tlb_flush_range.
  *
  * Called from TCG-generated code, which is under an RCU read-side
  * critical section.
@@ -360,7 +853,7 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
 
     assert(size >= TARGET_PAGE_SIZE);
     if (size != TARGET_PAGE_SIZE) {
-        tlb_add_large_page(env, vaddr, size);
+        tlb_add_large_page(env, mmu_idx, vaddr, size);
     }
 
     sz = size;
@@ -388,8 +881,11 @@ void tlb_set_page_with_attrs(CPUState *cpu, target_ulong vaddr,
     iotlb = memory_region_section_get_iotlb(cpu, section, vaddr, paddr, xlat,
                                             prot, &address);
 
-    index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    index = tlb_index(env, mmu_idx, vaddr);
     te = &env->tlb_table[mmu_idx][index];
+    if (tlb_entry_is_empty(te)) {
+        env->tlb_d[mmu_idx].n_used_entries++;
+    }
 
     /* do not discard the translation in te, evict it into a victim tlb */
     env->tlb_v_table[mmu_idx][vidx] = *te;
@@ -438,6 +934,45 @@ void tlb_set_page(CPUState *cpu, target_ulong vaddr,
                             prot, mmu_idx, size);
 }
 
+TlbStatsList *qmp_query_tlb_stats(Error **errp)
+{
+    TlbStatsList *head = NULL, **tail = &head;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        CPUArchState *env = cpu->env_ptr;
+        TlbStatsList *elem = g_new0(TlbStatsList, 1);
+        TlbStats *st = g_new0(TlbStats, 1);
+        intList **etail = &st->entries;
+        int mmu_idx;
+
+        /* The counters are updated without locking by the vCPU thread,
+           so the values may be slightly stale.  */
+        st->cpu_index = cpu->cpu_index;
+        st->hits = cpu->tlb_stats.hits;
+        st->misses = cpu->tlb_stats.misses;
+        st->victim_hits = cpu->tlb_stats.victim_hits;
+        st->full_flushes = cpu->tlb_stats.full_flushes;
+        st->page_flushes = cpu->tlb_stats.page_flushes;
+        st->mmio = cpu->tlb_stats.mmio;
+        st->resizes = cpu->tlb_stats.resizes;
+
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            intList *e = g_new0(intList, 1);
+
+            e->value = tlb_n_entries(env, mmu_idx);
+            *etail = e;
+            etail = &e->next;
+        }
+
+        elem->value = st;
+        *tail = elem;
+        tail = &elem->next;
+    }
+
+    return head;
+}
+
 /* NOTE: this function can trigger an exception */
 /* NOTE2: the returned address is not exactly the physical address: it
  * is actually a ram_addr_t (in system mode; the user mode emulation
@@ -451,11 +986,12 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
     CPUState *cpu = ENV_GET_CPU(env1);
     CPUIOTLBEntry *iotlbentry;
 
-    page_index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
     mmu_idx = cpu_mmu_index(env1, true);
+    page_index = tlb_index(env1, mmu_idx, addr);
     if (unlikely(env1->tlb_table[mmu_idx][page_index].addr_code !=
                  (addr & TARGET_PAGE_MASK))) {
         cpu_ldub_code(env1, addr);
+        page_index = tlb_index(env1, mmu_idx, addr);
     }
     iotlbentry = &env1->iotlb[mmu_idx][page_index];
     pd = iotlbentry->addr & ~TARGET_PAGE_MASK;
@@ -489,6 +1025,146 @@ tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 #include "softmmu_template.h"
 #undef MMUSUFFIX
 
+/* Probe for a read-modify-write atomic operation.  Fault in both read
+   and write permission, as the non-atomic load and store would, and
+   return the host address of the data, or NULL when the access has to
+   go through the I/O path: MMIO, pages that need dirty tracking, or a
+   misaligned address.  */
+static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                               TCGMemOpIdx oi, int size, uintptr_t retaddr)
+{
+    size_t mmu_idx = get_mmuidx(oi);
+    int index = tlb_index(env, mmu_idx, addr);
+    CPUTLBEntry *tlbe = &env->tlb_table[mmu_idx][index];
+    target_ulong tlb_addr;
+
+    if (unlikely(addr & (size - 1))) {
+        if ((get_memop(oi) & MO_AMASK) == MO_ALIGN) {
+            cpu_unaligned_access(ENV_GET_CPU(env), addr, MMU_DATA_STORE,
+                                 mmu_idx, retaddr);
+        }
+        return NULL;
+    }
+
+    tlb_addr = tlbe->addr_read;
+    if ((addr & TARGET_PAGE_MASK)
+        != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+        if (!VICTIM_TLB_HIT(addr_read)) {
+            ENV_GET_CPU(env)->tlb_stats.misses++;
+            tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_LOAD, mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
+            tlbe = &env->tlb_table[mmu_idx][index];
+        }
+    }
+
+    tlb_addr = tlbe->addr_write;
+    if ((addr & TARGET_PAGE_MASK)
+        != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+        if (!VICTIM_TLB_HIT(addr_write)) {
+            ENV_GET_CPU(env)->tlb_stats.misses++;
+            tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
+            tlbe = &env->tlb_table[mmu_idx][index];
+        }
+        tlb_addr = tlbe->addr_write;
+    }
+
+    if (unlikely(tlb_addr & ~TARGET_PAGE_MASK)
+        || unlikely(tlbe->addr_read != tlb_addr)) {
+        return NULL;
+    }
+    return (void *)((uintptr_t)addr + tlbe->addend);
+}
+
+#define atomic_mmu_cleanup()  do { } while (0)
+
+/* With multi-threaded TCG, serialize the slow path with the BQL.  Every
+   vCPU doing an atomic operation on the same MMIO or misaligned location
+   comes through here.  If an exception is raised while the lock is held,
+   cpu_exec drops it.  */
+static bool atomic_slow_lock(void)
+{
+    if (qemu_tcg_mttcg_enabled() && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
+static void atomic_slow_unlock(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
+static uint64_t atomic_slow_ld(CPUArchState *env, target_ulong addr,
+                               TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    switch (get_memop(oi) & (MO_BSWAP | MO_SIZE)) {
+    case MO_UB:
+        return helper_ret_ldub_mmu(env, addr, oi, retaddr);
+    case MO_LEUW:
+        return helper_le_lduw_mmu(env, addr, oi, retaddr);
+    case MO_LEUL:
+        return helper_le_ldul_mmu(env, addr, oi, retaddr);
+    case MO_LEQ:
+        return helper_le_ldq_mmu(env, addr, oi, retaddr);
+    case MO_BEUW:
+        return helper_be_lduw_mmu(env, addr, oi, retaddr);
+    case MO_BEUL:
+        return helper_be_ldul_mmu(env, addr, oi, retaddr);
+    case MO_BEQ:
+        return helper_be_ldq_mmu(env, addr, oi, retaddr);
+    default:
+        tcg_abort();
+    }
+}
+
+static void atomic_slow_st(CPUArchState *env, target_ulong addr, uint64_t val,
+                           TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    switch (get_memop(oi) & (MO_BSWAP | MO_SIZE)) {
+    case MO_UB:
+        helper_ret_stb_mmu(env, addr, val, oi, retaddr);
+        break;
+    case MO_LEUW:
+        helper_le_stw_mmu(env, addr, val, oi, retaddr);
+        break;
+    case MO_LEUL:
+        helper_le_stl_mmu(env, addr, val, oi, retaddr);
+        break;
+    case MO_LEQ:
+        helper_le_stq_mmu(env, addr, val, oi, retaddr);
+        break;
+    case MO_BEUW:
+        helper_be_stw_mmu(env, addr, val, oi, retaddr);
+        break;
+    case MO_BEUL:
+        helper_be_stl_mmu(env, addr, val, oi, retaddr);
+        break;
+    case MO_BEQ:
+        helper_be_stq_mmu(env, addr, val, oi, retaddr);
+        break;
+    default:
+        tcg_abort();
+    }
+}
+
+#define DATA_SIZE 1
+#include "atomic_template.h"
+
+#define DATA_SIZE 2
+#include "atomic_template.h"
+
+#define DATA_SIZE 4
+#include "atomic_template.h"
+
+#ifdef CONFIG_ATOMIC64
+#define DATA_SIZE 8
+#include "atomic_template.h"
+#endif
+
 #define MMUSUFFIX _cmmu
 #undef GETPC_ADJ
 #define GETPC_ADJ 0
@@ -84,6 +84,9 @@ this code that are retained.
  */
 #include "qemu/osdep.h"
 
+#include <float.h>
+#include <math.h>
+
 #include "fpu/softfloat.h"
 
 /* We only need stdlib for abort() */
@@ -540,6 +543,77 @@ float64 float64_squash_input_denormal(float64 a, float_status *status)
     return a;
 }
 
+/*----------------------------------------------------------------------------
+| Host FPU fast path.  When rounding to nearest-even with the inexact flag
+| already raised, an operation on zero or normal inputs that produces a
+| normal (or exactly zero) result gives the same value and the same flags on
+| the host FPU as in software, so it can be done natively.  Anything else,
+| i.e. infinities, NaNs, denormals, overflow and underflow, or a guest that
+| still has to see the inexact flag being raised, goes through the software
+| implementation below.
+|
+| This relies on the host computing in the precision of the type, without
+| the excess precision of the x87, and in the default rounding mode.
+*----------------------------------------------------------------------------*/
+#if defined(__FAST_MATH__) || !defined(FLT_EVAL_METHOD) || FLT_EVAL_METHOD != 0
+#define QEMU_NO_HARDFLOAT 1
+#else
+#define QEMU_NO_HARDFLOAT 0
+#endif
+
+typedef union {
+    float32 s;
+    float h;
+} union_float32;
+
+typedef union {
+    float64 s;
+    double h;
+} union_float64;
+
+static inline bool can_use_hardfloat(const float_status *s)
+{
+    if (QEMU_NO_HARDFLOAT) {
+        return false;
+    }
+    return likely(s->float_rounding_mode == float_round_nearest_even &&
+                  (s->float_exception_flags & float_flag_inexact));
+}
+
+static inline bool float32_is_zero_or_normal(float32 a)
+{
+    return float32_is_zero(a) ||
+        (extractFloat32Exp(a) != 0 && extractFloat32Exp(a) != 0xFF);
+}
+
+static inline bool float64_is_zero_or_normal(float64 a)
+{
+    return float64_is_zero(a) ||
+        (extractFloat64Exp(a) != 0 && extractFloat64Exp(a) != 0x7FF);
+}
+
+/* A host result is only usable if it is neither an overflow nor a possible
+   underflow.  ZERO_OK tells whether a zero result is known to be exact.  */
+static inline bool float32_hard_result_ok(float r, bool zero_ok)
+{
+    float ar = fabsf(r);
+
+    if (unlikely(ar <= FLT_MIN)) {
+        return zero_ok && ar == 0;
+    }
+    return likely(ar <= FLT_MAX);
+}
+
+static inline bool float64_hard_result_ok(double r, bool zero_ok)
+{
+    double ar = fabs(r);
+
+    if (unlikely(ar <= DBL_MIN)) {
+        return zero_ok && ar == 0;
+    }
+    return likely(ar <= DBL_MAX);
+}
+
 /*----------------------------------------------------------------------------
 | Normalizes the subnormal double-precision floating-point value represented
 | by the denormalized significand `aSig'.  The normalized exponent and
@@ -2167,6 +2241,19 @@ static float32 subFloat32Sigs(float32 a, float32 b, flag zSign,
 float32 float32_add(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        if (float32_hard_result_ok(ur.h, true)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2190,6 +2277,19 @@ float32 float32_add(float32 a, float32 b, float_status *status)
 float32 float32_sub(float32 a, float32 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        if (float32_hard_result_ok(ur.h, true)) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2218,6 +2318,19 @@ float32 float32_mul(float32 a, float32 b, float_status *status)
     uint64_t zSig64;
     uint32_t zSig;
 
+    if (can_use_hardfloat(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (float32_hard_result_ok(ur.h, float32_is_zero(a) ||
+                                   float32_is_zero(b))) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2280,6 +2393,19 @@ float32 float32_div(float32 a, float32 b, float_status *status)
     flag aSign, bSign, zSign;
     int aExp, bExp, zExp;
     uint32_t aSig, bSig, zSig;
+
+    if (can_use_hardfloat(status) && float32_is_zero_or_normal(a)
+        && float32_is_zero_or_normal(b) && !float32_is_zero(b)) {
+        union_float32 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (float32_hard_result_ok(ur.h, float32_is_zero(a))) {
+            return ur.s;
+        }
+    }
+
     a = float32_squash_input_denormal(a, status);
     b = float32_squash_input_denormal(b, status);
 
@@ -2679,6 +2805,16 @@ float32 float32_sqrt(float32 a, float_status *status)
     int aExp, zExp;
     uint32_t aSig, zSig;
     uint64_t rem, term;
+
+    if (can_use_hardfloat(status) && float32_is_zero_or_normal(a)
+        && !extractFloat32Sign(a)) {
+        union_float32 ua, ur;
+
+        ua.s = a;
+        ur.h = sqrtf(ua.h);
+        return ur.s;
+    }
+
     a = float32_squash_input_denormal(a, status);
 
     aSig = extractFloat32Frac( a );
@@ -3958,6 +4094,19 @@ static float64 subFloat64Sigs(float64 a, float64 b, flag zSign,
 float64 float64_add(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h + ub.h;
+        if (float64_hard_result_ok(ur.h, true)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -3981,6 +4130,19 @@ float64 float64_add(float64 a, float64 b, float_status *status)
 float64 float64_sub(float64 a, float64 b, float_status *status)
 {
     flag aSign, bSign;
+
+    if (can_use_hardfloat(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h - ub.h;
+        if (float64_hard_result_ok(ur.h, true)) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4007,6 +4169,19 @@ float64 float64_mul(float64 a, float64 b, float_status *status)
     int aExp, bExp, zExp;
     uint64_t aSig, bSig, zSig0, zSig1;
 
+    if (can_use_hardfloat(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h * ub.h;
+        if (float64_hard_result_ok(ur.h, float64_is_zero(a) ||
+                                   float64_is_zero(b))) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4071,6 +4246,19 @@ float64 float64_div(float64 a, float64 b, float_status *status)
     uint64_t aSig, bSig, zSig;
     uint64_t rem0, rem1;
     uint64_t term0, term1;
+
+    if (can_use_hardfloat(status) && float64_is_zero_or_normal(a)
+        && float64_is_zero_or_normal(b) && !float64_is_zero(b)) {
+        union_float64 ua, ub, ur;
+
+        ua.s = a;
+        ub.s = b;
+        ur.h = ua.h / ub.h;
+        if (float64_hard_result_ok(ur.h, float64_is_zero(a))) {
+            return ur.s;
+        }
+    }
+
     a = float64_squash_input_denormal(a, status);
     b = float64_squash_input_denormal(b, status);
 
@@ -4483,6 +4671,16 @@ float64 float64_sqrt(float64 a, float_status *status)
     int aExp, zExp;
     uint64_t aSig, zSig, doubleZSig;
     uint64_t rem0, rem1, term0, term1;
+
+    if (can_use_hardfloat(status) && float64_is_zero_or_normal(a)
+        && !extractFloat64Sign(a)) {
+        union_float64 ua, ur;
+
+        ua.s = a;
+        ur.h = sqrt(ua.h);
+        return ur.s;
+    }
+
     a = float64_squash_input_denormal(a, status);
 
     aSig = extractFloat64Frac( a );
@@ -288,6 +288,35 @@ STEXI
 @item info jit
 @findex jit
 Show dynamic compiler info.
+ETEXI
+
+    {
+        .name       = "tlb-stats",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show softmmu TLB statistics for each CPU",
+        .mhandler.cmd = hmp_info_tlb_stats,
+    },
+
+STEXI
+@item info tlb-stats
+@findex tlb-stats
+Show softmmu TLB statistics for each CPU.
+ETEXI
+
+    {
+        .name       = "tb-profile",
+        .args_type  = "top:i?",
+        .params     = "[N]",
+        .help       = "show the N (default 20) most executed translation blocks",
+        .mhandler.cmd = hmp_info_tb_profile,
+    },
+
+STEXI
+@item info tb-profile [@var{N}]
+@findex tb-profile
+Show the @var{N} (default 20) most executed translation blocks.  Requires
+@option{-accel tcg,profile=on}.
 ETEXI
 
     {
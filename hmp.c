@@ -345,6 +345,63 @@ void hmp_info_cpus(Monitor *mon, const QDict *qdict)
     qapi_free_CpuInfoList(cpu_list);
 }
 
+void hmp_info_tlb_stats(Monitor *mon, const QDict *qdict)
+{
+    TlbStatsList *list, *cpu;
+    intList *e;
+
+    list = qmp_query_tlb_stats(NULL);
+
+    for (cpu = list; cpu; cpu = cpu->next) {
+        TlbStats *st = cpu->value;
+
+        monitor_printf(mon, "CPU #%" PRId64 ":\n", st->cpu_index);
+        monitor_printf(mon, "  hits (slow path)  %" PRId64 "\n", st->hits);
+        monitor_printf(mon, "  misses            %" PRId64 "\n", st->misses);
+        monitor_printf(mon, "  victim hits       %" PRId64 "\n",
+                       st->victim_hits);
+        monitor_printf(mon, "  full flushes      %" PRId64 "\n",
+                       st->full_flushes);
+        monitor_printf(mon, "  page flushes      %" PRId64 "\n",
+                       st->page_flushes);
+        monitor_printf(mon, "  mmio accesses     %" PRId64 "\n", st->mmio);
+        monitor_printf(mon, "  resizes           %" PRId64 "\n", st->resizes);
+        monitor_printf(mon, "  entries          ");
+        for (e = st->entries; e; e = e->next) {
+            monitor_printf(mon, " %" PRId64, e->value);
+        }
+        monitor_printf(mon, "\n");
+    }
+
+    qapi_free_TlbStatsList(list);
+}
+
+void hmp_info_tb_profile(Monitor *mon, const QDict *qdict)
+{
+    TbProfileList *list, *e;
+    Error *err = NULL;
+    bool has_top = qdict_haskey(qdict, "top");
+    int64_t top = qdict_get_try_int(qdict, "top", 0);
+
+    list = qmp_query_tb_profile(has_top, top, &err);
+    if (err) {
+        hmp_handle_error(mon, &err);
+        return;
+    }
+
+    monitor_printf(mon, "%-18s %14s %6s %6s\n",
+                   "guest pc", "count", "guest", "host");
+    for (e = list; e; e = e->next) {
+        TbProfile *p = e->value;
+
+        monitor_printf(mon, "0x%016" PRIx64 " %14" PRId64 " %6" PRId64
+                       " %6" PRId64 "%s\n", p->pc, p->count, p->guest_size,
+                       p->host_size, p->trace ? " trace" : "");
+    }
+
+    qapi_free_TbProfileList(list);
+}
+
 static void print_block_info(Monitor *mon, BlockInfo *info,
                              BlockDeviceInfo *inserted, bool verbose)
 {
@@ -2007,8 +2064,18 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
     IOThreadInfoList *info;
 
     for (info = info_list; info; info = info->next) {
+        IOThreadInfo *value = info->value;
+
         monitor_printf(mon, "%s: thread_id=%" PRId64 "\n",
-                       info->value->id, info->value->thread_id);
+                       value->id, value->thread_id);
+        monitor_printf(mon, "  poll-max-ns=%" PRId64 " poll-grow=%" PRId64
+                       " poll-shrink=%" PRId64 "\n",
+                       value->poll_max_ns, value->poll_grow,
+                       value->poll_shrink);
+        monitor_printf(mon, "  poll-ns=%" PRId64 " poll-attempts=%" PRId64
+                       " poll-successes=%" PRId64 "\n",
+                       value->poll_ns, value->poll_attempts,
+                       value->poll_successes);
     }
 
     qapi_free_IOThreadInfoList(info_list);
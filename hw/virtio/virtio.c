@@ -1786,12 +1786,34 @@ static void virtio_queue_host_notifier_read(EventNotifier *n)
     }
 }
 
+static bool virtio_queue_host_notifier_aio_poll(void *opaque)
+{
+    EventNotifier *n = opaque;
+    VirtQueue *vq = container_of(n, VirtQueue, host_notifier);
+    uint16_t last_avail_idx;
+
+    if (!vq->vring.desc || virtio_queue_empty(vq)) {
+        return false;
+    }
+
+    /* Some queues hold buffers that the device only consumes on its own
+     * schedule, e.g. the virtio-scsi event queue.  Report progress only
+     * if the handler actually popped something, or aio_poll would keep
+     * spinning on a queue that never drains.
+     */
+    last_avail_idx = vq->last_avail_idx;
+    virtio_queue_notify_vq(vq);
+    return vq->last_avail_idx != last_avail_idx;
+}
+
 void virtio_queue_aio_set_host_notifier_handler(VirtQueue *vq, AioContext *ctx,
                                                 bool assign, bool set_handler)
 {
     if (assign && set_handler) {
         aio_set_event_notifier(ctx, &vq->host_notifier, true,
                                virtio_queue_host_notifier_read);
+        aio_set_event_notifier_poll(ctx, &vq->host_notifier,
+                                    virtio_queue_host_notifier_aio_poll);
     } else {
         aio_set_event_notifier(ctx, &vq->host_notifier, true, NULL);
     }
@@ -47,6 +47,7 @@ void qemu_aio_ref(void *p);
 typedef struct AioHandler AioHandler;
 typedef void QEMUBHFunc(void *opaque);
 typedef void IOHandler(void *opaque);
+typedef bool AioPollFn(void *opaque);
 
 struct AioContext {
     GSource source;
@@ -63,6 +64,11 @@ struct AioContext {
      */
     int walking_handlers;
 
+    /* Number of handlers marked deleted while walking_handlers was held,
+     * and not freed yet.
+     */
+    int deleted_handlers;
+
     /* Used to avoid unnecessary event_notifier_set calls in aio_notify;
      * accessed with atomic primitives.  If this field is 0, everything
      * (file descriptors, bottom halves, timers) will be re-evaluated
@@ -129,6 +135,24 @@ struct AioContext {
     int epollfd;
     bool epoll_enabled;
     bool epoll_available;
+
+    /* Adaptive polling.  Before blocking, aio_poll() calls the io_poll
+     * callbacks of the handlers for up to poll_ns nanoseconds.  poll_ns
+     * grows by poll_grow while events keep arriving within poll_max_ns of
+     * the start of the wait, and shrinks by poll_shrink when they do not.
+     * poll_max_ns == 0 disables polling.
+     */
+    int64_t poll_ns;
+    int64_t poll_max_ns;
+    int64_t poll_grow;
+    int64_t poll_shrink;
+
+    /* Number of handlers with an io_poll callback */
+    int poll_handlers;
+
+    /* Statistics: polling phases run, and those that found work */
+    uint64_t poll_attempts;
+    uint64_t poll_successes;
 };
 
 /**
@@ -328,6 +352,21 @@ void aio_set_event_notifier(AioContext *ctx,
                             bool is_external,
                             EventNotifierHandler *io_read);
 
+/* Set a callback that aio_poll() can busy-wait on before blocking in the
+ * kernel.  @io_poll must be cheap: it checks whether work is ready (e.g. a
+ * virtqueue or a completion ring is non-empty) and, if so, processes it and
+ * returns true.  The fd must already have a handler registered with
+ * aio_set_fd_handler(); the callback goes away together with the handler.
+ */
+void aio_set_fd_poll(AioContext *ctx, int fd, AioPollFn *io_poll);
+
+/* Like aio_set_fd_poll(), for an event notifier registered with
+ * aio_set_event_notifier().  @io_poll receives the notifier as its opaque.
+ */
+void aio_set_event_notifier_poll(AioContext *ctx,
+                                 EventNotifier *notifier,
+                                 AioPollFn *io_poll);
+
 /* Return a GSource that lets the main loop poll the file descriptors attached
  * to this AioContext.
  */
@@ -442,4 +481,16 @@ static inline bool aio_node_check(AioContext *ctx, bool is_external)
  */
 void aio_context_setup(AioContext *ctx, Error **errp);
 
+/**
+ * aio_context_set_poll_params:
+ * @ctx: the aio context
+ * @max_ns: how long to busy poll for, in nanoseconds (0 disables polling)
+ * @grow: polling time growth factor (0 selects the default of 2)
+ * @shrink: polling time shrink factor (0 resets polling time to 0)
+ *
+ * Configure adaptive polling before blocking in aio_poll().
+ */
+void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
+                                 int64_t grow, int64_t shrink, Error **errp);
+
 #endif
@@ -85,6 +85,17 @@ typedef uint64_t target_ulong;
  * 0x18 (the offset of the addend field in each TLB entry) plus the offset
  * of tlb_table inside env (which is non-trivial but not huge).
  */
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+/* Backends that set TCG_TARGET_IMPLEMENTS_DYN_TLB load the index mask
+ * from env->tlb_mask[] instead of using a constant, so the number of
+ * entries in use can change at every full flush (see cputlb.c).  The
+ * arrays are still allocated for the largest size, CPU_TLB_SIZE.
+ */
+#define CPU_TLB_DYN_MIN_BITS 6
+#define CPU_TLB_DYN_DEFAULT_BITS 8
+#define CPU_TLB_DYN_MAX_BITS 12
+#define CPU_TLB_BITS CPU_TLB_DYN_MAX_BITS
+#else
 #define CPU_TLB_BITS                                             \
     MIN(8,                                                       \
         TCG_TARGET_TLB_DISPLACEMENT_BITS - CPU_TLB_ENTRY_BITS -  \
@@ -92,6 +103,7 @@ typedef uint64_t target_ulong;
          NB_MMU_MODES <= 2 ? 1 :                                 \
          NB_MMU_MODES <= 4 ? 2 :                                 \
          NB_MMU_MODES <= 8 ? 3 : 4))
+#endif
 
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
@@ -128,14 +140,38 @@ typedef struct CPUIOTLBEntry {
     MemTxAttrs attrs;
 } CPUIOTLBEntry;
 
+/* Bookkeeping for sizing the TLB of one MMU index.  Only the owning
+ * vCPU updates it.
+ */
+typedef struct CPUTLBDesc {
+    /* Valid entries in tlb_table, i.e. main TLB slots filled since the
+       last full flush.  */
+    size_t n_used_entries;
+    /* Largest n_used_entries seen in the current window.  */
+    size_t window_max_entries;
+    int64_t window_begin_ns;
+    /* Region covered by the large pages entered since the last flush
+       that covered them, or -1 if there are none.  */
+    target_ulong large_page_addr;
+    target_ulong large_page_mask;
+} CPUTLBDesc;
+
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+#define CPU_COMMON_TLB_MASK \
+    /* (number of entries in use - 1) << CPU_TLB_ENTRY_BITS */          \
+    uintptr_t tlb_mask[NB_MMU_MODES];
+#else
+#define CPU_COMMON_TLB_MASK
+#endif
+
 #define CPU_COMMON_TLB \
     /* The meaning of the MMU modes is defined in the target code. */   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
     CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
     CPUIOTLBEntry iotlb[NB_MMU_MODES][CPU_TLB_SIZE];                    \
     CPUIOTLBEntry iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];                 \
-    target_ulong tlb_flush_addr;                                        \
-    target_ulong tlb_flush_mask;                                        \
+    CPU_COMMON_TLB_MASK                                                 \
+    CPUTLBDesc tlb_d[NB_MMU_MODES];                                     \
     target_ulong vtlb_index;                                            \
 
 #else
@@ -113,6 +113,35 @@
 /* The memory helpers for tcg-generated code need tcg_target_long etc.  */
 #include "tcg.h"
 
+static inline bool tlb_entry_is_empty(const CPUTLBEntry *te)
+{
+    return te->addr_read == -1 && te->addr_write == -1 && te->addr_code == -1;
+}
+
+/* Number of entries in the TLB of MMU_IDX; with a backend that
+   implements TCG_TARGET_IMPLEMENTS_DYN_TLB this changes at flush time.  */
+static inline size_t tlb_n_entries(CPUArchState *env, uintptr_t mmu_idx)
+{
+#if TCG_TARGET_IMPLEMENTS_DYN_TLB
+    return (env->tlb_mask[mmu_idx] >> CPU_TLB_ENTRY_BITS) + 1;
+#else
+    return CPU_TLB_SIZE;
+#endif
+}
+
+/* Index of the TLB entry for ADDR in the TLB of MMU_IDX.  */
+static inline uintptr_t tlb_index(CPUArchState *env, uintptr_t mmu_idx,
+                                  target_ulong addr)
+{
+    return (addr >> TARGET_PAGE_BITS) & (tlb_n_entries(env, mmu_idx) - 1);
+}
+
+static inline CPUTLBEntry *tlb_entry(CPUArchState *env, uintptr_t mmu_idx,
+                                     target_ulong addr)
+{
+    return &env->tlb_table[mmu_idx][tlb_index(env, mmu_idx, addr)];
+}
+
 #ifdef MMU_MODE0_SUFFIX
 #define CPU_MMU_INDEX 0
 #define MEMSUFFIX MMU_MODE0_SUFFIX
@@ -403,8 +432,7 @@ static inline void *tlb_vaddr_to_host(CPUArchState *env, target_ulong addr,
 #if defined(CONFIG_USER_ONLY)
     return g2h(vaddr);
 #else
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    CPUTLBEntry *tlbentry = &env->tlb_table[mmu_idx][index];
+    CPUTLBEntry *tlbentry = tlb_entry(env, mmu_idx, addr);
     target_ulong tlb_addr;
     uintptr_t haddr;
 
@@ -433,7 +461,7 @@ static inline void *tlb_vaddr_to_host(CPUArchState *env, target_ulong addr,
         return NULL;
     }
 
-    haddr = addr + env->tlb_table[mmu_idx][index].addend;
+    haddr = addr + tlbentry->addend;
     return (void *)haddr;
 #endif /* defined(CONFIG_USER_ONLY) */
 }
@@ -78,6 +78,7 @@ void QEMU_NORETURN cpu_io_recompile(CPUState *cpu, uintptr_t retaddr);
 TranslationBlock *tb_gen_code(CPUState *cpu,
                               target_ulong pc, target_ulong cs_base, int flags,
                               int cflags);
+void tb_gen_trace(CPUState *cpu, TranslationBlock *tb);
 void cpu_exec_init(CPUState *cpu, Error **errp);
 void QEMU_NORETURN cpu_loop_exit(CPUState *cpu);
 void QEMU_NORETURN cpu_loop_exit_restore(CPUState *cpu, uintptr_t pc);
@@ -153,6 +154,93 @@ void tlb_flush_page_by_mmuidx(CPUState *cpu, target_ulong addr, ...);
  * MMU indexes.
  */
 void tlb_flush_by_mmuidx(CPUState *cpu, ...);
+/**
+ * tlb_flush_all_cpus:
+ * @src_cpu: CPU doing the broadcast
+ *
+ * Flush the entire TLB of all CPUs.  Flushes of other vCPUs are
+ * queued to them and happen before they next execute guest code; queued
+ * flushes that have not happened yet are merged, see CPUTLBFlushQueue.
+ * The same applies to the other *_all_cpus functions.
+ */
+void tlb_flush_all_cpus(CPUState *src_cpu);
+/**
+ * tlb_flush_page_all_cpus:
+ * @src_cpu: CPU doing the broadcast
+ * @addr: virtual address of page to be flushed
+ *
+ * Flush one page from the TLB of all CPUs, for all MMU indexes.
+ */
+void tlb_flush_page_all_cpus(CPUState *src_cpu, target_ulong addr);
+/**
+ * tlb_flush_page_by_mmuidx_all_cpus:
+ * @src_cpu: CPU doing the broadcast
+ * @addr: virtual address of page to be flushed
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Flush one page from the TLB of all CPUs, for the specified MMU indexes.
+ */
+void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu, target_ulong addr,
+                                       ...);
+/**
+ * tlb_flush_by_mmuidx_all_cpus:
+ * @src_cpu: CPU doing the broadcast
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Flush all entries from the TLB of all CPUs, for the specified MMU
+ * indexes.
+ */
+void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, ...);
+/**
+ * tlb_flush_all_cpus_synced:
+ * @src_cpu: CPU doing the broadcast
+ *
+ * Like tlb_flush_all_cpus, but @src_cpu flushes its own TLB as safe
+ * work, once every other vCPU has left guest code and before any of
+ * them can run it again with a stale entry.  This is what a guest
+ * barrier after a broadcast invalidation (e.g. ARM TLBI IS then DSB)
+ * expects.  The caller must end the current TB right after the call,
+ * so that @src_cpu drains its work before executing further.
+ * The same applies to the other *_all_cpus_synced functions.
+ */
+void tlb_flush_all_cpus_synced(CPUState *src_cpu);
+/**
+ * tlb_flush_page_all_cpus_synced:
+ * @src_cpu: CPU doing the broadcast
+ * @addr: virtual address of page to be flushed
+ *
+ * Synced variant of tlb_flush_page_all_cpus.
+ */
+void tlb_flush_page_all_cpus_synced(CPUState *src_cpu, target_ulong addr);
+/**
+ * tlb_flush_page_by_mmuidx_all_cpus_synced:
+ * @src_cpu: CPU doing the broadcast
+ * @addr: virtual address of page to be flushed
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Synced variant of tlb_flush_page_by_mmuidx_all_cpus.
+ */
+void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                              target_ulong addr, ...);
+/**
+ * tlb_flush_by_mmuidx_all_cpus_synced:
+ * @src_cpu: CPU doing the broadcast
+ * @...: list of MMU indexes to flush, terminated by a negative value
+ *
+ * Synced variant of tlb_flush_by_mmuidx_all_cpus.
+ */
+void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, ...);
+/**
+ * tlb_flush_range:
+ * @cpu: CPU whose TLB should be flushed
+ * @addr: virtual address of the start of the range to be flushed
+ * @len: length of the range in bytes
+ *
+ * Flush every page overlapping [@addr, @addr + @len) from the TLB of
+ * the specified CPU, for all MMU indexes.  Large pages overlapping the
+ * range are flushed entirely, as with tlb_flush_page.
+ */
+void tlb_flush_range(CPUState *cpu, target_ulong addr, target_ulong len);
 /**
  * tlb_set_page_with_attrs:
  * @cpu: CPU to add this TLB entry for
@@ -207,12 +295,61 @@ static inline void tlb_flush_page_by_mmuidx(CPUState *cpu,
 static inline void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 {
 }
+
+static inline void tlb_flush_all_cpus(CPUState *src_cpu)
+{
+}
+
+static inline void tlb_flush_page_all_cpus(CPUState *src_cpu,
+                                           target_ulong addr)
+{
+}
+
+static inline void tlb_flush_page_by_mmuidx_all_cpus(CPUState *src_cpu,
+                                                     target_ulong addr, ...)
+{
+}
+
+static inline void tlb_flush_by_mmuidx_all_cpus(CPUState *src_cpu, ...)
+{
+}
+
+static inline void tlb_flush_all_cpus_synced(CPUState *src_cpu)
+{
+}
+
+static inline void tlb_flush_page_all_cpus_synced(CPUState *src_cpu,
+                                                  target_ulong addr)
+{
+}
+
+static inline void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
+                                                            target_ulong addr,
+                                                            ...)
+{
+}
+
+static inline void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, ...)
+{
+}
+
+static inline void tlb_flush_range(CPUState *cpu, target_ulong addr,
+                                   target_ulong len)
+{
+}
 #endif
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
-#define CODE_GEN_PHYS_HASH_BITS     15
-#define CODE_GEN_PHYS_HASH_SIZE     (1 << CODE_GEN_PHYS_HASH_BITS)
+#define CODE_GEN_HTABLE_BITS     15
+#define CODE_GEN_HTABLE_SIZE     (1 << CODE_GEN_HTABLE_BITS)
+
+/* The translation buffer is split into up to CODE_GEN_REGIONS regions
+   that are filled in turn.  When the last one fills up, only the oldest
+   region is evicted instead of flushing the whole buffer.  Regions are
+   never made smaller than CODE_GEN_MIN_REGION_SIZE.  */
+#define CODE_GEN_REGIONS            8
+#define CODE_GEN_MIN_REGION_SIZE    (1 * 1024 * 1024)
 
 /* Estimated block size for TB allocation.  */
 /* ??? The following is based on a 2015 survey of x86_64 host output.
@@ -224,6 +361,14 @@ static inline void tlb_flush_by_mmuidx(CPUState *cpu, ...)
 #define CODE_GEN_AVG_BLOCK_SIZE 150
 #endif
 
+/* A TB that has run TB_HOT_THRESHOLD times is translated again, along
+   with up to TB_TRACE_MAX_BLOCKS - 1 of its hot successors.  Each failed
+   attempt doubles the count before the next one, up to
+   TB_HOT_THRESHOLD << TB_HOT_MAX_BACKOFF.  */
+#define TB_HOT_THRESHOLD      1024
+#define TB_HOT_MAX_BACKOFF    20
+#define TB_TRACE_MAX_BLOCKS   4
+
 #if defined(__arm__) || defined(_ARCH_PPC) \
     || defined(__x86_64__) || defined(__i386__) \
     || defined(__sparc__) || defined(__aarch64__) \
@@ -245,11 +390,20 @@ struct TranslationBlock {
 #define CF_NOCACHE     0x10000 /* To be freed after execution */
 #define CF_USE_ICOUNT  0x20000
 #define CF_IGNORE_ICOUNT 0x40000 /* Do not generate icount code */
+#define CF_TRACE       0x80000 /* Hot TB, possibly spanning several blocks */
+#define CF_TRACE_TAIL  0x100000 /* Translating a non-head block of a trace */
+
+    bool invalid;       /* removed by tb_phys_invalidate */
+    /* executions left before the TB is considered hot; see tb_gen_trace */
+    int32_t hot_count;
+    /* failed tb_gen_trace attempts so far, capped at TB_HOT_MAX_BACKOFF */
+    uint8_t hot_backoff;
+    /* executions so far, if tb_profile_enabled */
+    uint64_t exec_count;
+    uint32_t tc_size;   /* size of the host code */
 
     void *tc_ptr;    /* pointer to the translated code */
     uint8_t *tc_search;  /* pointer to search data */
-    /* next matching tb for physical address. */
-    struct TranslationBlock *phys_hash_next;
     /* original tb when cflags has CF_NOCACHE */
     struct TranslationBlock *orig_tb;
     /* first and second physical page containing code. The lower bit
@@ -274,26 +428,75 @@ struct TranslationBlock {
 };
 
 #include "qemu/thread.h"
+#include "qemu/qht.h"
 
 typedef struct TBContext TBContext;
+typedef struct TBRegion TBRegion;
+
+/* A slice of the translation buffer, along with the TBs whose code
+   lives in it.  TBs in a region are sorted by tc_ptr.  */
+struct TBRegion {
+    void *start;
+    void *end;
+    void *ptr;      /* end of the generated code, once the region is full */
+    TranslationBlock *tbs;
+    int nb_tbs;
+    unsigned int gen;   /* generation in which the region was last filled */
+};
 
 struct TBContext {
 
     TranslationBlock *tbs;
-    TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
-    int nb_tbs;
+    struct qht htable;
+    int nb_tbs;     /* live TBs, summed over all regions */
+
+    TBRegion regions[CODE_GEN_REGIONS];
+    int nb_regions;
+    int cur_region;
+    int region_max_tbs;
+    unsigned int region_gen;
+    /* user mode: a vCPU found the current region full while other guest
+       threads were running; evicted by tb_region_advance_exclusive() */
+    bool region_advance_pending;
     /* any access to the tbs or the page table must use this lock */
     QemuMutex tb_lock;
 
     /* statistics */
     int tb_flush_count;
     int tb_phys_invalidate_count;
-
-    int tb_invalidated_flag;
+    int tb_region_evict_count;
+    int tb_evicted_tbs;
+    int tb_trace_count;
+    int tb_trace_blocks;
+    int tb_io_recompile_count;
+
+    /* Bumped under tb_lock whenever a TB is invalidated or its code is
+       evicted.  A vCPU that saw the same value before looking up two TBs
+       knows that both are still valid and may be chained without having
+       to hold tb_lock across the lookup.  */
+    unsigned int tb_invalidated_gen;
 };
 
+/* Whether the generated code counts executions of @tb towards
+   TB_HOT_THRESHOLD.  One-shot and I/O translations are not worth it, and
+   with icount the extra exits would disturb the instruction count.  */
+static inline bool tb_hot_counted(TranslationBlock *tb)
+{
+    return !(tb->cflags & (CF_COUNT_MASK | CF_LAST_IO | CF_NOCACHE |
+                           CF_USE_ICOUNT | CF_TRACE));
+}
+
+/* Set by -accel tcg,profile=on: TBs translated from then on count their
+   executions in exec_count.  */
+extern bool tb_profile_enabled;
+
 void tb_free(TranslationBlock *tb);
+TranslationBlock *tb_find_physical(CPUState *cpu, target_ulong pc,
+                                   target_ulong cs_base, uint64_t flags);
 void tb_flush(CPUState *cpu);
+#ifdef CONFIG_USER_ONLY
+void tb_region_advance_exclusive(void);
+#endif
 void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr);
 
 #if defined(USE_DIRECT_JUMP)
@@ -311,8 +514,9 @@ void ppc_tb_set_jmp_target(uintptr_t jmp_addr, uintptr_t addr);
 #elif defined(__i386__) || defined(__x86_64__)
 static inline void tb_set_jmp_target1(uintptr_t jmp_addr, uintptr_t addr)
 {
-    /* patch the branch destination */
-    stl_le_p((void*)jmp_addr, addr - (jmp_addr + 4));
+    /* patch the branch destination; the displacement is aligned so
+       that the update is atomic */
+    atomic_set((int32_t *)jmp_addr, addr - (jmp_addr + 4));
     /* no need to flush icache explicitly */
 }
 #elif defined(__s390x__)
@@ -422,6 +626,7 @@ void tlb_fill(CPUState *cpu, target_ulong addr, int is_write, int mmu_idx,
 #if defined(CONFIG_USER_ONLY)
 void mmap_lock(void);
 void mmap_unlock(void);
+void mmap_lock_reset(void);
 
 static inline tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr)
 {
@@ -430,6 +635,7 @@ static inline tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong
 #else
 static inline void mmap_lock(void) {}
 static inline void mmap_unlock(void) {}
+static inline void mmap_lock_reset(void) {}
 
 /* cputlb.c */
 tb_page_addr_t get_page_addr_code(CPUArchState *env1, target_ulong addr);
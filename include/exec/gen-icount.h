@@ -14,6 +14,12 @@ static inline void gen_tb_start(TranslationBlock *tb)
     TCGv_i32 count, flag, imm;
     int i;
 
+    if (tb->cflags & CF_TRACE_TAIL) {
+        /* The exit request was checked on entry to the head block; an
+           exit from the middle of a trace would not restore the PC.  */
+        return;
+    }
+
     exitreq_label = gen_new_label();
     flag = tcg_temp_new_i32();
     tcg_gen_ld_i32(flag, cpu_env,
@@ -21,6 +27,34 @@ static inline void gen_tb_start(TranslationBlock *tb)
     tcg_gen_brcondi_i32(TCG_COND_NE, flag, 0, exitreq_label);
     tcg_temp_free_i32(flag);
 
+    if (tb_profile_enabled) {
+        TCGv_ptr ptr = tcg_const_ptr(&tb->exec_count);
+        TCGv_i64 execs = tcg_temp_new_i64();
+
+        tcg_gen_ld_i64(execs, ptr, 0);
+        tcg_gen_addi_i64(execs, execs, 1);
+        tcg_gen_st_i64(execs, ptr, 0);
+        tcg_temp_free_i64(execs);
+        tcg_temp_free_ptr(ptr);
+    }
+
+    if (tb_hot_counted(tb)) {
+        /* Leave through the exit request path once the TB becomes hot;
+           cpu_exec then hands it to tb_gen_trace.  The counter is shared
+           by all vCPUs, and the aligned 32-bit load and store below are
+           the equivalent of atomic_read/atomic_set: concurrent
+           decrements may get lost, which only delays the exit.  */
+        TCGv_ptr ptr = tcg_const_ptr(&tb->hot_count);
+
+        count = tcg_temp_new_i32();
+        tcg_gen_ld_i32(count, ptr, 0);
+        tcg_gen_subi_i32(count, count, 1);
+        tcg_gen_st_i32(count, ptr, 0);
+        tcg_gen_brcondi_i32(TCG_COND_EQ, count, 0, exitreq_label);
+        tcg_temp_free_i32(count);
+        tcg_temp_free_ptr(ptr);
+    }
+
     if (!(tb->cflags & CF_USE_ICOUNT)) {
         return;
     }
@@ -49,8 +83,10 @@ static inline void gen_tb_start(TranslationBlock *tb)
 
 static void gen_tb_end(TranslationBlock *tb, int num_insns)
 {
-    gen_set_label(exitreq_label);
-    tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
+    if (!(tb->cflags & CF_TRACE_TAIL)) {
+        gen_set_label(exitreq_label);
+        tcg_gen_exit_tb((uintptr_t)tb + TB_EXIT_REQUESTED);
+    }
 
     if (tb->cflags & CF_USE_ICOUNT) {
         *icount_arg = num_insns;
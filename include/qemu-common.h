@@ -37,6 +37,7 @@ void cpu_ticks_init(void);
 
 /* icount */
 void configure_icount(QemuOpts *opts, Error **errp);
+void qemu_tcg_configure(QemuOpts *opts, Error **errp);
 extern int use_icount;
 extern int icount_align_option;
 /* drift information for info jit command */
@@ -339,6 +340,7 @@ struct qemu_work_item {
     void *data;
     int done;
     bool free;
+    bool exclusive;
 };
 
 
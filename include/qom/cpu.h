@@ -221,6 +221,58 @@ struct CPUWatchpoint {
 struct KVMState;
 struct kvm_run;
 
+/**
+ * CPUTLBStats:
+ * @hits: Accesses that reached the softmmu helpers although the TLB entry
+ *        matched (MMIO, unaligned or dirty-tracked pages).  Hits in the
+ *        inline fast path are not counted.
+ * @misses: Lookups that missed in the main TLB.
+ * @victim_hits: Misses that were refilled from the victim TLB.
+ * @full_flushes: Flushes of all entries, for all or some MMU indexes.
+ * @page_flushes: Flushes of a single page or a range of pages.
+ * @mmio: Accesses dispatched to an I/O memory region.
+ * @resizes: Changes of the TLB size.
+ *
+ * Softmmu TLB statistics of one CPU.  They are only updated by the thread
+ * running the CPU.
+ */
+typedef struct CPUTLBStats {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t victim_hits;
+    uint64_t full_flushes;
+    uint64_t page_flushes;
+    uint64_t mmio;
+    uint64_t resizes;
+} CPUTLBStats;
+
+#define TLB_FLUSH_QUEUE_PAGES 16
+
+/**
+ * CPUTLBFlushQueue:
+ * @lock: Protects the other fields.
+ * @scheduled: A work item that will drain the queue is pending.
+ * @full_idxmap: MMU indexes to flush entirely.
+ * @nb_pages: Number of entries used in @pages.
+ * @pages: Single pages to flush, with the MMU indexes to flush them from.
+ *
+ * TLB flushes requested by other vCPUs, or by the vCPU itself for a
+ * synced broadcast, which are done by the vCPU's own thread.  Requests
+ * accumulate until the queue is drained; when more than
+ * %TLB_FLUSH_QUEUE_PAGES pages are pending, they are merged into a flush
+ * of all the MMU indexes involved.
+ */
+typedef struct CPUTLBFlushQueue {
+    QemuSpin lock;
+    bool scheduled;
+    unsigned long full_idxmap;
+    int nb_pages;
+    struct {
+        vaddr addr;
+        unsigned long idxmap;
+    } pages[TLB_FLUSH_QUEUE_PAGES];
+} CPUTLBFlushQueue;
+
 #define TB_JMP_CACHE_BITS 12
 #define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
 
@@ -231,7 +283,10 @@ struct kvm_run;
  * @nr_threads: Number of threads within this CPU.
  * @numa_node: NUMA node this CPU is belonging to.
  * @host_tid: Host thread ID.
- * @running: #true if CPU is currently running (usermode).
+ * @running: #true if CPU is currently running (usermode and multi-threaded
+ *           TCG).
+ * @has_waiter: #true if an exclusive operation is waiting for this CPU to
+ *              leave the execution loop (usermode).
  * @created: Indicates whether the CPU thread has been successfully created.
  * @interrupt_request: Indicates a pending interrupt request.
  * @halted: Nonzero if the CPU is in suspended state.
@@ -262,6 +317,8 @@ struct kvm_run;
  * @opaque: User data.
  * @mem_io_pc: Host Program Counter at which the memory was accessed.
  * @mem_io_vaddr: Target virtual address at which the memory was accessed.
+ * @tlb_stats: Softmmu TLB statistics.
+ * @tlb_flush_queue: TLB flushes requested by other vCPUs.
  * @kvm_fd: vCPU file descriptor for KVM.
  * @work_mutex: Lock to prevent multiple access to queued_work_*.
  * @queued_work_first: First asynchronous work pending.
@@ -284,6 +341,7 @@ struct CPUState {
     int thread_id;
     uint32_t host_tid;
     bool running;
+    bool has_waiter;
     struct QemuCond *halt_cond;
     bool thread_kicked;
     bool created;
@@ -326,6 +384,9 @@ struct CPUState {
     uintptr_t mem_io_pc;
     vaddr mem_io_vaddr;
 
+    CPUTLBStats tlb_stats;
+    CPUTLBFlushQueue tlb_flush_queue;
+
     int kvm_fd;
     bool kvm_vcpu_dirty;
     struct KVMState *kvm_state;
@@ -593,6 +654,22 @@ void qemu_cpu_kick(CPUState *cpu);
  */
 bool cpu_is_stopped(CPUState *cpu);
 
+/**
+ * mttcg_enabled:
+ *
+ * Set when TCG runs each vCPU in its own thread ("-accel tcg,thread=multi").
+ * Only meaningful for target-specific code.
+ */
+extern bool mttcg_enabled;
+
+/**
+ * qemu_tcg_mttcg_enabled:
+ * Check whether we are running MultiThread TCG or not.
+ *
+ * Returns: %true if we are in MTTCG mode %false otherwise.
+ */
+#define qemu_tcg_mttcg_enabled() (mttcg_enabled)
+
 /**
  * run_on_cpu:
  * @cpu: The vCPU to run on.
@@ -613,6 +690,19 @@ void run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
  */
 void async_run_on_cpu(CPUState *cpu, void (*func)(void *data), void *data);
 
+/**
+ * async_safe_run_on_cpu:
+ * @cpu: The vCPU to run on.
+ * @func: The function to be executed.
+ * @data: Data to pass to the function.
+ *
+ * Schedules the function @func for execution on the vCPU @cpu asynchronously,
+ * while all other vCPUs are outside of guest code execution.  Use this for
+ * work that must not race with translated code running on other vCPUs.
+ */
+void async_safe_run_on_cpu(CPUState *cpu, void (*func)(void *data),
+                           void *data);
+
 /**
  * qemu_get_cpu:
  * @index: The CPUState@cpu_index value of the CPU to obtain.
@@ -110,11 +110,12 @@ static pthread_cond_t exclusive_cond = PTHREAD_COND_INITIALIZER;
 static pthread_cond_t exclusive_resume = PTHREAD_COND_INITIALIZER;
 static int pending_cpus;
 
-/* Make sure everything is in a consistent state for calling fork().  */
+/* Make sure everything is in a consistent state for calling fork().
+   exclusive_lock nests outside tb_lock, see cpu_exec_end.  */
 void fork_start(void)
 {
-    qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
     pthread_mutex_lock(&exclusive_lock);
+    qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
     mmap_fork_start();
 }
 
@@ -138,8 +139,8 @@ void fork_end(int child)
         qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
         gdbserver_fork(thread_cpu);
     } else {
-        pthread_mutex_unlock(&exclusive_lock);
         qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
+        pthread_mutex_unlock(&exclusive_lock);
     }
 }
 
@@ -157,53 +158,86 @@ static inline void exclusive_idle(void)
 static inline void start_exclusive(void)
 {
     CPUState *other_cpu;
+    int running_cpus;
 
     pthread_mutex_lock(&exclusive_lock);
     exclusive_idle();
 
-    pending_cpus = 1;
-    /* Make all other cpus stop executing.  */
+    /* Make all other cpus stop executing.  Setting pending_cpus before
+       reading cpu->running pairs with the opposite order in
+       cpu_exec_start/cpu_exec_end: either we see the cpu running and
+       wait for it, or it sees pending_cpus and takes the slow path.  */
+    atomic_set(&pending_cpus, 1);
+    smp_mb();
+    running_cpus = 0;
     CPU_FOREACH(other_cpu) {
-        if (other_cpu->running) {
-            pending_cpus++;
+        if (atomic_read(&other_cpu->running)) {
+            other_cpu->has_waiter = true;
+            running_cpus++;
             cpu_exit(other_cpu);
         }
     }
-    if (pending_cpus > 1) {
+    atomic_set(&pending_cpus, running_cpus + 1);
+    while (pending_cpus > 1) {
         pthread_cond_wait(&exclusive_cond, &exclusive_lock);
     }
 }
 
 /* Finish an exclusive operation.  */
-static inline void __attribute__((unused)) end_exclusive(void)
+static inline void end_exclusive(void)
 {
-    pending_cpus = 0;
+    atomic_set(&pending_cpus, 0);
     pthread_cond_broadcast(&exclusive_resume);
     pthread_mutex_unlock(&exclusive_lock);
 }
 
-/* Wait for exclusive ops to finish, and begin cpu execution.  */
+/* Wait for exclusive ops to finish, and begin cpu execution.  The
+   common case of no exclusive operation in flight does not touch
+   exclusive_lock, so that guest threads entering and leaving the
+   execution loop (e.g. for every syscall) do not contend.  */
 static inline void cpu_exec_start(CPUState *cpu)
 {
-    pthread_mutex_lock(&exclusive_lock);
-    exclusive_idle();
-    cpu->running = true;
-    pthread_mutex_unlock(&exclusive_lock);
+    atomic_set(&cpu->running, true);
+    smp_mb();
+    if (unlikely(atomic_read(&pending_cpus))) {
+        pthread_mutex_lock(&exclusive_lock);
+        if (!cpu->has_waiter) {
+            /* Not counted by start_exclusive; wait for it to finish.  */
+            atomic_set(&cpu->running, false);
+            exclusive_idle();
+            atomic_set(&cpu->running, true);
+        }
+        /* Otherwise the exclusive operation is waiting for us: run
+           until the cpu_exit it sent takes us to cpu_exec_end.  */
+        pthread_mutex_unlock(&exclusive_lock);
+    }
 }
 
 /* Mark cpu as not executing, and release pending exclusive ops.  */
 static inline void cpu_exec_end(CPUState *cpu)
 {
-    pthread_mutex_lock(&exclusive_lock);
-    cpu->running = false;
-    if (pending_cpus > 1) {
-        pending_cpus--;
-        if (pending_cpus == 1) {
-            pthread_cond_signal(&exclusive_cond);
+    atomic_set(&cpu->running, false);
+    smp_mb();
+    if (unlikely(atomic_read(&pending_cpus))) {
+        pthread_mutex_lock(&exclusive_lock);
+        if (cpu->has_waiter) {
+            cpu->has_waiter = false;
+            atomic_set(&pending_cpus, pending_cpus - 1);
+            if (pending_cpus == 1) {
+                pthread_cond_signal(&exclusive_cond);
+            }
         }
+        exclusive_idle();
+        pthread_mutex_unlock(&exclusive_lock);
+    }
+
+    /* The code buffer region to be evicted may hold code that other
+       threads are running, so stop them first.  */
+    if (unlikely(atomic_read(&tcg_ctx.tb_ctx.region_advance_pending))) {
+        start_exclusive();
+        tb_region_advance_exclusive();
+        end_exclusive();
     }
-    exclusive_idle();
-    pthread_mutex_unlock(&exclusive_lock);
 }
 
 void cpu_list_lock(void)
@@ -618,94 +652,6 @@ do_kernel_trap(CPUARMState *env)
     return 0;
 }
 
-/* Store exclusive handling for AArch32 */
-static int do_strex(CPUARMState *env)
-{
-    uint64_t val;
-    int size;
-    int rc = 1;
-    int segv = 0;
-    uint32_t addr;
-    start_exclusive();
-    if (env->exclusive_addr != env->exclusive_test) {
-        goto fail;
-    }
-    /* We know we're always AArch32 so the address is in uint32_t range
-     * unless it was the -1 exclusive-monitor-lost value (which won't
-     * match exclusive_test above).
-     */
-    assert(extract64(env->exclusive_addr, 32, 32) == 0);
-    addr = env->exclusive_addr;
-    size = env->exclusive_info & 0xf;
-    switch (size) {
-    case 0:
-        segv = get_user_u8(val, addr);
-        break;
-    case 1:
-        segv = get_user_data_u16(val, addr, env);
-        break;
-    case 2:
-    case 3:
-        segv = get_user_data_u32(val, addr, env);
-        break;
-    default:
-        abort();
-    }
-    if (segv) {
-        env->exception.vaddress = addr;
-        goto done;
-    }
-    if (size == 3) {
-        uint32_t valhi;
-        segv = get_user_data_u32(valhi, addr + 4, env);
-        if (segv) {
-            env->exception.vaddress = addr + 4;
-            goto done;
-        }
-        if (arm_cpu_bswap_data(env)) {
-            val = deposit64((uint64_t)valhi, 32, 32, val);
-        } else {
-            val = deposit64(val, 32, 32, valhi);
-        }
-    }
-    if (val != env->exclusive_val) {
-        goto fail;
-    }
-
-    val = env->regs[(env->exclusive_info >> 8) & 0xf];
-    switch (size) {
-    case 0:
-        segv = put_user_u8(val, addr);
-        break;
-    case 1:
-        segv = put_user_data_u16(val, addr, env);
-        break;
-    case 2:
-    case 3:
-        segv = put_user_data_u32(val, addr, env);
-        break;
-    }
-    if (segv) {
-        env->exception.vaddress = addr;
-        goto done;
-    }
-    if (size == 3) {
-        val = env->regs[(env->exclusive_info >> 12) & 0xf];
-        segv = put_user_data_u32(val, addr + 4, env);
-        if (segv) {
-            env->exception.vaddress = addr + 4;
-            goto done;
-        }
-    }
-    rc = 0;
-fail:
-    env->regs[15] += 4;
-    env->regs[(env->exclusive_info >> 4) & 0xf] = rc;
-done:
-    end_exclusive();
-    return segv;
-}
-
 void cpu_loop(CPUARMState *env)
 {
     CPUState *cs = CPU(arm_env_get_cpu(env));
@@ -869,11 +815,6 @@ void cpu_loop(CPUARMState *env)
         case EXCP_INTERRUPT:
             /* just indicate that signals should be handled asap */
             break;
-        case EXCP_STREX:
-            if (!do_strex(env)) {
-                break;
-            }
-            /* fall through for segv */
         case EXCP_PREFETCH_ABORT:
         case EXCP_DATA_ABORT:
             addr = env->exception.vaddress;
@@ -2740,6 +2681,9 @@ void cpu_loop(CPUOpenRISCState *env)
         case EXCP_NR:
             qemu_log_mask(CPU_LOG_INT, "\nNR\n");
             break;
+        case EXCP_INTERRUPT:
+            /* just indicate that signals should be handled asap */
+            break;
         default:
             EXCP_DUMP(env, "\nqemu: unhandled CPU exception %#x - aborting\n",
                      trapnr);
@@ -3669,6 +3613,9 @@ void cpu_loop(CPUTLGState *env)
         case TILEGX_EXCP_REG_UDN_ACCESS:
             gen_sigill_reg(env);
             break;
+        case EXCP_INTERRUPT:
+            /* just indicate that signals should be handled asap */
+            break;
         default:
             fprintf(stderr, "trapnr is %d[0x%x].\n", trapnr, trapnr);
             g_assert_not_reached();
@@ -44,6 +44,16 @@ void mmap_unlock(void)
     }
 }
 
+/* Drop mmap_lock if this thread holds it; used when cpu_exec regains
+   control through siglongjmp from code that held the lock.  */
+void mmap_lock_reset(void)
+{
+    if (mmap_lock_count) {
+        mmap_lock_count = 0;
+        pthread_mutex_unlock(&mmap_mutex);
+    }
+}
+
 /* Grab lock to make sure things are in a consistent state after fork().  */
 void mmap_fork_start(void)
 {
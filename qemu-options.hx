@@ -91,6 +91,41 @@ ETEXI
 HXCOMM Deprecated by -machine
 DEF("M", HAS_ARG, QEMU_OPTION_M, "", QEMU_ARCH_ALL)
 
+DEF("accel", HAS_ARG, QEMU_OPTION_accel,
+    "-accel [accel=]accelerator[,thread=single|multi][,profile=on|off]\n"
+    "       [,perfmap=on|off]\n"
+    "                select accelerator ('-accel help' for list)\n"
+    "                thread=single|multi (enable multi-threaded TCG)\n"
+    "                profile=on|off (count executions of each TCG block)\n"
+    "                perfmap=on|off (write /tmp/perf-PID.map for perf)\n",
+    QEMU_ARCH_ALL)
+STEXI
+@item -accel @var{name}[,prop=@var{value}[,...]]
+@findex -accel
+This is used to enable an accelerator. Depending on the target architecture,
+kvm, xen, or tcg can be available. By default, tcg is used. If there is more
+than one accelerator specified, the next one is used if the previous one fails
+to initialize.
+@table @option
+@item thread=single|multi
+Controls the number of TCG threads. When TCG is multi-threaded there will be
+one thread per vCPU, allowing guest code to run in parallel on the host.
+The default is single, which runs all vCPUs in a single round-robin thread.
+Multi-threaded TCG is only available for targets that have been converted to
+it and is incompatible with @option{-icount}. Note that guest atomic
+operations are not yet emulated atomically across vCPUs.
+@item profile=on|off
+Make the code generated by TCG count how many times each translation block
+is executed.  The most executed blocks can be listed with the
+@code{info tb-profile} monitor command or @code{query-tb-profile} QMP
+command.  The default is off.
+@item perfmap=on|off
+Write the host address, size and guest PC of each translation block to
+@file{/tmp/perf-@var{pid}.map}, so that @command{perf report} can attribute
+samples in generated code to guest code.  The default is off.
+@end table
+ETEXI
+
 DEF("cpu", HAS_ARG, QEMU_OPTION_cpu,
     "-cpu cpu        select CPU ('-cpu help' for list)\n", QEMU_ARCH_ALL)
 STEXI
@@ -521,7 +556,7 @@ DEF("drive", HAS_ARG, QEMU_OPTION_drive,
     "       [,cyls=c,heads=h,secs=s[,trans=t]][,snapshot=on|off]\n"
     "       [,cache=writethrough|writeback|none|directsync|unsafe][,format=f]\n"
     "       [,serial=s][,addr=A][,rerror=ignore|stop|report]\n"
-    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native]\n"
+    "       [,werror=ignore|stop|report|enospc][,id=name][,aio=threads|native|io_uring]\n"
     "       [,readonly=on|off][,copy-on-read=on|off]\n"
     "       [,discard=ignore|unmap][,detect-zeroes=on|off|unmap]\n"
     "       [[,bps=b]|[[,bps_rd=r][,bps_wr=w]]]\n"
@@ -564,7 +599,7 @@ These options have the same definition as they have in @option{-hdachs}.
 @item cache=@var{cache}
 @var{cache} is "none", "writeback", "unsafe", "directsync" or "writethrough" and controls how the host cache is used to access block data.
 @item aio=@var{aio}
-@var{aio} is "threads", or "native" and selects between pthread based disk I/O and native Linux AIO.
+@var{aio} is "threads", "native" or "io_uring" and selects between pthread based disk I/O, native Linux AIO and Linux io_uring.  Unlike "native", "io_uring" does not require @option{cache.direct=on}.
 @item discard=@var{discard}
 @var{discard} is one of "ignore" (or "off") or "unmap" (or "on") and controls whether @dfn{discard} (also known as @dfn{trim} or @dfn{unmap}) requests are ignored or passed to the filesystem.  Some machine types may not support discard requests.
 @item format=@var{format}
@@ -2888,6 +2888,102 @@ EQMP
         .mhandler.cmd_new = qmp_marshal_query_cpus,
     },
 
+SQMP
+query-tlb-stats
+---------------
+
+Show the softmmu TLB statistics of each CPU.
+
+Return a json-array. Each CPU is represented by a json-object, which contains:
+
+- "cpu-index": CPU index (json-int)
+- "hits": accesses handled out of line although the TLB entry matched
+          (json-int)
+- "misses": TLB misses that required a page table walk (json-int)
+- "victim-hits": TLB misses resolved from the victim TLB (json-int)
+- "full-flushes": number of full TLB flushes (json-int)
+- "page-flushes": number of single page flushes (json-int)
+- "mmio": accesses dispatched to I/O memory regions (json-int)
+- "resizes": number of TLB resizes (json-int)
+- "entries": current number of TLB entries for each MMU mode
+             (json-array of json-int)
+
+Example:
+
+-> { "execute": "query-tlb-stats" }
+<- {
+      "return":[
+         {
+            "cpu-index":0,
+            "hits":10233,
+            "misses":88021,
+            "victim-hits":15117,
+            "full-flushes":212,
+            "page-flushes":4096,
+            "mmio":9960,
+            "resizes":7,
+            "entries":[ 256, 1024, 256 ]
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-tlb-stats",
+        .args_type  = "",
+        .mhandler.cmd_new = qmp_marshal_query_tlb_stats,
+    },
+
+SQMP
+query-tb-profile
+----------------
+
+Show the most executed translation blocks.  Requires -accel tcg,profile=on.
+
+Arguments:
+
+- "top": number of blocks to return, default 20 (json-int, optional)
+
+Return a json-array, most executed block first. Each block is represented
+by a json-object, which contains:
+
+- "pc": guest virtual address of the block (json-int)
+- "count": number of executions since the block was translated (json-int)
+- "guest-size": size of the guest code, in bytes (json-int)
+- "host-size": size of the generated host code, in bytes (json-int)
+- "trace": whether the block is a trace of several blocks (json-bool)
+
+Example:
+
+-> { "execute": "query-tb-profile", "arguments": { "top": 2 } }
+<- {
+      "return":[
+         {
+            "pc":3221487664,
+            "count":1849213,
+            "guest-size":24,
+            "host-size":173,
+            "trace":true
+         },
+         {
+            "pc":3221489012,
+            "count":920117,
+            "guest-size":12,
+            "host-size":96,
+            "trace":false
+         }
+      ]
+   }
+
+EQMP
+
+    {
+        .name       = "query-tb-profile",
+        .args_type  = "top:i?",
+        .mhandler.cmd_new = qmp_marshal_query_tb_profile,
+    },
+
 SQMP
 query-iothreads
 ---------------
@@ -2902,6 +2998,12 @@ Return a json-array. Each iothread is represented by a json-object, which contai
 
 - "id": name of iothread (json-str)
 - "thread-id": ID of the underlying host thread (json-int)
+- "poll-max-ns": maximum polling time in ns, 0 disables polling (json-int)
+- "poll-grow": polling time growth factor (json-int)
+- "poll-shrink": polling time shrink factor (json-int)
+- "poll-ns": current adaptive polling time in ns (json-int)
+- "poll-attempts": number of polling phases run (json-int)
+- "poll-successes": number of polling phases that found work (json-int)
 
 Example:
 
@@ -2910,11 +3012,23 @@ Example:
       "return":[
          {
             "id":"iothread0",
-            "thread-id":3134
+            "thread-id":3134,
+            "poll-max-ns":32768,
+            "poll-grow":0,
+            "poll-shrink":0,
+            "poll-ns":16000,
+            "poll-attempts":52731,
+            "poll-successes":49012
          },
          {
             "id":"iothread1",
-            "thread-id":3135
+            "thread-id":3135,
+            "poll-max-ns":0,
+            "poll-grow":0,
+            "poll-shrink":0,
+            "poll-ns":0,
+            "poll-attempts":0,
+            "poll-successes":0
          }
       ]
    }
@@ -129,6 +129,10 @@
         if (env->tlb_v_table[mmu_idx][vidx].ty == (addr & TARGET_PAGE_MASK)) {\
             /* found entry in victim tlb, swap tlb and iotlb */               \
             tmptlb = env->tlb_table[mmu_idx][index];                          \
+            if (tlb_entry_is_empty(&tmptlb)) {                                \
+                env->tlb_d[mmu_idx].n_used_entries++;                         \
+            }                                                                 \
+            ENV_GET_CPU(env)->tlb_stats.victim_hits++;                        \
             env->tlb_table[mmu_idx][index] = env->tlb_v_table[mmu_idx][vidx]; \
             env->tlb_v_table[mmu_idx][vidx] = tmptlb;                         \
             tmpiotlb = env->iotlb[mmu_idx][index];                            \
@@ -151,6 +155,7 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr physaddr = iotlbentry->addr;
     MemoryRegion *mr = iotlb_to_region(cpu, physaddr, iotlbentry->attrs);
+    bool locked = false;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     cpu->mem_io_pc = retaddr;
@@ -159,8 +164,17 @@ static inline DATA_TYPE glue(io_read, SUFFIX)(CPUArchState *env,
     }
 
     cpu->mem_io_vaddr = addr;
+    cpu->tlb_stats.mmio++;
+    /* With multi-threaded TCG the vCPU runs without the BQL */
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
     memory_region_dispatch_read(mr, physaddr, &val, 1 << SHIFT,
                                 iotlbentry->attrs);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
     return val;
 }
 #endif
@@ -169,7 +183,7 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
                             TCGMemOpIdx oi, uintptr_t retaddr)
 {
     unsigned mmu_idx = get_mmuidx(oi);
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -186,10 +200,14 @@ WORD_TYPE helper_le_ld_name(CPUArchState *env, target_ulong addr,
                                  mmu_idx, retaddr);
         }
         if (!VICTIM_TLB_HIT(ADDR_READ)) {
+            ENV_GET_CPU(env)->tlb_stats.misses++;
             tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
                      mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
+    } else {
+        ENV_GET_CPU(env)->tlb_stats.hits++;
     }
 
     /* Handle an IO access.  */
@@ -253,7 +271,7 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
                             TCGMemOpIdx oi, uintptr_t retaddr)
 {
     unsigned mmu_idx = get_mmuidx(oi);
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
     uintptr_t haddr;
     DATA_TYPE res;
@@ -270,10 +288,14 @@ WORD_TYPE helper_be_ld_name(CPUArchState *env, target_ulong addr,
                                  mmu_idx, retaddr);
         }
         if (!VICTIM_TLB_HIT(ADDR_READ)) {
+            ENV_GET_CPU(env)->tlb_stats.misses++;
             tlb_fill(ENV_GET_CPU(env), addr, READ_ACCESS_TYPE,
                      mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].ADDR_READ;
+    } else {
+        ENV_GET_CPU(env)->tlb_stats.hits++;
     }
 
     /* Handle an IO access.  */
@@ -358,6 +380,7 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
     CPUState *cpu = ENV_GET_CPU(env);
     hwaddr physaddr = iotlbentry->addr;
     MemoryRegion *mr = iotlb_to_region(cpu, physaddr, iotlbentry->attrs);
+    bool locked = false;
 
     physaddr = (physaddr & TARGET_PAGE_MASK) + addr;
     if (mr != &io_mem_rom && mr != &io_mem_notdirty && !cpu->can_do_io) {
@@ -366,15 +389,24 @@ static inline void glue(io_write, SUFFIX)(CPUArchState *env,
 
     cpu->mem_io_vaddr = addr;
     cpu->mem_io_pc = retaddr;
+    cpu->tlb_stats.mmio++;
+    /* With multi-threaded TCG the vCPU runs without the BQL */
+    if (mr->global_locking && !qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        locked = true;
+    }
     memory_region_dispatch_write(mr, physaddr, val, 1 << SHIFT,
                                  iotlbentry->attrs);
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
 }
 
 void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        TCGMemOpIdx oi, uintptr_t retaddr)
 {
     unsigned mmu_idx = get_mmuidx(oi);
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -390,9 +422,13 @@ void helper_le_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                                  mmu_idx, retaddr);
         }
         if (!VICTIM_TLB_HIT(addr_write)) {
+            ENV_GET_CPU(env)->tlb_stats.misses++;
             tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+    } else {
+        ENV_GET_CPU(env)->tlb_stats.hits++;
     }
 
     /* Handle an IO access.  */
@@ -454,7 +490,7 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                        TCGMemOpIdx oi, uintptr_t retaddr)
 {
     unsigned mmu_idx = get_mmuidx(oi);
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
     uintptr_t haddr;
 
@@ -470,9 +506,13 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
                                  mmu_idx, retaddr);
         }
         if (!VICTIM_TLB_HIT(addr_write)) {
+            ENV_GET_CPU(env)->tlb_stats.misses++;
             tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
+            index = tlb_index(env, mmu_idx, addr);
         }
         tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
+    } else {
+        ENV_GET_CPU(env)->tlb_stats.hits++;
     }
 
     /* Handle an IO access.  */
@@ -536,13 +576,14 @@ void helper_be_st_name(CPUArchState *env, target_ulong addr, DATA_TYPE val,
 void probe_write(CPUArchState *env, target_ulong addr, int mmu_idx,
                  uintptr_t retaddr)
 {
-    int index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    int index = tlb_index(env, mmu_idx, addr);
     target_ulong tlb_addr = env->tlb_table[mmu_idx][index].addr_write;
 
     if ((addr & TARGET_PAGE_MASK)
         != (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
         /* TLB entry is for a different page */
         if (!VICTIM_TLB_HIT(addr_write)) {
+            ENV_GET_CPU(env)->tlb_stats.misses++;
             tlb_fill(ENV_GET_CPU(env), addr, MMU_DATA_STORE, mmu_idx, retaddr);
         }
     }
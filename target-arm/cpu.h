@@ -31,6 +31,9 @@
 
 #define TARGET_IS_BIENDIAN 1
 
+/* The TCG front-end is safe to run with one thread per vCPU */
+#define TARGET_SUPPORTS_MTTCG
+
 #define CPUArchState struct CPUARMState
 
 #include "qemu-common.h"
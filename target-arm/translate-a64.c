@@ -299,7 +299,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, uint64_t dest)
         } else if (s->singlestep_enabled) {
             gen_exception_internal(EXCP_DEBUG);
         } else {
-            tcg_gen_exit_tb(0);
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
             s->is_jmp = DISAS_TB_JUMP;
         }
     }
@@ -1646,7 +1646,7 @@ static void disas_uncond_b_reg(DisasContext *s, uint32_t insn)
             return;
         }
         gen_helper_exception_return(cpu_env);
-        s->is_jmp = DISAS_JUMP;
+        s->is_jmp = DISAS_EXIT;
         return;
     case 5: /* DRPS */
         if (rn != 0x1f) {
@@ -11174,7 +11174,7 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
          * (and thus a tb-jump is not possible when singlestepping).
          */
         assert(dc->is_jmp != DISAS_TB_JUMP);
-        if (dc->is_jmp != DISAS_JUMP) {
+        if (dc->is_jmp != DISAS_JUMP && dc->is_jmp != DISAS_EXIT) {
             gen_a64_set_pc_im(dc->pc);
         }
         if (cs->singlestep_enabled) {
@@ -11191,10 +11191,14 @@ void gen_intermediate_code_a64(ARMCPU *cpu, TranslationBlock *tb)
         case DISAS_UPDATE:
             gen_a64_set_pc_im(dc->pc);
             /* fall through */
-        case DISAS_JUMP:
+        case DISAS_EXIT:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
             break;
+        case DISAS_JUMP:
+            /* only the PC changed: look up the next TB and jump to it */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
         case DISAS_TB_JUMP:
         case DISAS_EXC:
         case DISAS_SWI:
@@ -24,6 +24,7 @@
 #include "internals.h"
 #include "disas/disas.h"
 #include "tcg-op.h"
+#include "tcg-op-gvec.h"
 #include "qemu/log.h"
 #include "qemu/bitops.h"
 #include "arm_ldst.h"
@@ -1064,6 +1065,23 @@ DO_GEN_ST(8, MO_UB, 3)
 DO_GEN_ST(16, MO_UW, 2)
 DO_GEN_ST(32, MO_UL, 0)
 
+/* Return the guest address for a memory operation OP on the AArch32
+ * address A32, zero extended and adjusted for system-mode BE32 in the
+ * same way as the load/store functions above.  The caller must free
+ * the result with tcg_temp_free().
+ */
+static TCGv gen_aa32_addr(DisasContext *s, TCGv_i32 a32, TCGMemOp op)
+{
+    TCGv addr = tcg_temp_new();
+    tcg_gen_extu_i32_tl(addr, a32);
+
+    /* Not needed for user-mode BE32, where we use MO_BE instead.  */
+    if (!IS_USER_ONLY && s->sctlr_b && (op & MO_SIZE) < MO_32) {
+        tcg_gen_xori_tl(addr, addr, 4 - (1 << (op & MO_SIZE)));
+    }
+    return addr;
+}
+
 static inline void gen_set_pc_im(DisasContext *s, target_ulong val)
 {
     tcg_gen_movi_i32(cpu_R[15], val);
@@ -1134,7 +1152,7 @@ static void gen_exception_insn(DisasContext *s, int offset, int excp,
 static inline void gen_lookup_tb(DisasContext *s)
 {
     tcg_gen_movi_i32(cpu_R[15], s->pc & ~1);
-    s->is_jmp = DISAS_JUMP;
+    s->is_jmp = DISAS_EXIT;
 }
 
 static inline void gen_add_data_offset(DisasContext *s, unsigned int insn,
@@ -4060,7 +4078,7 @@ static inline void gen_goto_tb(DisasContext *s, int n, target_ulong dest)
         tcg_gen_exit_tb((uintptr_t)tb + n);
     } else {
         gen_set_pc_im(s, dest);
-        tcg_gen_exit_tb(0);
+        tcg_gen_lookup_and_goto_ptr(cpu_env);
     }
 }
 
@@ -4357,7 +4375,7 @@ static void gen_exception_return(DisasContext *s, TCGv_i32 pc)
     tmp = load_cpu_field(spsr);
     gen_helper_cpsr_write_eret(cpu_env, tmp);
     tcg_temp_free_i32(tmp);
-    s->is_jmp = DISAS_JUMP;
+    s->is_jmp = DISAS_EXIT;
 }
 
 /* Generate a v6 exception return.  Marks both values as dead.  */
@@ -4366,7 +4384,7 @@ static void gen_rfe(DisasContext *s, TCGv_i32 pc, TCGv_i32 cpsr)
     gen_helper_cpsr_write_eret(cpu_env, cpsr);
     tcg_temp_free_i32(cpsr);
     store_reg(s, 15, pc);
-    s->is_jmp = DISAS_JUMP;
+    s->is_jmp = DISAS_EXIT;
 }
 
 static void gen_nop_hint(DisasContext *s, int val)
@@ -5466,6 +5484,65 @@ static int disas_neon_data_insn(DisasContext *s, uint32_t insn)
             tcg_temp_free_i32(tmp3);
             return 0;
         }
+        {
+            /* Elementwise integer operations that the generic vector
+               expanders handle directly, using host vectors if possible. */
+            long rd_ofs = vfp_reg_offset(1, rd);
+            long rn_ofs = vfp_reg_offset(1, rn);
+            long rm_ofs = vfp_reg_offset(1, rm);
+            int vec_size = q ? 16 : 8;
+
+            switch (op) {
+            case NEON_3R_LOGIC:
+                switch ((u << 2) | size) {
+                case 0: /* VAND */
+                    tcg_gen_gvec_and(0, cpu_env, rd_ofs, rn_ofs, rm_ofs,
+                                     vec_size);
+                    return 0;
+                case 1: /* BIC */
+                    tcg_gen_gvec_andc(0, cpu_env, rd_ofs, rn_ofs, rm_ofs,
+                                      vec_size);
+                    return 0;
+                case 2: /* VORR */
+                    tcg_gen_gvec_or(0, cpu_env, rd_ofs, rn_ofs, rm_ofs,
+                                    vec_size);
+                    return 0;
+                case 3: /* VORN */
+                    tcg_gen_gvec_orc(0, cpu_env, rd_ofs, rn_ofs, rm_ofs,
+                                     vec_size);
+                    return 0;
+                case 4: /* VEOR */
+                    tcg_gen_gvec_xor(0, cpu_env, rd_ofs, rn_ofs, rm_ofs,
+                                     vec_size);
+                    return 0;
+                }
+                break;
+            case NEON_3R_VADD_VSUB:
+                if (u) {
+                    tcg_gen_gvec_sub(size, cpu_env, rd_ofs, rn_ofs, rm_ofs,
+                                     vec_size);
+                } else {
+                    tcg_gen_gvec_add(size, cpu_env, rd_ofs, rn_ofs, rm_ofs,
+                                     vec_size);
+                }
+                return 0;
+            case NEON_3R_VTST_VCEQ:
+                if (u) { /* VCEQ */
+                    tcg_gen_gvec_cmp(TCG_COND_EQ, size, cpu_env,
+                                     rd_ofs, rn_ofs, rm_ofs, vec_size);
+                    return 0;
+                }
+                break;
+            case NEON_3R_VCGT:
+                tcg_gen_gvec_cmp(u ? TCG_COND_GTU : TCG_COND_GT, size, cpu_env,
+                                 rd_ofs, rn_ofs, rm_ofs, vec_size);
+                return 0;
+            case NEON_3R_VCGE:
+                tcg_gen_gvec_cmp(u ? TCG_COND_GEU : TCG_COND_GE, size, cpu_env,
+                                 rd_ofs, rn_ofs, rm_ofs, vec_size);
+                return 0;
+            }
+        }
         if (size == 3 && op != NEON_3R_LOGIC) {
             /* 64-bit element instructions. */
             for (pass = 0; pass < (q ? 2 : 1); pass++) {
@@ -5952,6 +6029,29 @@ static int disas_neon_data_insn(DisasContext *s, uint32_t insn)
                    element size in bits.  */
                 if (op <= 4)
                     shift = shift - (1 << (size + 3));
+                if (op == 0 || (op == 5 && !u)) {
+                    /* VSHR and VSHL: use the generic vector expanders.  */
+                    long rd_ofs = vfp_reg_offset(1, rd);
+                    long rm_ofs = vfp_reg_offset(1, rm);
+                    int vec_size = q ? 16 : 8;
+                    int esize = 8 << size;
+
+                    if (op == 5) {
+                        tcg_gen_gvec_shli(size, cpu_env, rd_ofs, rm_ofs,
+                                          shift, vec_size);
+                    } else if (!u) {
+                        /* A shift by the element size is the same as a
+                           shift by one less: all copies of the sign.  */
+                        tcg_gen_gvec_sari(size, cpu_env, rd_ofs, rm_ofs,
+                                          MIN(-shift, esize - 1), vec_size);
+                    } else if (-shift == esize) {
+                        tcg_gen_gvec_dupi(size, cpu_env, rd_ofs, vec_size, 0);
+                    } else {
+                        tcg_gen_gvec_shri(size, cpu_env, rd_ofs, rm_ofs,
+                                          -shift, vec_size);
+                    }
+                    return 0;
+                }
                 if (size == 3) {
                     count = q + 1;
                 } else {
@@ -7684,9 +7784,11 @@ static void gen_logicq_cc(TCGv_i32 lo, TCGv_i32 hi)
    the architecturally mandated semantics, and avoids having to monitor
    regular stores.
 
-   In system emulation mode only one CPU will be running at once, so
-   this sequence is effectively atomic.  In user emulation mode we
-   throw an exception and handle the atomic operation elsewhere.  */
+   The store is done with an atomic compare-and-swap against the value
+   that was loaded, so this works in both system and user emulation
+   without stopping the other CPUs.  The doubleword forms load and
+   compare all 64 bits at once; EXCLUSIVE_VAL holds them in the order
+   given by the data endianness.  */
 static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
                                TCGv_i32 addr, int size)
 {
@@ -7702,23 +7804,29 @@ static void gen_load_exclusive(DisasContext *s, int rt, int rt2,
         gen_aa32_ld16ua(s, tmp, addr, get_mem_index(s));
         break;
     case 2:
-    case 3:
         gen_aa32_ld32ua(s, tmp, addr, get_mem_index(s));
         break;
+    case 3:
+    {
+        TCGMemOp opc = MO_Q | MO_ALIGN | s->be_data;
+        TCGv taddr = gen_aa32_addr(s, addr, opc);
+        TCGv_i32 tmp2 = tcg_temp_new_i32();
+
+        tcg_gen_qemu_ld_i64(cpu_exclusive_val, taddr, get_mem_index(s), opc);
+        tcg_temp_free(taddr);
+        if (s->be_data == MO_BE) {
+            tcg_gen_extr_i64_i32(tmp2, tmp, cpu_exclusive_val);
+        } else {
+            tcg_gen_extr_i64_i32(tmp, tmp2, cpu_exclusive_val);
+        }
+        store_reg(s, rt2, tmp2);
+        break;
+    }
     default:
         abort();
     }
 
-    if (size == 3) {
-        TCGv_i32 tmp2 = tcg_temp_new_i32();
-        TCGv_i32 tmp3 = tcg_temp_new_i32();
-
-        tcg_gen_addi_i32(tmp2, addr, 4);
-        gen_aa32_ld32u(s, tmp3, tmp2, get_mem_index(s));
-        tcg_temp_free_i32(tmp2);
-        tcg_gen_concat_i32_i64(cpu_exclusive_val, tmp, tmp3);
-        store_reg(s, rt2, tmp3);
-    } else {
+    if (size != 3) {
         tcg_gen_extu_i32_i64(cpu_exclusive_val, tmp);
     }
 
@@ -7731,23 +7839,15 @@ static void gen_clrex(DisasContext *s)
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
 }
 
-#ifdef CONFIG_USER_ONLY
 static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
                                 TCGv_i32 addr, int size)
 {
-    tcg_gen_extu_i32_i64(cpu_exclusive_test, addr);
-    tcg_gen_movi_i32(cpu_exclusive_info,
-                     size | (rd << 4) | (rt << 8) | (rt2 << 12));
-    gen_exception_internal_insn(s, 4, EXCP_STREX);
-}
-#else
-static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
-                                TCGv_i32 addr, int size)
-{
-    TCGv_i32 tmp;
-    TCGv_i64 val64, extaddr;
+    TCGv_i32 t0, t1, t2;
+    TCGv_i64 extaddr;
+    TCGv taddr;
     TCGLabel *done_label;
     TCGLabel *fail_label;
+    TCGMemOp opc = size | MO_ALIGN | s->be_data;
 
     /* if (env->exclusive_addr == addr && env->exclusive_val == [addr]) {
          [addr] = {Rt};
@@ -7762,69 +7862,48 @@ static void gen_store_exclusive(DisasContext *s, int rd, int rt, int rt2,
     tcg_gen_brcond_i64(TCG_COND_NE, extaddr, cpu_exclusive_addr, fail_label);
     tcg_temp_free_i64(extaddr);
 
-    tmp = tcg_temp_new_i32();
-    switch (size) {
-    case 0:
-        gen_aa32_ld8u(s, tmp, addr, get_mem_index(s));
-        break;
-    case 1:
-        gen_aa32_ld16u(s, tmp, addr, get_mem_index(s));
-        break;
-    case 2:
-    case 3:
-        gen_aa32_ld32u(s, tmp, addr, get_mem_index(s));
-        break;
-    default:
-        abort();
-    }
-
-    val64 = tcg_temp_new_i64();
+    taddr = gen_aa32_addr(s, addr, opc);
+    t0 = tcg_temp_new_i32();
+    t1 = load_reg(s, rt);
     if (size == 3) {
-        TCGv_i32 tmp2 = tcg_temp_new_i32();
-        TCGv_i32 tmp3 = tcg_temp_new_i32();
-        tcg_gen_addi_i32(tmp2, addr, 4);
-        gen_aa32_ld32u(s, tmp3, tmp2, get_mem_index(s));
-        tcg_temp_free_i32(tmp2);
-        tcg_gen_concat_i32_i64(val64, tmp, tmp3);
-        tcg_temp_free_i32(tmp3);
-    } else {
-        tcg_gen_extu_i32_i64(val64, tmp);
-    }
-    tcg_temp_free_i32(tmp);
+        TCGv_i64 o64 = tcg_temp_new_i64();
+        TCGv_i64 n64 = tcg_temp_new_i64();
 
-    tcg_gen_brcond_i64(TCG_COND_NE, val64, cpu_exclusive_val, fail_label);
-    tcg_temp_free_i64(val64);
+        t2 = load_reg(s, rt2);
+        if (s->be_data == MO_BE) {
+            tcg_gen_concat_i32_i64(n64, t2, t1);
+        } else {
+            tcg_gen_concat_i32_i64(n64, t1, t2);
+        }
+        tcg_temp_free_i32(t2);
 
-    tmp = load_reg(s, rt);
-    switch (size) {
-    case 0:
-        gen_aa32_st8(s, tmp, addr, get_mem_index(s));
-        break;
-    case 1:
-        gen_aa32_st16(s, tmp, addr, get_mem_index(s));
-        break;
-    case 2:
-    case 3:
-        gen_aa32_st32(s, tmp, addr, get_mem_index(s));
-        break;
-    default:
-        abort();
-    }
-    tcg_temp_free_i32(tmp);
-    if (size == 3) {
-        tcg_gen_addi_i32(addr, addr, 4);
-        tmp = load_reg(s, rt2);
-        gen_aa32_st32(s, tmp, addr, get_mem_index(s));
-        tcg_temp_free_i32(tmp);
+        tcg_gen_atomic_cmpxchg_i64(o64, cpu_env, taddr, cpu_exclusive_val,
+                                   n64, get_mem_index(s), opc);
+        tcg_temp_free_i64(n64);
+
+        tcg_gen_setcond_i64(TCG_COND_NE, o64, o64, cpu_exclusive_val);
+        tcg_gen_extrl_i64_i32(t0, o64);
+
+        tcg_temp_free_i64(o64);
+    } else {
+        t2 = tcg_temp_new_i32();
+        tcg_gen_extrl_i64_i32(t2, cpu_exclusive_val);
+        tcg_gen_atomic_cmpxchg_i32(t0, cpu_env, taddr, t2, t1,
+                                   get_mem_index(s), opc);
+        tcg_gen_setcond_i32(TCG_COND_NE, t0, t0, t2);
+        tcg_temp_free_i32(t2);
     }
-    tcg_gen_movi_i32(cpu_R[rd], 0);
+    tcg_temp_free_i32(t1);
+    tcg_temp_free(taddr);
+    tcg_gen_mov_i32(cpu_R[rd], t0);
+    tcg_temp_free_i32(t0);
     tcg_gen_br(done_label);
+
     gen_set_label(fail_label);
     tcg_gen_movi_i32(cpu_R[rd], 1);
     gen_set_label(done_label);
     tcg_gen_movi_i64(cpu_exclusive_addr, -1);
 }
-#endif
 
 /* gen_srs:
  * @env: CPUARMState
@@ -9382,7 +9461,7 @@ static void disas_arm_insn(DisasContext *s, unsigned int insn)
                     tmp = load_cpu_field(spsr);
                     gen_helper_cpsr_write_eret(cpu_env, tmp);
                     tcg_temp_free_i32(tmp);
-                    s->is_jmp = DISAS_JUMP;
+                    s->is_jmp = DISAS_EXIT;
                 }
             }
             break;
@@ -11911,10 +11990,14 @@ void gen_intermediate_code(CPUARMState *env, TranslationBlock *tb)
         case DISAS_NEXT:
             gen_goto_tb(dc, 1, dc->pc);
             break;
+        case DISAS_JUMP:
+            /* only the PC changed: look up the next TB and jump to it */
+            tcg_gen_lookup_and_goto_ptr(cpu_env);
+            break;
         case DISAS_UPDATE:
             gen_set_pc_im(dc, dc->pc);
             /* fall through */
-        case DISAS_JUMP:
+        case DISAS_EXIT:
         default:
             /* indicate that the hash table must be used to find the next TB */
             tcg_gen_exit_tb(0);
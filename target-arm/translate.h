@@ -120,6 +120,12 @@ static inline int default_exception_el(DisasContext *s)
 #define DISAS_HVC 8
 #define DISAS_SMC 9
 #define DISAS_YIELD 10
+/* CPU state was modified dynamically in a way that requires a return to
+ * the main loop (e.g. interrupt masking or exception return); the PC has
+ * already been updated.  Unlike DISAS_JUMP we must not jump straight to
+ * the next TB with lookup_and_goto_ptr.
+ */
+#define DISAS_EXIT 11
 
 #ifdef TARGET_AARCH64
 void a64_translate_init(void);
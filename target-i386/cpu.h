@@ -35,6 +35,9 @@
    close to the modifying instruction */
 #define TARGET_HAS_PRECISE_SMC
 
+/* The TCG front-end is safe to run with one thread per vCPU */
+#define TARGET_SUPPORTS_MTTCG
+
 #ifdef TARGET_X86_64
 #define I386_ELF_MACHINE  EM_X86_64
 #define ELF_MACHINE_UNAME "x86_64"
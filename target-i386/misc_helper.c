@@ -22,6 +22,7 @@
 #include "exec/helper-proto.h"
 #include "exec/cpu_ldst.h"
 #include "exec/address-spaces.h"
+#include "qemu/main-loop.h"
 
 void helper_outb(CPUX86State *env, uint32_t port, uint32_t data)
 {
@@ -120,6 +121,24 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
 {
 }
 #else
+/* The local APIC is device state protected by the BQL, which is not held
+   while executing guest code with multi-threaded TCG.  */
+static bool apic_lock_iothread(void)
+{
+    if (!qemu_mutex_iothread_locked()) {
+        qemu_mutex_lock_iothread();
+        return true;
+    }
+    return false;
+}
+
+static void apic_unlock_iothread(bool locked)
+{
+    if (locked) {
+        qemu_mutex_unlock_iothread();
+    }
+}
+
 target_ulong helper_read_crN(CPUX86State *env, int reg)
 {
     target_ulong val;
@@ -131,7 +150,9 @@ target_ulong helper_read_crN(CPUX86State *env, int reg)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            bool locked = apic_lock_iothread();
             val = cpu_get_apic_tpr(x86_env_get_cpu(env)->apic_state);
+            apic_unlock_iothread(locked);
         } else {
             val = env->v_tpr;
         }
@@ -155,7 +176,9 @@ void helper_write_crN(CPUX86State *env, int reg, target_ulong t0)
         break;
     case 8:
         if (!(env->hflags2 & HF2_VINTR_MASK)) {
+            bool locked = apic_lock_iothread();
             cpu_set_apic_tpr(x86_env_get_cpu(env)->apic_state, t0);
+            apic_unlock_iothread(locked);
         }
         env->v_tpr = t0 & 0x0f;
         break;
@@ -243,8 +266,12 @@ void helper_wrmsr(CPUX86State *env)
         env->sysenter_eip = val;
         break;
     case MSR_IA32_APICBASE:
+    {
+        bool locked = apic_lock_iothread();
         cpu_set_apic_base(x86_env_get_cpu(env)->apic_state, val);
+        apic_unlock_iothread(locked);
         break;
+    }
     case MSR_EFER:
         {
             uint64_t update_mask;
@@ -400,8 +427,12 @@ void helper_rdmsr(CPUX86State *env)
         val = env->sysenter_eip;
         break;
     case MSR_IA32_APICBASE:
+    {
+        bool locked = apic_lock_iothread();
         val = cpu_get_apic_base(x86_env_get_cpu(env)->apic_state);
+        apic_unlock_iothread(locked);
         break;
+    }
     case MSR_EFER:
         val = env->efer;
         break;
@@ -1720,15 +1720,13 @@ static inline void do_invalidate_BAT(CPUPPCState *env, target_ulong BATu,
                                      target_ulong mask)
 {
     CPUState *cs = CPU(ppc_env_get_cpu(env));
-    target_ulong base, end, page;
+    target_ulong base, end;
 
     base = BATu & ~0x0001FFFF;
     end = base + mask + 0x00020000;
     LOG_BATS("Flush BAT from " TARGET_FMT_lx " to " TARGET_FMT_lx " ("
              TARGET_FMT_lx ")\n", base, end, mask);
-    for (page = base; page != end; page += TARGET_PAGE_SIZE) {
-        tlb_flush_page(cs, page);
-    }
+    tlb_flush_range(cs, base, end - base);
     LOG_BATS("Flush done\n");
 }
 #endif
@@ -2311,7 +2309,6 @@ void helper_4xx_tlbwe_hi(CPUPPCState *env, target_ulong entry,
     PowerPCCPU *cpu = ppc_env_get_cpu(env);
     CPUState *cs = CPU(cpu);
     ppcemb_tlb_t *tlb;
-    target_ulong page, end;
 
     LOG_SWTLB("%s entry %d val " TARGET_FMT_lx "\n", __func__, (int)entry,
               val);
@@ -2319,12 +2316,10 @@ void helper_4xx_tlbwe_hi(CPUPPCState *env, target_ulong entry,
     tlb = &env->tlb.tlbe[entry];
     /* Invalidate previous TLB (if it's valid) */
     if (tlb->prot & PAGE_VALID) {
-        end = tlb->EPN + tlb->size;
         LOG_SWTLB("%s: invalidate old TLB %d start " TARGET_FMT_lx " end "
-                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN, end);
-        for (page = tlb->EPN; page < end; page += TARGET_PAGE_SIZE) {
-            tlb_flush_page(cs, page);
-        }
+                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN,
+                  tlb->EPN + tlb->size);
+        tlb_flush_range(cs, tlb->EPN, tlb->size);
     }
     tlb->size = booke_tlb_to_page_size((val >> PPC4XX_TLBHI_SIZE_SHIFT)
                                        & PPC4XX_TLBHI_SIZE_MASK);
@@ -2358,12 +2353,10 @@ void helper_4xx_tlbwe_hi(CPUPPCState *env, target_ulong entry,
               tlb->prot & PAGE_VALID ? 'v' : '-', (int)tlb->PID);
     /* Invalidate new TLB (if valid) */
     if (tlb->prot & PAGE_VALID) {
-        end = tlb->EPN + tlb->size;
         LOG_SWTLB("%s: invalidate TLB %d start " TARGET_FMT_lx " end "
-                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN, end);
-        for (page = tlb->EPN; page < end; page += TARGET_PAGE_SIZE) {
-            tlb_flush_page(cs, page);
-        }
+                  TARGET_FMT_lx "\n", __func__, (int)entry, tlb->EPN,
+                  tlb->EPN + tlb->size);
+        tlb_flush_range(cs, tlb->EPN, tlb->size);
     }
 }
 
@@ -29,6 +29,9 @@ static const char * const tcg_target_reg_names[TCG_TARGET_NB_REGS] = {
 #if TCG_TARGET_REG_BITS == 64
     "%rax", "%rcx", "%rdx", "%rbx", "%rsp", "%rbp", "%rsi", "%rdi",
     "%r8",  "%r9",  "%r10", "%r11", "%r12", "%r13", "%r14", "%r15",
+    "%xmm0", "%xmm1", "%xmm2", "%xmm3", "%xmm4", "%xmm5", "%xmm6", "%xmm7",
+    "%xmm8", "%xmm9", "%xmm10", "%xmm11",
+    "%xmm12", "%xmm13", "%xmm14", "%xmm15",
 #else
     "%eax", "%ecx", "%edx", "%ebx", "%esp", "%ebp", "%esi", "%edi",
 #endif
@@ -52,6 +55,26 @@ static const int tcg_target_reg_alloc_order[] = {
     TCG_REG_RSI,
     TCG_REG_RDI,
     TCG_REG_RAX,
+    TCG_REG_XMM0,
+    TCG_REG_XMM1,
+    TCG_REG_XMM2,
+    TCG_REG_XMM3,
+    TCG_REG_XMM4,
+    TCG_REG_XMM5,
+#ifndef _WIN64
+    /* The Win64 ABI has xmm6-xmm15 as call-saved, and we do not save
+       any of them.  Therefore only allow xmm0-xmm5 to be allocated.  */
+    TCG_REG_XMM6,
+    TCG_REG_XMM7,
+    TCG_REG_XMM8,
+    TCG_REG_XMM9,
+    TCG_REG_XMM10,
+    TCG_REG_XMM11,
+    TCG_REG_XMM12,
+    TCG_REG_XMM13,
+    TCG_REG_XMM14,
+    TCG_REG_XMM15,
+#endif
 #else
     TCG_REG_EBX,
     TCG_REG_ESI,
@@ -93,6 +116,14 @@ static const int tcg_target_call_oarg_regs[] = {
 #define TCG_CT_CONST_U32 0x200
 #define TCG_CT_CONST_I32 0x400
 
+/* The SSE registers available for host vectors; see the comment in
+   tcg_target_reg_alloc_order.  */
+#ifdef _WIN64
+# define ALL_VECTOR_REGS 0x003f0000
+#else
+# define ALL_VECTOR_REGS 0xffff0000
+#endif
+
 /* Registers used with L constraint, which are the first argument 
    registers on x86_64, and two random call clobbered registers on
    i386. */
@@ -238,6 +269,11 @@ static int target_parse_constraint(TCGArgConstraint *ct, const char **pct_str)
         tcg_regset_reset_reg(ct->u.regs, TCG_REG_L1);
         break;
 
+    case 'x':
+        ct->ct |= TCG_CT_REG;
+        tcg_regset_set32(ct->u.regs, 0, ALL_VECTOR_REGS);
+        break;
+
     case 'e':
         ct->ct |= TCG_CT_CONST_S32;
         break;
@@ -333,6 +369,37 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define OPC_MOVSLQ	(0x63 | P_REXW)
 #define OPC_MOVZBL	(0xb6 | P_EXT)
 #define OPC_MOVZWL	(0xb7 | P_EXT)
+#define OPC_MOVD_VyEy   (0x6e | P_EXT | P_DATA16)
+#define OPC_MOVDQA_VxWx (0x6f | P_EXT | P_DATA16)
+#define OPC_MOVDQU_VxWx (0x6f | P_EXT | P_SIMDF3)
+#define OPC_MOVDQU_WxVx (0x7f | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_VqWq   (0x7e | P_EXT | P_SIMDF3)
+#define OPC_MOVQ_WqVq   (0xd6 | P_EXT | P_DATA16)
+#define OPC_PADDB       (0xfc | P_EXT | P_DATA16)
+#define OPC_PADDW       (0xfd | P_EXT | P_DATA16)
+#define OPC_PADDD       (0xfe | P_EXT | P_DATA16)
+#define OPC_PADDQ       (0xd4 | P_EXT | P_DATA16)
+#define OPC_PAND        (0xdb | P_EXT | P_DATA16)
+#define OPC_PANDN       (0xdf | P_EXT | P_DATA16)
+#define OPC_PCMPEQB     (0x74 | P_EXT | P_DATA16)
+#define OPC_PCMPEQW     (0x75 | P_EXT | P_DATA16)
+#define OPC_PCMPEQD     (0x76 | P_EXT | P_DATA16)
+#define OPC_PCMPGTB     (0x64 | P_EXT | P_DATA16)
+#define OPC_PCMPGTW     (0x65 | P_EXT | P_DATA16)
+#define OPC_PCMPGTD     (0x66 | P_EXT | P_DATA16)
+#define OPC_POR         (0xeb | P_EXT | P_DATA16)
+#define OPC_PSHIFTW_Ib  (0x71 | P_EXT | P_DATA16) /* /2 /6 /4 */
+#define OPC_PSHIFTD_Ib  (0x72 | P_EXT | P_DATA16) /* /2 /6 /4 */
+#define OPC_PSHIFTQ_Ib  (0x73 | P_EXT | P_DATA16) /* /2 /6 */
+#define OPC_PSHUFD      (0x70 | P_EXT | P_DATA16)
+#define OPC_PSUBB       (0xf8 | P_EXT | P_DATA16)
+#define OPC_PSUBW       (0xf9 | P_EXT | P_DATA16)
+#define OPC_PSUBD       (0xfa | P_EXT | P_DATA16)
+#define OPC_PSUBQ       (0xfb | P_EXT | P_DATA16)
+#define OPC_PUNPCKLBW   (0x60 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLWD   (0x61 | P_EXT | P_DATA16)
+#define OPC_PUNPCKLQDQ  (0x6c | P_EXT | P_DATA16)
+#define OPC_PXOR        (0xef | P_EXT | P_DATA16)
 #define OPC_POP_r32	(0x58)
 #define OPC_PUSH_r32	(0x50)
 #define OPC_PUSH_Iv	(0x68)
@@ -383,6 +450,11 @@ static inline int tcg_target_const_match(tcg_target_long val, TCGType type,
 #define EXT5_CALLN_Ev	2
 #define EXT5_JMPN_Ev	4
 
+/* Opcode extensions for the SSE immediate shifts, OPC_PSHIFT*_Ib.  */
+#define EXT_PSHIFT_SRL  2
+#define EXT_PSHIFT_SRA  4
+#define EXT_PSHIFT_SLL  6
+
 /* Condition codes to be added to OPC_JCC_{long,short}.  */
 #define JCC_JMP (-1)
 #define JCC_JO  0x0
@@ -424,10 +496,16 @@ static void tcg_out_opc(TCGContext *s, int opc, int r, int rm, int x)
         tcg_out8(s, 0x65);
     }
     if (opc & P_DATA16) {
-        /* We should never be asking for both 16 and 64-bit operation.  */
-        assert((opc & P_REXW) == 0);
+        /* We should never be asking for both 16 and 64-bit operation,
+           except where 0x66 is the mandatory prefix of an SSE insn.  */
+        assert((opc & P_REXW) == 0 || (opc & P_EXT));
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & P_ADDR32) {
         tcg_out8(s, 0x67);
     }
@@ -465,6 +543,11 @@ static void tcg_out_opc(TCGContext *s, int opc)
     if (opc & P_DATA16) {
         tcg_out8(s, 0x66);
     }
+    if (opc & P_SIMDF3) {
+        tcg_out8(s, 0xf3);
+    } else if (opc & P_SIMDF2) {
+        tcg_out8(s, 0xf2);
+    }
     if (opc & (P_EXT | P_EXT38)) {
         tcg_out8(s, 0x0f);
         if (opc & P_EXT38) {
@@ -635,7 +718,20 @@ static inline void tcg_out_mov(TCGContext *s, TCGType type,
                                TCGReg ret, TCGReg arg)
 {
     if (arg != ret) {
-        int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+        int opc;
+
+        switch (type) {
+        case TCG_TYPE_V64:
+        case TCG_TYPE_V128:
+            opc = OPC_MOVDQA_VxWx;
+            break;
+        case TCG_TYPE_I64:
+            opc = OPC_MOVL_GvEv + P_REXW;
+            break;
+        default:
+            opc = OPC_MOVL_GvEv;
+            break;
+        }
         tcg_out_modrm(s, opc, ret, arg);
     }
 }
@@ -686,6 +782,19 @@ static inline void tcg_out_pushi(TCGContext *s, tcg_target_long val)
     }
 }
 
+/* Emit a nop of N bytes, 1 <= N <= 3, as the one byte "xchg %eax,%eax"
+   with operand size prefixes.  */
+static void tcg_out_nopn(TCGContext *s, int n)
+{
+    int i;
+
+    tcg_debug_assert(n >= 1);
+    for (i = 1; i < n; ++i) {
+        tcg_out8(s, 0x66);
+    }
+    tcg_out8(s, 0x90);
+}
+
 static inline void tcg_out_push(TCGContext *s, int reg)
 {
     tcg_out_opc(s, OPC_PUSH_r32 + LOWREGMASK(reg), 0, reg, 0);
@@ -699,14 +808,44 @@ static inline void tcg_out_pop(TCGContext *s, int reg)
 static inline void tcg_out_ld(TCGContext *s, TCGType type, TCGReg ret,
                               TCGReg arg1, intptr_t arg2)
 {
-    int opc = OPC_MOVL_GvEv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+    int opc;
+
+    switch (type) {
+    case TCG_TYPE_V64:
+        opc = OPC_MOVQ_VqWq;
+        break;
+    case TCG_TYPE_V128:
+        opc = OPC_MOVDQU_VxWx;
+        break;
+    case TCG_TYPE_I64:
+        opc = OPC_MOVL_GvEv + P_REXW;
+        break;
+    default:
+        opc = OPC_MOVL_GvEv;
+        break;
+    }
     tcg_out_modrm_offset(s, opc, ret, arg1, arg2);
 }
 
 static inline void tcg_out_st(TCGContext *s, TCGType type, TCGReg arg,
                               TCGReg arg1, intptr_t arg2)
 {
-    int opc = OPC_MOVL_EvGv + (type == TCG_TYPE_I64 ? P_REXW : 0);
+    int opc;
+
+    switch (type) {
+    case TCG_TYPE_V64:
+        opc = OPC_MOVQ_WqVq;
+        break;
+    case TCG_TYPE_V128:
+        opc = OPC_MOVDQU_WxVx;
+        break;
+    case TCG_TYPE_I64:
+        opc = OPC_MOVL_EvGv + P_REXW;
+        break;
+    default:
+        opc = OPC_MOVL_EvGv;
+        break;
+    }
     tcg_out_modrm_offset(s, opc, arg, arg1, arg2);
 }
 
@@ -1211,8 +1350,10 @@ static inline void tcg_out_tlb_load(TCGContext *s, TCGReg addrlo, TCGReg addrhi,
 
     tgen_arithi(s, ARITH_AND + trexw, r1,
                 TARGET_PAGE_MASK | (aligned ? s_mask : 0), 0);
-    tgen_arithi(s, ARITH_AND + tlbrexw, r0,
-                (CPU_TLB_SIZE - 1) << CPU_TLB_ENTRY_BITS, 0);
+    /* and tlb_mask[mem_index](env), r0 -- the TLB size changes at
+       flush time.  */
+    tcg_out_modrm_offset(s, OPC_ARITH_GvEv + (ARITH_AND << 3) + tlbrexw, r0,
+                         TCG_AREG0, offsetof(CPUArchState, tlb_mask[mem_index]));
 
     tcg_out_modrm_sib_offset(s, OPC_LEA + hrexw, r0, TCG_AREG0, r0, 0,
                              offsetof(CPUArchState, tlb_table[mem_index][0])
@@ -1754,6 +1895,77 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args, bool is64)
 #endif
 }
 
+#if TCG_TARGET_REG_BITS == 64
+static const int add_insn[4] = {
+    OPC_PADDB, OPC_PADDW, OPC_PADDD, OPC_PADDQ
+};
+static const int sub_insn[4] = {
+    OPC_PSUBB, OPC_PSUBW, OPC_PSUBD, OPC_PSUBQ
+};
+static const int cmpeq_insn[3] = {
+    OPC_PCMPEQB, OPC_PCMPEQW, OPC_PCMPEQD
+};
+static const int cmpgt_insn[3] = {
+    OPC_PCMPGTB, OPC_PCMPGTW, OPC_PCMPGTD
+};
+
+/* Replicate the low element of general register A across vector R.  */
+static void tcg_out_dup_vec(TCGContext *s, unsigned vece, TCGReg r, TCGReg a)
+{
+    if (vece == MO_64) {
+        tcg_out_modrm(s, OPC_MOVD_VyEy + P_REXW, r, a);
+        tcg_out_modrm(s, OPC_PUNPCKLQDQ, r, r);
+        return;
+    }
+
+    tcg_out_modrm(s, OPC_MOVD_VyEy, r, a);
+    switch (vece) {
+    case MO_8:
+        tcg_out_modrm(s, OPC_PUNPCKLBW, r, r);
+        /* fall through */
+    case MO_16:
+        tcg_out_modrm(s, OPC_PUNPCKLWD, r, r);
+        /* fall through */
+    case MO_32:
+        tcg_out_modrm(s, OPC_PSHUFD, r, r);
+        tcg_out8(s, 0);
+        break;
+    default:
+        tcg_abort();
+    }
+}
+
+static void tcg_out_vec_shifti(TCGContext *s, int ext, unsigned vece,
+                               TCGReg r, int count)
+{
+    static const int shift_insn[4] = {
+        -1, OPC_PSHIFTW_Ib, OPC_PSHIFTD_Ib, OPC_PSHIFTQ_Ib
+    };
+
+    tcg_debug_assert(vece != MO_8);
+    tcg_out_modrm(s, shift_insn[vece], ext, r);
+    tcg_out8(s, count);
+}
+
+int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece)
+{
+    switch (opc) {
+    case INDEX_op_shli_vec:
+    case INDEX_op_shri_vec:
+        /* SSE has no byte shifts.  */
+        return vece != MO_8;
+    case INDEX_op_sari_vec:
+        /* Nor a 64-bit arithmetic shift before AVX-512.  */
+        return vece == MO_16 || vece == MO_32;
+    case INDEX_op_cmp_vec:
+        /* PCMPEQQ and PCMPGTQ need SSE4.1 and SSE4.2.  */
+        return vece <= MO_32;
+    default:
+        return 1;
+    }
+}
+#endif
+
 static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
                               const TCGArg *args, const int *const_args)
 {
@@ -1774,9 +1986,20 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         tcg_out_movi(s, TCG_TYPE_PTR, TCG_REG_EAX, args[0]);
         tcg_out_jmp(s, tb_ret_addr);
         break;
+    case INDEX_op_goto_ptr:
+        /* jmp to the given host address (could be epilogue) */
+        tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, args[0]);
+        break;
     case INDEX_op_goto_tb:
         if (s->tb_jmp_offset) {
             /* direct jump method */
+            /* jump displacement must be aligned for atomic patching
+               while other vCPUs may be executing the code; see if we
+               need to add extra nops before the jump */
+            int gap = -(uintptr_t)(s->code_ptr + 1) & 3;
+            if (gap) {
+                tcg_out_nopn(s, gap);
+            }
             tcg_out8(s, OPC_JMP_long); /* jmp im */
             s->tb_jmp_offset[args[0]] = tcg_current_code_size(s);
             tcg_out32(s, 0);
@@ -2097,8 +2320,60 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
         }
         break;
 
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ld_vec:
+        tcg_out_ld(s, args[3], args[0], args[1], args[2]);
+        break;
+    case INDEX_op_st_vec:
+        tcg_out_st(s, args[3], args[0], args[1], args[2]);
+        break;
+    case INDEX_op_dup_vec:
+        tcg_out_dup_vec(s, args[2], args[0], args[1]);
+        break;
+
+    case INDEX_op_add_vec:
+        tcg_out_modrm(s, add_insn[args[3]], args[0], args[2]);
+        break;
+    case INDEX_op_sub_vec:
+        tcg_out_modrm(s, sub_insn[args[3]], args[0], args[2]);
+        break;
+    case INDEX_op_and_vec:
+        tcg_out_modrm(s, OPC_PAND, args[0], args[2]);
+        break;
+    case INDEX_op_or_vec:
+        tcg_out_modrm(s, OPC_POR, args[0], args[2]);
+        break;
+    case INDEX_op_xor_vec:
+        tcg_out_modrm(s, OPC_PXOR, args[0], args[2]);
+        break;
+    case INDEX_op_andc_vec:
+        /* PANDN complements its destination, which is aliased to B.  */
+        tcg_out_modrm(s, OPC_PANDN, args[0], args[1]);
+        break;
+
+    case INDEX_op_shli_vec:
+        tcg_out_vec_shifti(s, EXT_PSHIFT_SLL, args[3], args[0], args[2]);
+        break;
+    case INDEX_op_shri_vec:
+        tcg_out_vec_shifti(s, EXT_PSHIFT_SRL, args[3], args[0], args[2]);
+        break;
+    case INDEX_op_sari_vec:
+        tcg_out_vec_shifti(s, EXT_PSHIFT_SRA, args[3], args[0], args[2]);
+        break;
+
+    case INDEX_op_cmp_vec:
+        if (args[3] == TCG_COND_EQ) {
+            tcg_out_modrm(s, cmpeq_insn[args[4]], args[0], args[2]);
+        } else {
+            tcg_debug_assert(args[3] == TCG_COND_GT);
+            tcg_out_modrm(s, cmpgt_insn[args[4]], args[0], args[2]);
+        }
+        break;
+#endif
+
     case INDEX_op_mov_i32:  /* Always emitted via tcg_out_mov.  */
     case INDEX_op_mov_i64:
+    case INDEX_op_mov_vec:
     case INDEX_op_movi_i32: /* Always emitted via tcg_out_movi.  */
     case INDEX_op_movi_i64:
     case INDEX_op_call:     /* Always emitted via tcg_out_call.  */
@@ -2112,6 +2387,7 @@ static inline void tcg_out_op(TCGContext *s, TCGOpcode opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_br, { } },
     { INDEX_op_ld8u_i32, { "r", "r" } },
     { INDEX_op_ld8s_i32, { "r", "r" } },
@@ -2223,6 +2499,20 @@ static const TCGTargetOpDef x86_op_defs[] = {
 #endif
 
 #if TCG_TARGET_REG_BITS == 64
+    { INDEX_op_ld_vec, { "x", "r" } },
+    { INDEX_op_st_vec, { "x", "r" } },
+    { INDEX_op_dup_vec, { "x", "r" } },
+    { INDEX_op_add_vec, { "x", "0", "x" } },
+    { INDEX_op_sub_vec, { "x", "0", "x" } },
+    { INDEX_op_and_vec, { "x", "0", "x" } },
+    { INDEX_op_or_vec, { "x", "0", "x" } },
+    { INDEX_op_xor_vec, { "x", "0", "x" } },
+    { INDEX_op_andc_vec, { "x", "x", "0" } },
+    { INDEX_op_shli_vec, { "x", "0" } },
+    { INDEX_op_shri_vec, { "x", "0" } },
+    { INDEX_op_sari_vec, { "x", "0" } },
+    { INDEX_op_cmp_vec, { "x", "0", "x" } },
+
     { INDEX_op_qemu_ld_i32, { "r", "L" } },
     { INDEX_op_qemu_st_i32, { "L", "L" } },
     { INDEX_op_qemu_ld_i64, { "r", "L" } },
@@ -2307,6 +2597,13 @@ static void tcg_target_qemu_prologue(TCGContext *s)
     tcg_out_modrm(s, OPC_GRP5, EXT5_JMPN_Ev, tcg_target_call_iarg_regs[1]);
 #endif
 
+    /*
+     * Return path for goto_ptr. Set return value to 0, a-la exit_tb,
+     * and fall through to the rest of the epilogue.
+     */
+    s->code_gen_epilogue = s->code_ptr;
+    tcg_out_movi(s, TCG_TYPE_REG, TCG_REG_EAX, 0);
+
     /* TB epilogue */
     tb_ret_addr = s->code_ptr;
 
@@ -2361,6 +2658,10 @@ static void tcg_target_init(TCGContext *s)
     if (TCG_TARGET_REG_BITS == 64) {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xffff);
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I64], 0, 0xffff);
+        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V64], 0,
+                         ALL_VECTOR_REGS);
+        tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_V128], 0,
+                         ALL_VECTOR_REGS);
     } else {
         tcg_regset_set32(tcg_target_available_regs[TCG_TYPE_I32], 0, 0xff);
     }
@@ -2378,6 +2679,8 @@ static void tcg_target_init(TCGContext *s)
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R9);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R10);
         tcg_regset_set_reg(tcg_target_call_clobber_regs, TCG_REG_R11);
+        /* All of the SSE registers we allocate are call-clobbered.  */
+        tcg_regset_set32(tcg_target_call_clobber_regs, 0, ALL_VECTOR_REGS);
     }
 
     tcg_regset_clear(s->reserved_regs);
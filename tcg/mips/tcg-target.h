@@ -116,6 +116,11 @@ extern bool use_mips32r2_instructions;
 #define TCG_TARGET_HAS_muls2_i32        (!use_mips32r6_instructions)
 #define TCG_TARGET_HAS_muluh_i32        1
 #define TCG_TARGET_HAS_mulsh_i32        1
+#define TCG_TARGET_HAS_goto_ptr         0
+#define TCG_TARGET_HAS_v64              0
+#define TCG_TARGET_HAS_v128             0
+
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB   0
 
 /* optional instructions detected at runtime */
 #define TCG_TARGET_HAS_movcond_i32      use_movnz_instructions
@@ -1329,3 +1329,267 @@ void tcg_optimize(TCGContext *s)
         }
     }
 }
+
+/* The passes below work on the fields of env that the front ends access
+   with plain ld/st ops rather than through TCG globals, such as those
+   used by target-arm's load_cpu_field() and store_cpu_field().  Both
+   stay within a basic block: labels, branches, calls, and guest memory
+   accesses (which may fault or reach MMIO) end the region they track.  */
+
+#define ENV_MEM_ENTRIES 32
+
+typedef struct EnvMemEntry {
+    intptr_t ofs;
+    int size;
+    TCGOpcode ld_opc;   /* the full-width load that VAL satisfies */
+    TCGArg val;
+} EnvMemEntry;
+
+static inline bool arg_is_env(TCGContext *s, TCGArg arg)
+{
+    TCGTemp *ts = &s->temps[arg];
+
+    return ts->fixed_reg && ts->reg == TCG_AREG0;
+}
+
+/* Return the number of bytes accessed by a host load or store opcode,
+   or 0 if OPC is not one.  */
+static int env_mem_size(TCGOpcode opc, bool *is_store)
+{
+    *is_store = false;
+    switch (opc) {
+    case INDEX_op_st8_i32:
+    case INDEX_op_st8_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld8u_i32:
+    case INDEX_op_ld8s_i32:
+    case INDEX_op_ld8u_i64:
+    case INDEX_op_ld8s_i64:
+        return 1;
+    case INDEX_op_st16_i32:
+    case INDEX_op_st16_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld16u_i32:
+    case INDEX_op_ld16s_i32:
+    case INDEX_op_ld16u_i64:
+    case INDEX_op_ld16s_i64:
+        return 2;
+    case INDEX_op_st_i32:
+    case INDEX_op_st32_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld_i32:
+    case INDEX_op_ld32u_i64:
+    case INDEX_op_ld32s_i64:
+        return 4;
+    case INDEX_op_st_i64:
+        *is_store = true;
+        /* fall through */
+    case INDEX_op_ld_i64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+static inline bool env_mem_overlap(const EnvMemEntry *e,
+                                   intptr_t ofs, int size)
+{
+    return ofs < e->ofs + e->size && e->ofs < ofs + size;
+}
+
+/* Whether OP may read or write env other than through an ld/st op
+   whose base is env, or ends the basic block.  */
+static bool env_mem_barrier(TCGContext *s, TCGOp *op, TCGArg *args,
+                            bool for_stores)
+{
+    const TCGOpDef *def = &tcg_op_defs[op->opc];
+    bool is_store;
+
+    if (def->flags & (TCG_OPF_BB_END | TCG_OPF_SIDE_EFFECTS)) {
+        return true;
+    }
+    if (op->opc == INDEX_op_call) {
+        int flags = args[op->callo + op->calli + 1];
+
+        /* A helper may read env through its env argument; only one
+           that is known not to write anything can be ignored when
+           forwarding loads.  */
+        return for_stores ||
+            (flags & (TCG_CALL_NO_SIDE_EFFECTS | TCG_CALL_NO_WRITE_GLOBALS))
+            != (TCG_CALL_NO_SIDE_EFFECTS | TCG_CALL_NO_WRITE_GLOBALS);
+    }
+    if (op->opc == INDEX_op_ld_vec || op->opc == INDEX_op_st_vec) {
+        return true;
+    }
+    if (env_mem_size(op->opc, &is_store)) {
+        /* Accesses through another pointer may alias env.  */
+        return !arg_is_env(s, args[1]);
+    }
+    return false;
+}
+
+/* Redundant load elimination: replace a full-width load from env with
+   a move when an earlier load or store in the same basic block left
+   the value in a temp that has not been redefined since.  */
+void tcg_optimize_env_loads(TCGContext *s)
+{
+    EnvMemEntry ents[ENV_MEM_ENTRIES];
+    int n = 0, count = 0;
+    int oi, oi_next;
+
+    for (oi = s->gen_first_op_idx; oi >= 0; oi = oi_next) {
+        TCGOp * const op = &s->gen_op_buf[oi];
+        TCGArg * const args = &s->gen_opparam_buf[op->args];
+        TCGOpcode opc = op->opc;
+        int nb_oargs, size, i;
+        bool is_store;
+
+        oi_next = op->next;
+
+        if (env_mem_barrier(s, op, args, false)) {
+            n = 0;
+            continue;
+        }
+
+        /* Forget values held in temps that this op redefines.  */
+        if (opc == INDEX_op_discard) {
+            nb_oargs = 1;
+        } else if (opc == INDEX_op_call) {
+            nb_oargs = op->callo;
+        } else {
+            nb_oargs = tcg_op_defs[opc].nb_oargs;
+        }
+        for (i = 0; i < n; ) {
+            int j;
+
+            for (j = 0; j < nb_oargs; j++) {
+                if (ents[i].val == args[j]) {
+                    break;
+                }
+            }
+            if (j < nb_oargs) {
+                ents[i] = ents[--n];
+            } else {
+                i++;
+            }
+        }
+
+        size = env_mem_size(opc, &is_store);
+        if (size == 0) {
+            continue;
+        }
+
+        if (!is_store) {
+            TCGOpcode mov_opc;
+
+            if (opc == INDEX_op_ld_i32) {
+                mov_opc = INDEX_op_mov_i32;
+            } else if (opc == INDEX_op_ld_i64) {
+                mov_opc = INDEX_op_mov_i64;
+            } else {
+                continue;
+            }
+            for (i = 0; i < n; i++) {
+                if (ents[i].ofs == args[2] && ents[i].ld_opc == opc) {
+                    break;
+                }
+            }
+            if (i < n) {
+                op->opc = mov_opc;
+                args[1] = ents[i].val;
+                count++;
+            } else if (n < ENV_MEM_ENTRIES) {
+                ents[n].ofs = args[2];
+                ents[n].size = size;
+                ents[n].ld_opc = opc;
+                ents[n].val = args[0];
+                n++;
+            }
+            continue;
+        }
+
+        for (i = 0; i < n; ) {
+            if (env_mem_overlap(&ents[i], args[2], size)) {
+                ents[i] = ents[--n];
+            } else {
+                i++;
+            }
+        }
+        if ((opc == INDEX_op_st_i32 || opc == INDEX_op_st_i64)
+            && n < ENV_MEM_ENTRIES) {
+            ents[n].ofs = args[2];
+            ents[n].size = size;
+            ents[n].ld_opc = (opc == INDEX_op_st_i32
+                              ? INDEX_op_ld_i32 : INDEX_op_ld_i64);
+            ents[n].val = args[0];
+            n++;
+        }
+    }
+
+#ifdef CONFIG_PROFILER
+    s->rle_op_count += count;
+#endif
+}
+
+/* Dead store elimination: walking backwards, remove a store to env that
+   is entirely overwritten by later stores in the same basic block
+   before anything can read it.  */
+void tcg_optimize_env_stores(TCGContext *s)
+{
+    EnvMemEntry ents[ENV_MEM_ENTRIES];
+    int n = 0, count = 0;
+    int oi, oi_prev;
+
+    for (oi = s->gen_last_op_idx; oi >= 0; oi = oi_prev) {
+        TCGOp * const op = &s->gen_op_buf[oi];
+        TCGArg * const args = &s->gen_opparam_buf[op->args];
+        intptr_t ofs;
+        int size, i;
+        bool is_store;
+
+        oi_prev = op->prev;
+
+        if (env_mem_barrier(s, op, args, true)) {
+            n = 0;
+            continue;
+        }
+        size = env_mem_size(op->opc, &is_store);
+        if (size == 0) {
+            continue;
+        }
+        ofs = args[2];
+
+        if (!is_store) {
+            for (i = 0; i < n; ) {
+                if (env_mem_overlap(&ents[i], ofs, size)) {
+                    ents[i] = ents[--n];
+                } else {
+                    i++;
+                }
+            }
+            continue;
+        }
+
+        for (i = 0; i < n; i++) {
+            if (ents[i].ofs <= ofs
+                && ofs + size <= ents[i].ofs + ents[i].size) {
+                break;
+            }
+        }
+        if (i < n) {
+            tcg_op_remove(s, op);
+            count++;
+        } else if (n < ENV_MEM_ENTRIES) {
+            ents[n].ofs = ofs;
+            ents[n].size = size;
+            n++;
+        }
+    }
+
+#ifdef CONFIG_PROFILER
+    s->dse_op_count += count;
+#endif
+}
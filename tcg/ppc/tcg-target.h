@@ -73,6 +73,11 @@ typedef enum {
 #define TCG_TARGET_HAS_muls2_i32        0
 #define TCG_TARGET_HAS_muluh_i32        1
 #define TCG_TARGET_HAS_mulsh_i32        1
+#define TCG_TARGET_HAS_goto_ptr         0
+#define TCG_TARGET_HAS_v64              0
+#define TCG_TARGET_HAS_v128             0
+
+#define TCG_TARGET_IMPLEMENTS_DYN_TLB   0
 
 #if TCG_TARGET_REG_BITS == 64
 #define TCG_TARGET_HAS_add2_i32         0
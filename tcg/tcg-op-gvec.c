@@ -0,0 +1,545 @@
+/*
+ * Tiny Code Generator for QEMU - generic vector expansion
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "tcg.h"
+#include "tcg-op.h"
+#include "tcg-op-gvec.h"
+
+/* Expansion of a two or three operand operation.  FNI8 operates on 64
+   bits of elements at a time and is always available; FNIV is used
+   instead when the backend can emit OPC for the vector type.  */
+typedef struct {
+    void (*fni8)(unsigned vece, TCGv_i64, TCGv_i64, TCGv_i64);
+    void (*fniv)(unsigned vece, TCGv_vec, TCGv_vec, TCGv_vec);
+    TCGOpcode opc;
+} GVecGen3;
+
+typedef struct {
+    void (*fni8)(unsigned vece, TCGv_i64, TCGv_i64, int64_t);
+    void (*fniv)(unsigned vece, TCGv_vec, TCGv_vec, int64_t);
+    TCGOpcode opc;
+} GVecGen2i;
+
+/* Pick the widest host vector type that OPC can be emitted with for an
+   operation of OPRSZ bytes, or TCG_TYPE_I64 if there is none.  */
+static TCGType choose_vector_type(TCGOpcode opc, unsigned vece,
+                                  uint32_t oprsz)
+{
+    if (TCG_TARGET_HAS_v128 && (oprsz % 16) == 0
+        && tcg_can_emit_vec_op(opc, TCG_TYPE_V128, vece)) {
+        return TCG_TYPE_V128;
+    }
+    if (TCG_TARGET_HAS_v64
+        && tcg_can_emit_vec_op(opc, TCG_TYPE_V64, vece)) {
+        return TCG_TYPE_V64;
+    }
+    return TCG_TYPE_I64;
+}
+
+static void expand_3(const GVecGen3 *g, unsigned vece, TCGv_ptr base,
+                     uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                     uint32_t oprsz)
+{
+    TCGType type = choose_vector_type(g->opc, vece, oprsz);
+    uint32_t i;
+
+    tcg_debug_assert((oprsz % 8) == 0);
+
+    if (type == TCG_TYPE_I64) {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+        TCGv_i64 t1 = tcg_temp_new_i64();
+
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, base, aofs + i);
+            tcg_gen_ld_i64(t1, base, bofs + i);
+            g->fni8(vece, t0, t0, t1);
+            tcg_gen_st_i64(t0, base, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+        tcg_temp_free_i64(t1);
+    } else {
+        uint32_t step = (type == TCG_TYPE_V128 ? 16 : 8);
+        TCGv_vec t0 = tcg_temp_new_vec(type);
+        TCGv_vec t1 = tcg_temp_new_vec(type);
+
+        for (i = 0; i < oprsz; i += step) {
+            tcg_gen_ld_vec(t0, base, aofs + i);
+            tcg_gen_ld_vec(t1, base, bofs + i);
+            g->fniv(vece, t0, t0, t1);
+            tcg_gen_st_vec(t0, base, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+        tcg_temp_free_vec(t1);
+    }
+}
+
+static void expand_2i(const GVecGen2i *g, unsigned vece, TCGv_ptr base,
+                      uint32_t dofs, uint32_t aofs, int64_t c,
+                      uint32_t oprsz)
+{
+    TCGType type = choose_vector_type(g->opc, vece, oprsz);
+    uint32_t i;
+
+    tcg_debug_assert((oprsz % 8) == 0);
+
+    if (type == TCG_TYPE_I64) {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, base, aofs + i);
+            g->fni8(vece, t0, t0, c);
+            tcg_gen_st_i64(t0, base, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+    } else {
+        uint32_t step = (type == TCG_TYPE_V128 ? 16 : 8);
+        TCGv_vec t0 = tcg_temp_new_vec(type);
+
+        for (i = 0; i < oprsz; i += step) {
+            tcg_gen_ld_vec(t0, base, aofs + i);
+            g->fniv(vece, t0, t0, c);
+            tcg_gen_st_vec(t0, base, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+    }
+}
+
+void tcg_gen_gvec_mov(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz)
+{
+    TCGType type = choose_vector_type(INDEX_op_ld_vec, vece, oprsz);
+    uint32_t i;
+
+    tcg_debug_assert((oprsz % 8) == 0);
+
+    if (dofs == aofs) {
+        return;
+    }
+    if (type == TCG_TYPE_I64) {
+        TCGv_i64 t0 = tcg_temp_new_i64();
+
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_ld_i64(t0, base, aofs + i);
+            tcg_gen_st_i64(t0, base, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+    } else {
+        uint32_t step = (type == TCG_TYPE_V128 ? 16 : 8);
+        TCGv_vec t0 = tcg_temp_new_vec(type);
+
+        for (i = 0; i < oprsz; i += step) {
+            tcg_gen_ld_vec(t0, base, aofs + i);
+            tcg_gen_st_vec(t0, base, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+    }
+}
+
+void tcg_gen_gvec_dupi(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t oprsz, uint64_t c)
+{
+    TCGType type = choose_vector_type(INDEX_op_dup_vec, MO_64, oprsz);
+    uint32_t i;
+
+    tcg_debug_assert((oprsz % 8) == 0);
+
+    c = dup_const(vece, c);
+    if (type == TCG_TYPE_I64) {
+        TCGv_i64 t0 = tcg_const_i64(c);
+
+        for (i = 0; i < oprsz; i += 8) {
+            tcg_gen_st_i64(t0, base, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+    } else {
+        uint32_t step = (type == TCG_TYPE_V128 ? 16 : 8);
+        TCGv_vec t0 = tcg_temp_new_vec(type);
+
+        tcg_gen_dupi_vec(MO_64, t0, c);
+        for (i = 0; i < oprsz; i += step) {
+            tcg_gen_st_vec(t0, base, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+    }
+}
+
+/* Integer fallbacks for add and sub: compute the low bits of each
+   element with the sign bits masked off, so that no carry or borrow
+   can cross into the next element, then fix up the sign bits.  */
+static void gen_addv_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 t1, t2, t3;
+    uint64_t m;
+
+    if (vece == MO_64) {
+        tcg_gen_add_i64(d, a, b);
+        return;
+    }
+
+    m = dup_const(vece, 1ull << ((8 << vece) - 1));
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    tcg_gen_andi_i64(t1, a, ~m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_xor_i64(t3, a, b);
+    tcg_gen_add_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+static void gen_subv_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    TCGv_i64 t1, t2, t3;
+    uint64_t m;
+
+    if (vece == MO_64) {
+        tcg_gen_sub_i64(d, a, b);
+        return;
+    }
+
+    m = dup_const(vece, 1ull << ((8 << vece) - 1));
+    t1 = tcg_temp_new_i64();
+    t2 = tcg_temp_new_i64();
+    t3 = tcg_temp_new_i64();
+    tcg_gen_ori_i64(t1, a, m);
+    tcg_gen_andi_i64(t2, b, ~m);
+    tcg_gen_eqv_i64(t3, a, b);
+    tcg_gen_sub_i64(d, t1, t2);
+    tcg_gen_andi_i64(t3, t3, m);
+    tcg_gen_xor_i64(d, d, t3);
+    tcg_temp_free_i64(t1);
+    tcg_temp_free_i64(t2);
+    tcg_temp_free_i64(t3);
+}
+
+void tcg_gen_gvec_add(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_addv_i64,
+        .fniv = tcg_gen_add_vec,
+        .opc = INDEX_op_add_vec,
+    };
+    expand_3(&g, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+void tcg_gen_gvec_sub(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_subv_i64,
+        .fniv = tcg_gen_sub_vec,
+        .opc = INDEX_op_sub_vec,
+    };
+    expand_3(&g, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+static void gen_and_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_and_i64(d, a, b);
+}
+
+static void gen_or_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_or_i64(d, a, b);
+}
+
+static void gen_xor_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_xor_i64(d, a, b);
+}
+
+static void gen_andc_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_andc_i64(d, a, b);
+}
+
+static void gen_orc_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, TCGv_i64 b)
+{
+    tcg_gen_orc_i64(d, a, b);
+}
+
+static void gen_not_vec(TCGv_vec d, TCGv_vec a)
+{
+    TCGv_vec ones = tcg_temp_new_vec(tcg_ctx.temps[GET_TCGV_VEC(d)].type);
+
+    tcg_gen_dupi_vec(MO_64, ones, -1);
+    tcg_gen_xor_vec(MO_64, d, a, ones);
+    tcg_temp_free_vec(ones);
+}
+
+static void gen_orc_vec(unsigned vece, TCGv_vec d, TCGv_vec a, TCGv_vec b)
+{
+    TCGv_vec t = tcg_temp_new_vec(tcg_ctx.temps[GET_TCGV_VEC(d)].type);
+
+    gen_not_vec(t, b);
+    tcg_gen_or_vec(vece, d, a, t);
+    tcg_temp_free_vec(t);
+}
+
+void tcg_gen_gvec_and(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_and_i64,
+        .fniv = tcg_gen_and_vec,
+        .opc = INDEX_op_and_vec,
+    };
+    expand_3(&g, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+void tcg_gen_gvec_or(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_or_i64,
+        .fniv = tcg_gen_or_vec,
+        .opc = INDEX_op_or_vec,
+    };
+    expand_3(&g, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+void tcg_gen_gvec_xor(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_xor_i64,
+        .fniv = tcg_gen_xor_vec,
+        .opc = INDEX_op_xor_vec,
+    };
+    expand_3(&g, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+void tcg_gen_gvec_andc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_andc_i64,
+        .fniv = tcg_gen_andc_vec,
+        .opc = INDEX_op_andc_vec,
+    };
+    expand_3(&g, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+void tcg_gen_gvec_orc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz)
+{
+    static const GVecGen3 g = {
+        .fni8 = gen_orc_i64,
+        .fniv = gen_orc_vec,
+        .opc = INDEX_op_or_vec,
+    };
+    expand_3(&g, vece, base, dofs, aofs, bofs, oprsz);
+}
+
+static void gen_not_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    tcg_gen_not_i64(d, a);
+}
+
+static void gen_notv_vec(unsigned vece, TCGv_vec d, TCGv_vec a, int64_t c)
+{
+    gen_not_vec(d, a);
+}
+
+void tcg_gen_gvec_not(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz)
+{
+    static const GVecGen2i g = {
+        .fni8 = gen_not_i64,
+        .fniv = gen_notv_vec,
+        .opc = INDEX_op_xor_vec,
+    };
+    expand_2i(&g, vece, base, dofs, aofs, 0, oprsz);
+}
+
+static inline uint64_t elt_mask(unsigned vece)
+{
+    return vece == MO_64 ? -1ull : (1ull << (8 << vece)) - 1;
+}
+
+/* Integer fallbacks for the shifts: shift the whole word, then clear
+   the bits that were shifted in from the neighbouring element.  */
+static void gen_shli_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    uint64_t mask = dup_const(vece, elt_mask(vece) << c);
+
+    tcg_gen_shli_i64(d, a, c);
+    if (vece != MO_64) {
+        tcg_gen_andi_i64(d, d, mask);
+    }
+}
+
+static void gen_shri_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    uint64_t mask = dup_const(vece, elt_mask(vece) >> c);
+
+    tcg_gen_shri_i64(d, a, c);
+    if (vece != MO_64) {
+        tcg_gen_andi_i64(d, d, mask);
+    }
+}
+
+static void gen_sari_i64(unsigned vece, TCGv_i64 d, TCGv_i64 a, int64_t c)
+{
+    uint64_t s_mask, c_mask;
+    TCGv_i64 s;
+
+    if (vece == MO_64) {
+        tcg_gen_sari_i64(d, a, c);
+        return;
+    }
+
+    s_mask = dup_const(vece, (1ull << ((8 << vece) - 1)) >> c);
+    c_mask = dup_const(vece, elt_mask(vece) >> c);
+    s = tcg_temp_new_i64();
+
+    tcg_gen_shri_i64(d, a, c);
+    /* Isolate the shifted sign bit of each element and replicate it
+       into the C bits above it.  */
+    tcg_gen_andi_i64(s, d, s_mask);
+    tcg_gen_muli_i64(s, s, (2 << c) - 2);
+    tcg_gen_andi_i64(d, d, c_mask);
+    tcg_gen_or_i64(d, d, s);
+    tcg_temp_free_i64(s);
+}
+
+void tcg_gen_gvec_shli(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, int64_t shift, uint32_t oprsz)
+{
+    static const GVecGen2i g = {
+        .fni8 = gen_shli_i64,
+        .fniv = tcg_gen_shli_vec,
+        .opc = INDEX_op_shli_vec,
+    };
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    expand_2i(&g, vece, base, dofs, aofs, shift, oprsz);
+}
+
+void tcg_gen_gvec_shri(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, int64_t shift, uint32_t oprsz)
+{
+    static const GVecGen2i g = {
+        .fni8 = gen_shri_i64,
+        .fniv = tcg_gen_shri_vec,
+        .opc = INDEX_op_shri_vec,
+    };
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    expand_2i(&g, vece, base, dofs, aofs, shift, oprsz);
+}
+
+void tcg_gen_gvec_sari(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, int64_t shift, uint32_t oprsz)
+{
+    static const GVecGen2i g = {
+        .fni8 = gen_sari_i64,
+        .fniv = tcg_gen_sari_vec,
+        .opc = INDEX_op_sari_vec,
+    };
+    tcg_debug_assert(shift >= 0 && shift < (8 << vece));
+    expand_2i(&g, vece, base, dofs, aofs, shift, oprsz);
+}
+
+static void gen_ld_elt(unsigned vece, bool sign, TCGv_i64 t,
+                       TCGv_ptr base, uint32_t ofs)
+{
+    switch (vece) {
+    case MO_8:
+        (sign ? tcg_gen_ld8s_i64 : tcg_gen_ld8u_i64)(t, base, ofs);
+        break;
+    case MO_16:
+        (sign ? tcg_gen_ld16s_i64 : tcg_gen_ld16u_i64)(t, base, ofs);
+        break;
+    case MO_32:
+        (sign ? tcg_gen_ld32s_i64 : tcg_gen_ld32u_i64)(t, base, ofs);
+        break;
+    default:
+        tcg_gen_ld_i64(t, base, ofs);
+        break;
+    }
+}
+
+static void gen_st_elt(unsigned vece, TCGv_i64 t, TCGv_ptr base, uint32_t ofs)
+{
+    switch (vece) {
+    case MO_8:
+        tcg_gen_st8_i64(t, base, ofs);
+        break;
+    case MO_16:
+        tcg_gen_st16_i64(t, base, ofs);
+        break;
+    case MO_32:
+        tcg_gen_st32_i64(t, base, ofs);
+        break;
+    default:
+        tcg_gen_st_i64(t, base, ofs);
+        break;
+    }
+}
+
+void tcg_gen_gvec_cmp(TCGCond cond, unsigned vece, TCGv_ptr base,
+                      uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz)
+{
+    TCGType type = choose_vector_type(INDEX_op_cmp_vec, vece, oprsz);
+    uint32_t i;
+
+    tcg_debug_assert((oprsz % 8) == 0);
+
+    if (type == TCG_TYPE_I64) {
+        /* The integer fallback works one element at a time; there is
+           no cheap way to produce a per-element mask otherwise.  */
+        bool sign = (cond == TCG_COND_LT || cond == TCG_COND_LE ||
+                     cond == TCG_COND_GT || cond == TCG_COND_GE);
+        uint32_t esz = 1 << vece;
+        TCGv_i64 t0 = tcg_temp_new_i64();
+        TCGv_i64 t1 = tcg_temp_new_i64();
+
+        for (i = 0; i < oprsz; i += esz) {
+            gen_ld_elt(vece, sign, t0, base, aofs + i);
+            gen_ld_elt(vece, sign, t1, base, bofs + i);
+            tcg_gen_setcond_i64(cond, t0, t0, t1);
+            tcg_gen_neg_i64(t0, t0);
+            gen_st_elt(vece, t0, base, dofs + i);
+        }
+        tcg_temp_free_i64(t0);
+        tcg_temp_free_i64(t1);
+    } else {
+        uint32_t step = (type == TCG_TYPE_V128 ? 16 : 8);
+        TCGv_vec t0 = tcg_temp_new_vec(type);
+        TCGv_vec t1 = tcg_temp_new_vec(type);
+
+        for (i = 0; i < oprsz; i += step) {
+            tcg_gen_ld_vec(t0, base, aofs + i);
+            tcg_gen_ld_vec(t1, base, bofs + i);
+            tcg_gen_cmp_vec(cond, vece, t0, t0, t1);
+            tcg_gen_st_vec(t0, base, dofs + i);
+        }
+        tcg_temp_free_vec(t0);
+        tcg_temp_free_vec(t1);
+    }
+}
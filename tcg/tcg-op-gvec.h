@@ -0,0 +1,74 @@
+/*
+ * Tiny Code Generator for QEMU - generic vector expansion
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef TCG_TCG_OP_GVEC_H
+#define TCG_TCG_OP_GVEC_H
+
+/*
+ * "Generic" vectors.  All operands are given as offsets from BASE
+ * (normally cpu_env) to guest vector registers of OPRSZ bytes, which
+ * must be a multiple of 8.  VECE is the log2 of the element size, as
+ * for the MO_8 ... MO_64 memory operation sizes.
+ *
+ * The expansion uses host vector operations where the backend supports
+ * them for the given element size, and otherwise falls back to 64-bit
+ * integer operations, working on several elements at once where that
+ * can be done without carries crossing element boundaries.
+ */
+
+void tcg_gen_gvec_mov(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz);
+void tcg_gen_gvec_not(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t oprsz);
+void tcg_gen_gvec_dupi(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t oprsz, uint64_t c);
+
+void tcg_gen_gvec_add(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_sub(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_and(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_or(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                     uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_xor(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_andc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+void tcg_gen_gvec_orc(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                      uint32_t aofs, uint32_t bofs, uint32_t oprsz);
+
+/* Shifts by an immediate, 0 <= SHIFT < (8 << VECE).  */
+void tcg_gen_gvec_shli(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, int64_t shift, uint32_t oprsz);
+void tcg_gen_gvec_shri(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, int64_t shift, uint32_t oprsz);
+void tcg_gen_gvec_sari(unsigned vece, TCGv_ptr base, uint32_t dofs,
+                       uint32_t aofs, int64_t shift, uint32_t oprsz);
+
+/* Set each element of the destination to all ones if COND holds for the
+   corresponding elements of A and B, and to zero otherwise.  */
+void tcg_gen_gvec_cmp(TCGCond cond, unsigned vece, TCGv_ptr base,
+                      uint32_t dofs, uint32_t aofs, uint32_t bofs,
+                      uint32_t oprsz);
+
+#endif
@@ -0,0 +1,213 @@
+/*
+ * Tiny Code Generator for QEMU - host vector operations
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "qemu/osdep.h"
+#include "tcg.h"
+#include "tcg-op.h"
+
+static inline TCGType vec_type(TCGv_vec v)
+{
+    return tcg_ctx.temps[GET_TCGV_VEC(v)].base_type;
+}
+
+static void vec_gen_op2(TCGOpcode opc, TCGv_vec r, TCGv_vec a)
+{
+    tcg_debug_assert(vec_type(r) == vec_type(a));
+    tcg_gen_op2(&tcg_ctx, opc, GET_TCGV_VEC(r), GET_TCGV_VEC(a));
+}
+
+static void vec_gen_op3(TCGOpcode opc, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    tcg_debug_assert(vec_type(r) == vec_type(a));
+    tcg_debug_assert(vec_type(r) == vec_type(b));
+    tcg_gen_op3(&tcg_ctx, opc, GET_TCGV_VEC(r),
+                GET_TCGV_VEC(a), GET_TCGV_VEC(b));
+}
+
+static void vec_gen_op3i(TCGOpcode opc, unsigned vece, TCGv_vec r,
+                         TCGv_vec a, TCGv_vec b)
+{
+    tcg_debug_assert(vec_type(r) == vec_type(a));
+    tcg_debug_assert(vec_type(r) == vec_type(b));
+    tcg_gen_op4(&tcg_ctx, opc, GET_TCGV_VEC(r),
+                GET_TCGV_VEC(a), GET_TCGV_VEC(b), vece);
+}
+
+void tcg_gen_mov_vec(TCGv_vec r, TCGv_vec a)
+{
+    if (!TCGV_EQUAL_VEC(r, a)) {
+        vec_gen_op2(INDEX_op_mov_vec, r, a);
+    }
+}
+
+void tcg_gen_ld_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset)
+{
+    tcg_gen_op4(&tcg_ctx, INDEX_op_ld_vec, GET_TCGV_VEC(r),
+                GET_TCGV_PTR(base), offset, vec_type(r));
+}
+
+void tcg_gen_st_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset)
+{
+    tcg_gen_op4(&tcg_ctx, INDEX_op_st_vec, GET_TCGV_VEC(r),
+                GET_TCGV_PTR(base), offset, vec_type(r));
+}
+
+void tcg_gen_dup_i64_vec(unsigned vece, TCGv_vec r, TCGv_i64 a)
+{
+    tcg_gen_op3(&tcg_ctx, INDEX_op_dup_vec, GET_TCGV_VEC(r),
+                GET_TCGV_I64(a), vece);
+}
+
+void tcg_gen_dupi_vec(unsigned vece, TCGv_vec r, uint64_t a)
+{
+    TCGv_i64 t = tcg_const_i64(a);
+    tcg_gen_dup_i64_vec(vece, r, t);
+    tcg_temp_free_i64(t);
+}
+
+void tcg_gen_add_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3i(INDEX_op_add_vec, vece, r, a, b);
+}
+
+void tcg_gen_sub_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3i(INDEX_op_sub_vec, vece, r, a, b);
+}
+
+void tcg_gen_and_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_and_vec, r, a, b);
+}
+
+void tcg_gen_or_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_or_vec, r, a, b);
+}
+
+void tcg_gen_xor_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_xor_vec, r, a, b);
+}
+
+void tcg_gen_andc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    vec_gen_op3(INDEX_op_andc_vec, r, a, b);
+}
+
+static void do_shifti(TCGOpcode opc, unsigned vece,
+                      TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    tcg_debug_assert(i >= 0 && i < (8 << vece));
+    tcg_debug_assert(vec_type(r) == vec_type(a));
+
+    if (i == 0) {
+        tcg_gen_mov_vec(r, a);
+    } else {
+        tcg_gen_op4(&tcg_ctx, opc, GET_TCGV_VEC(r), GET_TCGV_VEC(a), i, vece);
+    }
+}
+
+void tcg_gen_shli_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    do_shifti(INDEX_op_shli_vec, vece, r, a, i);
+}
+
+void tcg_gen_shri_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    do_shifti(INDEX_op_shri_vec, vece, r, a, i);
+}
+
+void tcg_gen_sari_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i)
+{
+    do_shifti(INDEX_op_sari_vec, vece, r, a, i);
+}
+
+/* Backends are only required to implement EQ and signed GT; everything
+   else is built from those by swapping, inverting and, for the unsigned
+   conditions, flipping the sign bit of each element.  */
+void tcg_gen_cmp_vec(TCGCond cond, unsigned vece,
+                     TCGv_vec r, TCGv_vec a, TCGv_vec b)
+{
+    TCGType type = vec_type(r);
+    TCGv_vec t1, t2, ones;
+    bool inv = false;
+
+    tcg_debug_assert(type == vec_type(a));
+    tcg_debug_assert(type == vec_type(b));
+
+    switch (cond) {
+    case TCG_COND_NE:
+        inv = true;
+        cond = TCG_COND_EQ;
+        break;
+    case TCG_COND_LE:
+    case TCG_COND_LEU:
+        inv = true;
+        cond = tcg_invert_cond(cond);
+        break;
+    case TCG_COND_GE:
+    case TCG_COND_GEU:
+        inv = true;
+        /* fall through */
+    case TCG_COND_LT:
+    case TCG_COND_LTU:
+        t1 = a, a = b, b = t1;
+        cond = tcg_swap_cond(cond);
+        if (inv) {
+            cond = tcg_invert_cond(cond);
+        }
+        break;
+    default:
+        break;
+    }
+
+    t1 = a;
+    t2 = b;
+    if (cond == TCG_COND_GTU) {
+        uint64_t sign = dup_const(vece, 1ull << ((8 << vece) - 1));
+        TCGv_vec m = tcg_temp_new_vec(type);
+
+        t1 = tcg_temp_new_vec(type);
+        t2 = tcg_temp_new_vec(type);
+        tcg_gen_dupi_vec(MO_64, m, sign);
+        tcg_gen_xor_vec(vece, t1, a, m);
+        tcg_gen_xor_vec(vece, t2, b, m);
+        tcg_temp_free_vec(m);
+        cond = TCG_COND_GT;
+    }
+    tcg_debug_assert(cond == TCG_COND_EQ || cond == TCG_COND_GT);
+
+    tcg_gen_op5(&tcg_ctx, INDEX_op_cmp_vec, GET_TCGV_VEC(r),
+                GET_TCGV_VEC(t1), GET_TCGV_VEC(t2), cond, vece);
+
+    if (!TCGV_EQUAL_VEC(t1, a)) {
+        tcg_temp_free_vec(t1);
+        tcg_temp_free_vec(t2);
+    }
+    if (inv) {
+        ones = tcg_temp_new_vec(type);
+        tcg_gen_dupi_vec(MO_64, ones, -1);
+        tcg_gen_xor_vec(vece, r, r, ones);
+        tcg_temp_free_vec(ones);
+    }
+}
@@ -25,6 +25,7 @@
 #include "qemu/osdep.h"
 #include "tcg.h"
 #include "tcg-op.h"
+#include "qemu/log.h"
 
 /* Reduce the number of ifdefs below.  This assumes that all uses of
    TCGV_HIGH and TCGV_LOW are properly protected by a conditional that
@@ -1844,6 +1845,18 @@ void tcg_gen_goto_tb(unsigned idx)
     tcg_gen_op1i(INDEX_op_goto_tb, idx);
 }
 
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env)
+{
+    if (TCG_TARGET_HAS_goto_ptr && !qemu_loglevel_mask(CPU_LOG_TB_NOCHAIN)) {
+        TCGv_ptr ptr = tcg_temp_new_ptr();
+        gen_helper_lookup_tb_ptr(ptr, env);
+        tcg_gen_op1i(INDEX_op_goto_ptr, GET_TCGV_PTR(ptr));
+        tcg_temp_free_ptr(ptr);
+    } else {
+        tcg_gen_exit_tb(0);
+    }
+}
+
 static inline TCGMemOp tcg_canonicalize_memop(TCGMemOp op, bool is64, bool st)
 {
     switch (op & MO_SIZE) {
@@ -1942,3 +1955,234 @@ void tcg_gen_qemu_st_i64(TCGv_i64 val, TCGv addr, TCGArg idx, TCGMemOp memop)
     memop = tcg_canonicalize_memop(memop, 1, 1);
     gen_ldst_i64(INDEX_op_qemu_st_i64, val, addr, memop, idx);
 }
+
+static void tcg_gen_ext_i32(TCGv_i32 ret, TCGv_i32 val, TCGMemOp opc)
+{
+    switch (opc & MO_SSIZE) {
+    case MO_SB:
+        tcg_gen_ext8s_i32(ret, val);
+        break;
+    case MO_UB:
+        tcg_gen_ext8u_i32(ret, val);
+        break;
+    case MO_SW:
+        tcg_gen_ext16s_i32(ret, val);
+        break;
+    case MO_UW:
+        tcg_gen_ext16u_i32(ret, val);
+        break;
+    default:
+        tcg_gen_mov_i32(ret, val);
+        break;
+    }
+}
+
+static void tcg_gen_ext_i64(TCGv_i64 ret, TCGv_i64 val, TCGMemOp opc)
+{
+    switch (opc & MO_SSIZE) {
+    case MO_SB:
+        tcg_gen_ext8s_i64(ret, val);
+        break;
+    case MO_UB:
+        tcg_gen_ext8u_i64(ret, val);
+        break;
+    case MO_SW:
+        tcg_gen_ext16s_i64(ret, val);
+        break;
+    case MO_UW:
+        tcg_gen_ext16u_i64(ret, val);
+        break;
+    case MO_SL:
+        tcg_gen_ext32s_i64(ret, val);
+        break;
+    case MO_UL:
+        tcg_gen_ext32u_i64(ret, val);
+        break;
+    default:
+        tcg_gen_mov_i64(ret, val);
+        break;
+    }
+}
+
+typedef void (*gen_atomic_cx_i32)(TCGv_i32, TCGv_ptr, TCGv,
+                                  TCGv_i32, TCGv_i32, TCGv_i32);
+typedef void (*gen_atomic_op_i32)(TCGv_i32, TCGv_ptr, TCGv,
+                                  TCGv_i32, TCGv_i32);
+
+static gen_atomic_cx_i32 const table_cmpxchg[MO_32 + 1] = {
+    [MO_8] = gen_helper_atomic_cmpxchgb,
+    [MO_16] = gen_helper_atomic_cmpxchgw,
+    [MO_32] = gen_helper_atomic_cmpxchgl,
+};
+
+static gen_atomic_op_i32 const table_xchg[MO_32 + 1] = {
+    [MO_8] = gen_helper_atomic_xchgb,
+    [MO_16] = gen_helper_atomic_xchgw,
+    [MO_32] = gen_helper_atomic_xchgl,
+};
+
+static gen_atomic_op_i32 const table_fetch_add[MO_32 + 1] = {
+    [MO_8] = gen_helper_atomic_fetch_addb,
+    [MO_16] = gen_helper_atomic_fetch_addw,
+    [MO_32] = gen_helper_atomic_fetch_addl,
+};
+
+void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv_ptr env, TCGv addr,
+                                TCGv_i32 cmpv, TCGv_i32 newv,
+                                TCGArg idx, TCGMemOp memop)
+{
+    TCGv_i32 oi;
+
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+    oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+    table_cmpxchg[memop & MO_SIZE](retv, env, addr, cmpv, newv, oi);
+    tcg_temp_free_i32(oi);
+
+    if (memop & MO_SIGN) {
+        tcg_gen_ext_i32(retv, retv, memop);
+    }
+}
+
+static void do_atomic_op_i32(TCGv_i32 ret, TCGv_ptr env, TCGv addr,
+                             TCGv_i32 val, TCGArg idx, TCGMemOp memop,
+                             gen_atomic_op_i32 const table[])
+{
+    TCGv_i32 oi;
+
+    memop = tcg_canonicalize_memop(memop, 0, 0);
+    oi = tcg_const_i32(make_memop_idx(memop & ~MO_SIGN, idx));
+    table[memop & MO_SIZE](ret, env, addr, val, oi);
+    tcg_temp_free_i32(oi);
+
+    if (memop & MO_SIGN) {
+        tcg_gen_ext_i32(ret, ret, memop);
+    }
+}
+
+void tcg_gen_atomic_xchg_i32(TCGv_i32 ret, TCGv_ptr env, TCGv addr,
+                             TCGv_i32 val, TCGArg idx, TCGMemOp memop)
+{
+    do_atomic_op_i32(ret, env, addr, val, idx, memop, table_xchg);
+}
+
+void tcg_gen_atomic_fetch_add_i32(TCGv_i32 ret, TCGv_ptr env, TCGv addr,
+                                  TCGv_i32 val, TCGArg idx, TCGMemOp memop)
+{
+    do_atomic_op_i32(ret, env, addr, val, idx, memop, table_fetch_add);
+}
+
+/* The 64-bit operations use the 32-bit helpers for the smaller sizes.
+   Hosts without 64-bit atomics get a plain load and store for MO_64,
+   which is only atomic with respect to a single vCPU.  */
+
+void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv_ptr env, TCGv addr,
+                                TCGv_i64 cmpv, TCGv_i64 newv,
+                                TCGArg idx, TCGMemOp memop)
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if ((memop & MO_SIZE) == MO_64) {
+#ifdef CONFIG_ATOMIC64
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, idx));
+        gen_helper_atomic_cmpxchgq(retv, env, addr, cmpv, newv, oi);
+        tcg_temp_free_i32(oi);
+#else
+        TCGv_i64 t1 = tcg_temp_new_i64();
+        TCGv_i64 t2 = tcg_temp_new_i64();
+
+        tcg_gen_qemu_ld_i64(t1, addr, idx, memop);
+        tcg_gen_movcond_i64(TCG_COND_EQ, t2, t1, cmpv, newv, t1);
+        tcg_gen_qemu_st_i64(t2, addr, idx, memop);
+        tcg_gen_mov_i64(retv, t1);
+        tcg_temp_free_i64(t1);
+        tcg_temp_free_i64(t2);
+#endif
+    } else {
+        TCGv_i32 c32 = tcg_temp_new_i32();
+        TCGv_i32 n32 = tcg_temp_new_i32();
+        TCGv_i32 r32 = tcg_temp_new_i32();
+
+        tcg_gen_extrl_i64_i32(c32, cmpv);
+        tcg_gen_extrl_i64_i32(n32, newv);
+        tcg_gen_atomic_cmpxchg_i32(r32, env, addr, c32, n32,
+                                   idx, memop & ~MO_SIGN);
+        tcg_temp_free_i32(c32);
+        tcg_temp_free_i32(n32);
+
+        tcg_gen_extu_i32_i64(retv, r32);
+        tcg_temp_free_i32(r32);
+
+        if (memop & MO_SIGN) {
+            tcg_gen_ext_i64(retv, retv, memop);
+        }
+    }
+}
+
+static void do_atomic_op_i64(TCGv_i64 ret, TCGv_ptr env, TCGv addr,
+                             TCGv_i64 val, TCGArg idx, TCGMemOp memop,
+                             gen_atomic_op_i32 const table[],
+                             void (*gen64)(TCGv_i64, TCGv_ptr, TCGv,
+                                           TCGv_i64, TCGv_i32),
+                             void (*gen_op)(TCGv_i64, TCGv_i64, TCGv_i64))
+{
+    memop = tcg_canonicalize_memop(memop, 1, 0);
+
+    if ((memop & MO_SIZE) == MO_64) {
+#ifdef CONFIG_ATOMIC64
+        TCGv_i32 oi = tcg_const_i32(make_memop_idx(memop, idx));
+        gen64(ret, env, addr, val, oi);
+        tcg_temp_free_i32(oi);
+#else
+        TCGv_i64 t1 = tcg_temp_new_i64();
+        TCGv_i64 t2 = tcg_temp_new_i64();
+
+        tcg_gen_qemu_ld_i64(t1, addr, idx, memop);
+        gen_op(t2, t1, val);
+        tcg_gen_qemu_st_i64(t2, addr, idx, memop);
+        tcg_gen_mov_i64(ret, t1);
+        tcg_temp_free_i64(t1);
+        tcg_temp_free_i64(t2);
+#endif
+    } else {
+        TCGv_i32 v32 = tcg_temp_new_i32();
+        TCGv_i32 r32 = tcg_temp_new_i32();
+
+        tcg_gen_extrl_i64_i32(v32, val);
+        do_atomic_op_i32(r32, env, addr, v32, idx, memop & ~MO_SIGN, table);
+        tcg_temp_free_i32(v32);
+
+        tcg_gen_extu_i32_i64(ret, r32);
+        tcg_temp_free_i32(r32);
+
+        if (memop & MO_SIGN) {
+            tcg_gen_ext_i64(ret, ret, memop);
+        }
+    }
+}
+
+#ifdef CONFIG_ATOMIC64
+#define GEN_ATOMIC_HELPER64(NAME)  gen_helper_atomic_##NAME##q
+#else
+#define GEN_ATOMIC_HELPER64(NAME)  NULL
+#endif
+
+static void gen_xchg_op_i64(TCGv_i64 ret, TCGv_i64 old, TCGv_i64 val)
+{
+    tcg_gen_mov_i64(ret, val);
+}
+
+void tcg_gen_atomic_xchg_i64(TCGv_i64 ret, TCGv_ptr env, TCGv addr,
+                             TCGv_i64 val, TCGArg idx, TCGMemOp memop)
+{
+    do_atomic_op_i64(ret, env, addr, val, idx, memop, table_xchg,
+                     GEN_ATOMIC_HELPER64(xchg), gen_xchg_op_i64);
+}
+
+void tcg_gen_atomic_fetch_add_i64(TCGv_i64 ret, TCGv_ptr env, TCGv addr,
+                                  TCGv_i64 val, TCGArg idx, TCGMemOp memop)
+{
+    do_atomic_op_i64(ret, env, addr, val, idx, memop, table_fetch_add,
+                     GEN_ATOMIC_HELPER64(fetch_add), tcg_gen_add_i64);
+}
+
+#undef GEN_ATOMIC_HELPER64
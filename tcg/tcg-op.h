@@ -755,6 +755,61 @@ static inline void tcg_gen_exit_tb(uintptr_t val)
 
 void tcg_gen_goto_tb(unsigned idx);
 
+/**
+ * tcg_gen_lookup_and_goto_ptr() - look up the next TB and jump to it
+ * @env: the CPU env pointer
+ *
+ * End the TB with an indirect jump to the translated code for the
+ * current CPU state, as looked up in the per-vCPU jump cache and TB
+ * hash table.  Use this instead of tcg_gen_exit_tb(0) when the guest
+ * PC has been set dynamically (e.g. an indirect branch or return) and
+ * no other CPU state that requires a trip to the main loop (interrupt
+ * masking, exception state) has been changed.  If no TB is found, or
+ * the backend does not support goto_ptr, this returns to the main loop
+ * just like exit_tb(0).
+ */
+void tcg_gen_lookup_and_goto_ptr(TCGv_ptr env);
+
+/* Host vector operations.  These may only be used when
+   tcg_can_emit_vec_op() has returned true for the opcode, type and
+   element size; see tcg-op-gvec.h for expanders that fall back to
+   integer code when that is not the case.  */
+
+/* Replicate the low (8 << vece) bits of C across 64 bits.  */
+static inline uint64_t dup_const(unsigned vece, uint64_t c)
+{
+    switch (vece) {
+    case MO_8:
+        return 0x0101010101010101ull * (uint8_t)c;
+    case MO_16:
+        return 0x0001000100010001ull * (uint16_t)c;
+    case MO_32:
+        return 0x0000000100000001ull * (uint32_t)c;
+    default:
+        return c;
+    }
+}
+
+void tcg_gen_mov_vec(TCGv_vec, TCGv_vec);
+void tcg_gen_ld_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset);
+void tcg_gen_st_vec(TCGv_vec r, TCGv_ptr base, tcg_target_long offset);
+void tcg_gen_dup_i64_vec(unsigned vece, TCGv_vec, TCGv_i64);
+void tcg_gen_dupi_vec(unsigned vece, TCGv_vec, uint64_t);
+
+void tcg_gen_add_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_sub_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_and_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_or_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_xor_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+void tcg_gen_andc_vec(unsigned vece, TCGv_vec r, TCGv_vec a, TCGv_vec b);
+
+void tcg_gen_shli_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i);
+void tcg_gen_shri_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i);
+void tcg_gen_sari_vec(unsigned vece, TCGv_vec r, TCGv_vec a, int64_t i);
+
+void tcg_gen_cmp_vec(TCGCond cond, unsigned vece, TCGv_vec r,
+                     TCGv_vec a, TCGv_vec b);
+
 #if TARGET_LONG_BITS == 32
 #define tcg_temp_new() tcg_temp_new_i32()
 #define tcg_global_reg_new tcg_global_reg_new_i32
@@ -784,6 +839,26 @@ void tcg_gen_qemu_st_i32(TCGv_i32, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_ld_i64(TCGv_i64, TCGv, TCGArg, TCGMemOp);
 void tcg_gen_qemu_st_i64(TCGv_i64, TCGv, TCGArg, TCGMemOp);
 
+/* Atomic read-modify-write operations on guest memory.  Each returns the
+   value that was in memory before the operation, extended according to
+   MEMOP.  ENV is the CPU env pointer, which the out-of-line helpers
+   need for the TLB lookup.  cmpxchg stores NEWV only if the old value
+   equals CMPV.  */
+void tcg_gen_atomic_cmpxchg_i32(TCGv_i32 retv, TCGv_ptr env, TCGv addr,
+                                TCGv_i32 cmpv, TCGv_i32 newv,
+                                TCGArg idx, TCGMemOp memop);
+void tcg_gen_atomic_cmpxchg_i64(TCGv_i64 retv, TCGv_ptr env, TCGv addr,
+                                TCGv_i64 cmpv, TCGv_i64 newv,
+                                TCGArg idx, TCGMemOp memop);
+void tcg_gen_atomic_xchg_i32(TCGv_i32 ret, TCGv_ptr env, TCGv addr,
+                             TCGv_i32 val, TCGArg idx, TCGMemOp memop);
+void tcg_gen_atomic_xchg_i64(TCGv_i64 ret, TCGv_ptr env, TCGv addr,
+                             TCGv_i64 val, TCGArg idx, TCGMemOp memop);
+void tcg_gen_atomic_fetch_add_i32(TCGv_i32 ret, TCGv_ptr env, TCGv addr,
+                                  TCGv_i32 val, TCGArg idx, TCGMemOp memop);
+void tcg_gen_atomic_fetch_add_i64(TCGv_i64 ret, TCGv_ptr env, TCGv addr,
+                                  TCGv_i64 val, TCGArg idx, TCGMemOp memop);
+
 static inline void tcg_gen_qemu_ld8u(TCGv ret, TCGv addr, int mem_index)
 {
     tcg_gen_qemu_ld_tl(ret, addr, mem_index, MO_UB);
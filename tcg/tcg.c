@@ -116,7 +116,7 @@ static bool tcg_out_tb_finalize(TCGContext *s);
 
 
 
-static TCGRegSet tcg_target_available_regs[2];
+static TCGRegSet tcg_target_available_regs[TCG_TYPE_COUNT];
 static TCGRegSet tcg_target_call_clobber_regs;
 
 #if TCG_TARGET_INSN_UNIT_SIZE == 1
@@ -407,10 +407,14 @@ void tcg_prologue_init(TCGContext *s)
     /* Compute a high-water mark, at which we voluntarily flush the buffer
        and start over.  The size here is arbitrary, significantly larger
        than we expect the code generation for any one opcode to require.  */
-    s->code_gen_highwater = s->code_gen_buffer + (total_size - 1024);
+    s->code_gen_highwater = s->code_gen_buffer + (total_size - TCG_HIGHWATER);
 
     tcg_register_jit(s->code_gen_buffer, total_size);
 
+    /* Backends that implement goto_ptr must provide an epilogue to
+       return to when the lookup fails.  */
+    tcg_debug_assert(!TCG_TARGET_HAS_goto_ptr || s->code_gen_epilogue);
+
 #ifdef DEBUG_DISAS
     if (qemu_loglevel_mask(CPU_LOG_TB_OUT_ASM)) {
         qemu_log("PROLOGUE: [size=%zu]\n", prologue_size);
@@ -632,6 +636,27 @@ TCGv_i64 tcg_temp_new_internal_i64(int temp_local)
     return MAKE_TCGV_I64(idx);
 }
 
+TCGv_vec tcg_temp_new_vec(TCGType type)
+{
+    int idx;
+
+#ifdef CONFIG_DEBUG_TCG
+    switch (type) {
+    case TCG_TYPE_V64:
+        assert(TCG_TARGET_HAS_v64);
+        break;
+    case TCG_TYPE_V128:
+        assert(TCG_TARGET_HAS_v128);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+#endif
+
+    idx = tcg_temp_new_internal(type, 0);
+    return MAKE_TCGV_VEC(idx);
+}
+
 static void tcg_temp_free_internal(int idx)
 {
     TCGContext *s = &tcg_ctx;
@@ -664,6 +689,11 @@ void tcg_temp_free_i64(TCGv_i64 arg)
     tcg_temp_free_internal(GET_TCGV_I64(arg));
 }
 
+void tcg_temp_free_vec(TCGv_vec arg)
+{
+    tcg_temp_free_internal(GET_TCGV_VEC(arg));
+}
+
 TCGv_i32 tcg_const_i32(int32_t val)
 {
     TCGv_i32 t0;
@@ -1329,6 +1359,25 @@ static inline void tcg_la_bb_end(TCGContext *s, uint8_t *dead_temps,
     }
 }
 
+/* liveness analysis: conditional branch: all temps are dead, globals
+   and local temps should be synced but stay live, as the fall-through
+   path continues to use them. */
+static inline void tcg_la_bb_sync(TCGContext *s, uint8_t *dead_temps,
+                                  uint8_t *mem_temps)
+{
+    int i;
+
+    memset(mem_temps, 1, s->nb_globals);
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        if (s->temps[i].temp_local) {
+            mem_temps[i] = 1;
+        } else {
+            dead_temps[i] = 1;
+            mem_temps[i] = 0;
+        }
+    }
+}
+
 /* Liveness analysis : update the opc_dead_args array to tell if a
    given input arguments is dead. Instructions updating dead
    temporaries are removed. */
@@ -1547,7 +1596,9 @@ static void tcg_liveness_analysis(TCGContext *s)
                 }
 
                 /* if end of basic block, update */
-                if (def->flags & TCG_OPF_BB_END) {
+                if (def->flags & TCG_OPF_COND_BRANCH) {
+                    tcg_la_bb_sync(s, dead_temps, mem_temps);
+                } else if (def->flags & TCG_OPF_BB_END) {
                     tcg_la_bb_end(s, dead_temps, mem_temps);
                 } else if (def->flags & TCG_OPF_SIDE_EFFECTS) {
                     /* globals should be synced to memory */
@@ -1661,21 +1712,24 @@ static void check_regs(TCGContext *s)
 static void temp_allocate_frame(TCGContext *s, int temp)
 {
     TCGTemp *ts;
+    tcg_target_long size;
+
     ts = &s->temps[temp];
+    /* Vector temps need a slot of their own size; everything else fits
+       in a host register sized slot.  */
+    size = (ts->type == TCG_TYPE_V128 ? 16 : sizeof(tcg_target_long));
 #if !(defined(__sparc__) && TCG_TARGET_REG_BITS == 64)
     /* Sparc64 stack is accessed with offset of 2047 */
-    s->current_frame_offset = (s->current_frame_offset +
-                               (tcg_target_long)sizeof(tcg_target_long) - 1) &
-        ~(sizeof(tcg_target_long) - 1);
+    s->current_frame_offset = (s->current_frame_offset + size - 1) &
+        ~(size - 1);
 #endif
-    if (s->current_frame_offset + (tcg_target_long)sizeof(tcg_target_long) >
-        s->frame_end) {
+    if (s->current_frame_offset + size > s->frame_end) {
         tcg_abort();
     }
     ts->mem_offset = s->current_frame_offset;
     ts->mem_base = s->frame_temp;
     ts->mem_allocated = 1;
-    s->current_frame_offset += sizeof(tcg_target_long);
+    s->current_frame_offset += size;
 }
 
 static void temp_load(TCGContext *, TCGTemp *, TCGRegSet, TCGRegSet);
@@ -1892,6 +1946,38 @@ static void tcg_reg_alloc_bb_end(TCGContext *s, TCGRegSet allocated_regs)
     save_globals(s, allocated_regs);
 }
 
+/* at a conditional branch, we assume all temporaries are dead and all
+   globals and local temps are synced to their location, but keep them
+   in their registers for the fall-through path.  The branch target is
+   a label, at which tcg_reg_alloc_bb_end() forgets the register state. */
+static void tcg_reg_alloc_cbranch(TCGContext *s, TCGRegSet allocated_regs)
+{
+    int i;
+
+    sync_globals(s, allocated_regs);
+
+    for (i = s->nb_globals; i < s->nb_temps; i++) {
+        TCGTemp *ts = &s->temps[i];
+#ifdef USE_LIVENESS_ANALYSIS
+        /* ??? Liveness does not yet incorporate indirect bases.  */
+        if (!ts->indirect_base) {
+            /* The liveness analysis already ensures that temps are dead
+               and local temps are synced.  Keep an assert for safety. */
+            tcg_debug_assert(ts->temp_local
+                             ? ts->val_type != TEMP_VAL_REG
+                               || ts->mem_coherent
+                             : ts->val_type == TEMP_VAL_DEAD);
+            continue;
+        }
+#endif
+        if (ts->temp_local) {
+            temp_sync(s, ts, allocated_regs);
+        } else {
+            temp_dead(s, ts);
+        }
+    }
+}
+
 #define IS_DEAD_ARG(n) ((dead_args >> (n)) & 1)
 #define NEED_SYNC_ARG(n) ((sync_args >> (n)) & 1)
 
@@ -2098,7 +2184,9 @@ static void tcg_reg_alloc_op(TCGContext *s,
         }
     }
 
-    if (def->flags & TCG_OPF_BB_END) {
+    if (def->flags & TCG_OPF_COND_BRANCH) {
+        tcg_reg_alloc_cbranch(s, allocated_regs);
+    } else if (def->flags & TCG_OPF_BB_END) {
         tcg_reg_alloc_bb_end(s, allocated_regs);
     } else {
         if (def->flags & TCG_OPF_CALL_CLOBBER) {
@@ -2331,6 +2419,9 @@ void tcg_dump_op_count(FILE *f, fprintf_function cpu_fprintf)
 int tcg_gen_code(TCGContext *s, tcg_insn_unit *gen_code_buf)
 {
     int i, oi, oi_next, num_insns;
+#ifdef CONFIG_PROFILER
+    int64_t del_op_count;
+#endif
 
 #ifdef CONFIG_PROFILER
     {
@@ -2360,6 +2451,7 @@ int tcg_gen_code(TCGContext *s, tcg_insn_unit *gen_code_buf)
 
 #ifdef CONFIG_PROFILER
     s->opt_time -= profile_getclock();
+    del_op_count = s->del_op_count;
 #endif
 
 #ifdef USE_TCG_OPTIMIZATIONS
@@ -2368,13 +2460,34 @@ int tcg_gen_code(TCGContext *s, tcg_insn_unit *gen_code_buf)
 
 #ifdef CONFIG_PROFILER
     s->opt_time += profile_getclock();
+    s->opt_del_op_count += s->del_op_count - del_op_count;
+    s->rle_time -= profile_getclock();
+#endif
+
+#ifdef USE_TCG_OPTIMIZATIONS
+    tcg_optimize_env_loads(s);
+#endif
+
+#ifdef CONFIG_PROFILER
+    s->rle_time += profile_getclock();
+    s->dse_time -= profile_getclock();
+#endif
+
+#ifdef USE_TCG_OPTIMIZATIONS
+    tcg_optimize_env_stores(s);
+#endif
+
+#ifdef CONFIG_PROFILER
+    s->dse_time += profile_getclock();
     s->la_time -= profile_getclock();
+    del_op_count = s->del_op_count;
 #endif
 
     tcg_liveness_analysis(s);
 
 #ifdef CONFIG_PROFILER
     s->la_time += profile_getclock();
+    s->la_del_op_count += s->del_op_count - del_op_count;
 #endif
 
 #ifdef DEBUG_DISAS
@@ -2409,6 +2522,7 @@ int tcg_gen_code(TCGContext *s, tcg_insn_unit *gen_code_buf)
         switch (opc) {
         case INDEX_op_mov_i32:
         case INDEX_op_mov_i64:
+        case INDEX_op_mov_vec:
             tcg_reg_alloc_mov(s, def, args, dead_args, sync_args);
             break;
         case INDEX_op_movi_i32:
@@ -2522,6 +2636,18 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
                 * 100.0);
     cpu_fprintf(f, "liveness/code time  %0.1f%%\n", 
                 (double)s->la_time / (s->code_time ? s->code_time : 1) * 100.0);
+    cpu_fprintf(f, "  const/copy prop   %0.1f%% (%0.2f deleted ops/TB)\n",
+                (double)s->opt_time / (s->code_time ? s->code_time : 1)
+                * 100.0, (double)s->opt_del_op_count / tb_div_count);
+    cpu_fprintf(f, "  env load elim.    %0.1f%% (%0.2f loads/TB)\n",
+                (double)s->rle_time / (s->code_time ? s->code_time : 1)
+                * 100.0, (double)s->rle_op_count / tb_div_count);
+    cpu_fprintf(f, "  env store elim.   %0.1f%% (%0.2f stores/TB)\n",
+                (double)s->dse_time / (s->code_time ? s->code_time : 1)
+                * 100.0, (double)s->dse_op_count / tb_div_count);
+    cpu_fprintf(f, "  liveness          %0.1f%% (%0.2f dead ops/TB)\n",
+                (double)s->la_time / (s->code_time ? s->code_time : 1)
+                * 100.0, (double)s->la_del_op_count / tb_div_count);
     cpu_fprintf(f, "cpu_restore count   %" PRId64 "\n",
                 s->restore_count);
     cpu_fprintf(f, "  avg cycles        %0.1f\n",
@@ -2534,6 +2660,57 @@ void tcg_dump_info(FILE *f, fprintf_function cpu_fprintf)
 }
 #endif
 
+static FILE *tcg_perf_map;
+
+/* Start writing a map of the generated code in the format that perf(1)
+   reads for JITs, beginning with the prologue.  TBs are added by
+   tcg_perf_map_add as they are translated; the entries of evicted TBs
+   are not removed, so a later TB at the same address supersedes them.  */
+static void tcg_perf_map_close(void)
+{
+    /* vCPU threads may still be translating while QEMU exits */
+    FILE *f = atomic_xchg(&tcg_perf_map, NULL);
+
+    if (f) {
+        fclose(f);
+    }
+}
+
+bool tcg_perf_map_open(TCGContext *s)
+{
+    char name[64];
+
+    snprintf(name, sizeof(name), "/tmp/perf-%d.map", getpid());
+    tcg_perf_map = fopen(name, "w");
+    if (tcg_perf_map == NULL) {
+        return false;
+    }
+    /* perf may read the map while QEMU runs or after it was killed, so
+       write out every entry as soon as it is added */
+    setvbuf(tcg_perf_map, NULL, _IOLBF, 0);
+    atexit(tcg_perf_map_close);
+    tcg_perf_map_add(s->code_gen_prologue,
+                     (uint8_t *)s->code_gen_buffer -
+                     (uint8_t *)s->code_gen_prologue,
+                     "qemu-tcg-prologue");
+    return true;
+}
+
+void tcg_perf_map_add(const void *start, size_t size, const char *name)
+{
+    FILE *f = atomic_read(&tcg_perf_map);
+
+    if (f) {
+        fprintf(f, "%" PRIxPTR " %zx %s\n",
+                (uintptr_t)start, size, name);
+    }
+}
+
+bool tcg_perf_map_enabled(void)
+{
+    return tcg_perf_map != NULL;
+}
+
 #ifdef ELF_HOST_MACHINE
 /* In order to use this feature, the backend needs to do three things:
 
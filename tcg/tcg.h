@@ -42,6 +42,15 @@
 # endif
 #endif
 
+/* Oversized TCG guests make things like MTTCG hard
+ * as we can't use atomics for cputlb updates.
+ */
+#if TARGET_LONG_BITS > TCG_TARGET_REG_BITS
+#define TCG_OVERSIZED_GUEST 1
+#else
+#define TCG_OVERSIZED_GUEST 0
+#endif
+
 #if TCG_TARGET_REG_BITS == 32
 typedef int32_t tcg_target_long;
 typedef uint32_t tcg_target_ulong;
@@ -101,6 +110,9 @@ typedef uint64_t TCGRegSet;
 #define TCG_TARGET_HAS_sub2_i32         1
 #endif
 
+/* True if the backend implements any of the host vector types.  */
+#define TCG_TARGET_MAYBE_vec  (TCG_TARGET_HAS_v64 | TCG_TARGET_HAS_v128)
+
 #ifndef TCG_TARGET_deposit_i32_valid
 #define TCG_TARGET_deposit_i32_valid(ofs, len) 1
 #endif
@@ -203,6 +215,8 @@ typedef struct TCGPool {
 typedef enum TCGType {
     TCG_TYPE_I32,
     TCG_TYPE_I64,
+    TCG_TYPE_V64,   /* host vector registers, see TCG_TARGET_HAS_v* */
+    TCG_TYPE_V128,
     TCG_TYPE_COUNT, /* number of different types */
 
     /* An alias for the size of the host register.  */
@@ -303,11 +317,13 @@ typedef tcg_target_ulong TCGArg;
    need to know about any of this, and should treat TCGv as an opaque type.
    In addition we do typechecking for different types of variables.  TCGv_i32
    and TCGv_i64 are 32/64-bit variables respectively.  TCGv and TCGv_ptr
-   are aliases for target_ulong and host pointer sized values respectively.  */
+   are aliases for target_ulong and host pointer sized values respectively.
+   TCGv_vec is a host vector of one of the TCG_TYPE_V* types.  */
 
 typedef struct TCGv_i32_d *TCGv_i32;
 typedef struct TCGv_i64_d *TCGv_i64;
 typedef struct TCGv_ptr_d *TCGv_ptr;
+typedef struct TCGv_vec_d *TCGv_vec;
 typedef TCGv_ptr TCGv_env;
 #if TARGET_LONG_BITS == 32
 #define TCGv TCGv_i32
@@ -332,6 +348,11 @@ static inline TCGv_ptr QEMU_ARTIFICIAL MAKE_TCGV_PTR(intptr_t i)
     return (TCGv_ptr)i;
 }
 
+static inline TCGv_vec QEMU_ARTIFICIAL MAKE_TCGV_VEC(intptr_t i)
+{
+    return (TCGv_vec)i;
+}
+
 static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_I32(TCGv_i32 t)
 {
     return (intptr_t)t;
@@ -347,6 +368,11 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
     return (intptr_t)t;
 }
 
+static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_VEC(TCGv_vec t)
+{
+    return (intptr_t)t;
+}
+
 #if TCG_TARGET_REG_BITS == 32
 #define TCGV_LOW(t) MAKE_TCGV_I32(GET_TCGV_I64(t))
 #define TCGV_HIGH(t) MAKE_TCGV_I32(GET_TCGV_I64(t) + 1)
@@ -355,6 +381,7 @@ static inline intptr_t QEMU_ARTIFICIAL GET_TCGV_PTR(TCGv_ptr t)
 #define TCGV_EQUAL_I32(a, b) (GET_TCGV_I32(a) == GET_TCGV_I32(b))
 #define TCGV_EQUAL_I64(a, b) (GET_TCGV_I64(a) == GET_TCGV_I64(b))
 #define TCGV_EQUAL_PTR(a, b) (GET_TCGV_PTR(a) == GET_TCGV_PTR(b))
+#define TCGV_EQUAL_VEC(a, b) (GET_TCGV_VEC(a) == GET_TCGV_VEC(b))
 
 /* Dummy definition to avoid compiler warnings.  */
 #define TCGV_UNUSED_I32(x) x = MAKE_TCGV_I32(-1)
@@ -501,6 +528,10 @@ QEMU_BUILD_BUG_ON(NB_OPS > 0xff);
 QEMU_BUILD_BUG_ON(OPC_BUF_SIZE >= 0x7fff);
 QEMU_BUILD_BUG_ON(OPPARAM_BUF_SIZE >= 0x7fff);
 
+/* Margin kept below the end of the code buffer; the code generated for
+   any one opcode is expected to fit in it.  */
+#define TCG_HIGHWATER 1024
+
 struct TCGContext {
     uint8_t *pool_cur, *pool_end;
     TCGPool *pool_first, *pool_current, *pool_first_large;
@@ -547,6 +578,13 @@ struct TCGContext {
     int64_t code_time;
     int64_t la_time;
     int64_t opt_time;
+    /* per-pass breakdown of the optimizer */
+    int64_t opt_del_op_count;
+    int64_t rle_time;
+    int64_t rle_op_count;
+    int64_t dse_time;
+    int64_t dse_op_count;
+    int64_t la_del_op_count;
     int64_t restore_count;
     int64_t restore_time;
 #endif
@@ -567,6 +605,7 @@ struct TCGContext {
        extension that allows arithmetic on void*.  */
     int code_gen_max_blocks;
     void *code_gen_prologue;
+    void *code_gen_epilogue;
     void *code_gen_buffer;
     size_t code_gen_buffer_size;
     void *code_gen_ptr;
@@ -647,9 +686,22 @@ TCGv_i64 tcg_global_reg_new_i64(TCGReg reg, const char *name);
 
 TCGv_i32 tcg_temp_new_internal_i32(int temp_local);
 TCGv_i64 tcg_temp_new_internal_i64(int temp_local);
+TCGv_vec tcg_temp_new_vec(TCGType type);
 
 void tcg_temp_free_i32(TCGv_i32 arg);
 void tcg_temp_free_i64(TCGv_i64 arg);
+void tcg_temp_free_vec(TCGv_vec arg);
+
+#if TCG_TARGET_MAYBE_vec
+/* Return true if the backend can emit vector opcode OPC for a vector of
+   TYPE with elements of size 8 << VECE bits.  */
+int tcg_can_emit_vec_op(TCGOpcode opc, TCGType type, unsigned vece);
+#else
+static inline int tcg_can_emit_vec_op(TCGOpcode o, TCGType t, unsigned ve)
+{
+    return 0;
+}
+#endif
 
 static inline TCGv_i32 tcg_global_mem_new_i32(TCGv_ptr reg, intptr_t offset,
                                               const char *name)
@@ -730,6 +782,9 @@ enum {
     /* Instruction is optional and not implemented by the host, or insn
        is generic and should not be implemened by the host.  */
     TCG_OPF_NOT_PRESENT  = 0x10,
+    /* Instruction is a conditional branch: globals need only be synced,
+       not discarded, since the fall-through path continues the block.  */
+    TCG_OPF_COND_BRANCH  = 0x20,
 };
 
 typedef struct TCGOpDef {
@@ -797,6 +852,8 @@ void tcg_gen_callN(TCGContext *s, void *func,
 
 void tcg_op_remove(TCGContext *s, TCGOp *op);
 void tcg_optimize(TCGContext *s);
+void tcg_optimize_env_loads(TCGContext *s);
+void tcg_optimize_env_stores(TCGContext *s);
 
 /* only used for debugging purposes */
 void tcg_dump_ops(TCGContext *s);
@@ -976,6 +1033,10 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr);
 
 void tcg_register_jit(void *buf, size_t buf_size);
 
+bool tcg_perf_map_open(TCGContext *s);
+bool tcg_perf_map_enabled(void);
+void tcg_perf_map_add(const void *start, size_t size, const char *name);
+
 /*
  * Memory helpers that will be used by TCG generated code.
  */
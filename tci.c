@@ -459,12 +459,207 @@ static bool tci_compare64(uint64_t u0, uint64_t u1, TCGCond condition)
 # define qemu_st_beq(X)  stq_be_p(g2h(taddr), X)
 #endif
 
+#if defined(GETPC)
+# define TCI_SET_TB_PTR()  (tci_tb_ptr = (uintptr_t)tb_ptr)
+#else
+# define TCI_SET_TB_PTR()  ((void)0)
+#endif
+
+/* With GCC, dispatch through a table of label addresses (threaded code):
+ * each operation ends with its own indirect jump to the next one instead
+ * of returning to a single switch, which gives the host branch predictor
+ * one history per operation.  Debug builds keep the plain switch, so that
+ * the size of every operation is still checked after it has run.
+ *
+ * Operations end with TCI_NEXT() when they fall through to the next
+ * operation, and with TCI_NEXT_JUMP() after they have moved tb_ptr.
+ */
+#if defined(__GNUC__) && defined(NDEBUG)
+# define TCI_THREADED
+# define TCI_CASE(op)      case INDEX_op_##op: tci_op_##op
+# define TCI_DEFAULT       default: tci_op_default
+# define TCI_NEXT() \
+    do { \
+        void *next_op = tci_dispatch[tb_ptr[0]]; \
+        TCI_SET_TB_PTR(); \
+        tb_ptr += 2; \
+        goto *next_op; \
+    } while (0)
+# define TCI_NEXT_JUMP()   TCI_NEXT()
+#else
+# define TCI_CASE(op)      case INDEX_op_##op
+# define TCI_DEFAULT       default
+# define TCI_NEXT()        break
+# define TCI_NEXT_JUMP()   continue
+#endif
+
 /* Interpret pseudo code in tb. */
 uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
 {
     long tcg_temps[CPU_TEMP_BUF_NLONGS];
     uintptr_t sp_value = (uintptr_t)(tcg_temps + CPU_TEMP_BUF_NLONGS);
     uintptr_t next_tb = 0;
+#ifdef TCI_THREADED
+    static void *const tci_dispatch[NB_OPS] = {
+        [0 ... NB_OPS - 1] = &&tci_op_default,
+        [INDEX_op_call] = &&tci_op_call,
+        [INDEX_op_br] = &&tci_op_br,
+        [INDEX_op_setcond_i32] = &&tci_op_setcond_i32,
+#if TCG_TARGET_REG_BITS == 32
+        [INDEX_op_setcond2_i32] = &&tci_op_setcond2_i32,
+#elif TCG_TARGET_REG_BITS == 64
+        [INDEX_op_setcond_i64] = &&tci_op_setcond_i64,
+#endif
+        [INDEX_op_mov_i32] = &&tci_op_mov_i32,
+        [INDEX_op_movi_i32] = &&tci_op_movi_i32,
+        [INDEX_op_ld8u_i32] = &&tci_op_ld8u_i32,
+        [INDEX_op_ld8s_i32] = &&tci_op_ld8s_i32,
+        [INDEX_op_ld16u_i32] = &&tci_op_ld16u_i32,
+        [INDEX_op_ld16s_i32] = &&tci_op_ld16s_i32,
+        [INDEX_op_ld_i32] = &&tci_op_ld_i32,
+        [INDEX_op_st8_i32] = &&tci_op_st8_i32,
+        [INDEX_op_st16_i32] = &&tci_op_st16_i32,
+        [INDEX_op_st_i32] = &&tci_op_st_i32,
+        [INDEX_op_add_i32] = &&tci_op_add_i32,
+        [INDEX_op_sub_i32] = &&tci_op_sub_i32,
+        [INDEX_op_mul_i32] = &&tci_op_mul_i32,
+#if TCG_TARGET_HAS_div_i32
+        [INDEX_op_div_i32] = &&tci_op_div_i32,
+        [INDEX_op_divu_i32] = &&tci_op_divu_i32,
+        [INDEX_op_rem_i32] = &&tci_op_rem_i32,
+        [INDEX_op_remu_i32] = &&tci_op_remu_i32,
+#elif TCG_TARGET_HAS_div2_i32
+        [INDEX_op_div2_i32] = &&tci_op_div2_i32,
+        [INDEX_op_divu2_i32] = &&tci_op_divu2_i32,
+#endif
+        [INDEX_op_and_i32] = &&tci_op_and_i32,
+        [INDEX_op_or_i32] = &&tci_op_or_i32,
+        [INDEX_op_xor_i32] = &&tci_op_xor_i32,
+        [INDEX_op_shl_i32] = &&tci_op_shl_i32,
+        [INDEX_op_shr_i32] = &&tci_op_shr_i32,
+        [INDEX_op_sar_i32] = &&tci_op_sar_i32,
+#if TCG_TARGET_HAS_rot_i32
+        [INDEX_op_rotl_i32] = &&tci_op_rotl_i32,
+        [INDEX_op_rotr_i32] = &&tci_op_rotr_i32,
+#endif
+#if TCG_TARGET_HAS_deposit_i32
+        [INDEX_op_deposit_i32] = &&tci_op_deposit_i32,
+#endif
+        [INDEX_op_brcond_i32] = &&tci_op_brcond_i32,
+#if TCG_TARGET_REG_BITS == 32
+        [INDEX_op_add2_i32] = &&tci_op_add2_i32,
+        [INDEX_op_sub2_i32] = &&tci_op_sub2_i32,
+        [INDEX_op_brcond2_i32] = &&tci_op_brcond2_i32,
+        [INDEX_op_mulu2_i32] = &&tci_op_mulu2_i32,
+#endif /* TCG_TARGET_REG_BITS == 32 */
+#if TCG_TARGET_HAS_ext8s_i32
+        [INDEX_op_ext8s_i32] = &&tci_op_ext8s_i32,
+#endif
+#if TCG_TARGET_HAS_ext16s_i32
+        [INDEX_op_ext16s_i32] = &&tci_op_ext16s_i32,
+#endif
+#if TCG_TARGET_HAS_ext8u_i32
+        [INDEX_op_ext8u_i32] = &&tci_op_ext8u_i32,
+#endif
+#if TCG_TARGET_HAS_ext16u_i32
+        [INDEX_op_ext16u_i32] = &&tci_op_ext16u_i32,
+#endif
+#if TCG_TARGET_HAS_bswap16_i32
+        [INDEX_op_bswap16_i32] = &&tci_op_bswap16_i32,
+#endif
+#if TCG_TARGET_HAS_bswap32_i32
+        [INDEX_op_bswap32_i32] = &&tci_op_bswap32_i32,
+#endif
+#if TCG_TARGET_HAS_not_i32
+        [INDEX_op_not_i32] = &&tci_op_not_i32,
+#endif
+#if TCG_TARGET_HAS_neg_i32
+        [INDEX_op_neg_i32] = &&tci_op_neg_i32,
+#endif
+#if TCG_TARGET_REG_BITS == 64
+        [INDEX_op_mov_i64] = &&tci_op_mov_i64,
+        [INDEX_op_movi_i64] = &&tci_op_movi_i64,
+        [INDEX_op_ld8u_i64] = &&tci_op_ld8u_i64,
+        [INDEX_op_ld8s_i64] = &&tci_op_ld8s_i64,
+        [INDEX_op_ld16u_i64] = &&tci_op_ld16u_i64,
+        [INDEX_op_ld16s_i64] = &&tci_op_ld16s_i64,
+        [INDEX_op_ld32u_i64] = &&tci_op_ld32u_i64,
+        [INDEX_op_ld32s_i64] = &&tci_op_ld32s_i64,
+        [INDEX_op_ld_i64] = &&tci_op_ld_i64,
+        [INDEX_op_st8_i64] = &&tci_op_st8_i64,
+        [INDEX_op_st16_i64] = &&tci_op_st16_i64,
+        [INDEX_op_st32_i64] = &&tci_op_st32_i64,
+        [INDEX_op_st_i64] = &&tci_op_st_i64,
+        [INDEX_op_add_i64] = &&tci_op_add_i64,
+        [INDEX_op_sub_i64] = &&tci_op_sub_i64,
+        [INDEX_op_mul_i64] = &&tci_op_mul_i64,
+#if TCG_TARGET_HAS_div_i64
+        [INDEX_op_div_i64] = &&tci_op_div_i64,
+        [INDEX_op_divu_i64] = &&tci_op_divu_i64,
+        [INDEX_op_rem_i64] = &&tci_op_rem_i64,
+        [INDEX_op_remu_i64] = &&tci_op_remu_i64,
+#elif TCG_TARGET_HAS_div2_i64
+        [INDEX_op_div2_i64] = &&tci_op_div2_i64,
+        [INDEX_op_divu2_i64] = &&tci_op_divu2_i64,
+#endif
+        [INDEX_op_and_i64] = &&tci_op_and_i64,
+        [INDEX_op_or_i64] = &&tci_op_or_i64,
+        [INDEX_op_xor_i64] = &&tci_op_xor_i64,
+        [INDEX_op_shl_i64] = &&tci_op_shl_i64,
+        [INDEX_op_shr_i64] = &&tci_op_shr_i64,
+        [INDEX_op_sar_i64] = &&tci_op_sar_i64,
+#if TCG_TARGET_HAS_rot_i64
+        [INDEX_op_rotl_i64] = &&tci_op_rotl_i64,
+        [INDEX_op_rotr_i64] = &&tci_op_rotr_i64,
+#endif
+#if TCG_TARGET_HAS_deposit_i64
+        [INDEX_op_deposit_i64] = &&tci_op_deposit_i64,
+#endif
+        [INDEX_op_brcond_i64] = &&tci_op_brcond_i64,
+#if TCG_TARGET_HAS_ext8u_i64
+        [INDEX_op_ext8u_i64] = &&tci_op_ext8u_i64,
+#endif
+#if TCG_TARGET_HAS_ext8s_i64
+        [INDEX_op_ext8s_i64] = &&tci_op_ext8s_i64,
+#endif
+#if TCG_TARGET_HAS_ext16s_i64
+        [INDEX_op_ext16s_i64] = &&tci_op_ext16s_i64,
+#endif
+#if TCG_TARGET_HAS_ext16u_i64
+        [INDEX_op_ext16u_i64] = &&tci_op_ext16u_i64,
+#endif
+#if TCG_TARGET_HAS_ext32s_i64
+        [INDEX_op_ext32s_i64] = &&tci_op_ext32s_i64,
+#endif
+        [INDEX_op_ext_i32_i64] = &&tci_op_ext_i32_i64,
+#if TCG_TARGET_HAS_ext32u_i64
+        [INDEX_op_ext32u_i64] = &&tci_op_ext32u_i64,
+#endif
+        [INDEX_op_extu_i32_i64] = &&tci_op_extu_i32_i64,
+#if TCG_TARGET_HAS_bswap16_i64
+        [INDEX_op_bswap16_i64] = &&tci_op_bswap16_i64,
+#endif
+#if TCG_TARGET_HAS_bswap32_i64
+        [INDEX_op_bswap32_i64] = &&tci_op_bswap32_i64,
+#endif
+#if TCG_TARGET_HAS_bswap64_i64
+        [INDEX_op_bswap64_i64] = &&tci_op_bswap64_i64,
+#endif
+#if TCG_TARGET_HAS_not_i64
+        [INDEX_op_not_i64] = &&tci_op_not_i64,
+#endif
+#if TCG_TARGET_HAS_neg_i64
+        [INDEX_op_neg_i64] = &&tci_op_neg_i64,
+#endif
+#endif /* TCG_TARGET_REG_BITS == 64 */
+        [INDEX_op_exit_tb] = &&tci_op_exit_tb,
+        [INDEX_op_goto_tb] = &&tci_op_goto_tb,
+        [INDEX_op_qemu_ld_i32] = &&tci_op_qemu_ld_i32,
+        [INDEX_op_qemu_ld_i64] = &&tci_op_qemu_ld_i64,
+        [INDEX_op_qemu_st_i32] = &&tci_op_qemu_st_i32,
+        [INDEX_op_qemu_st_i64] = &&tci_op_qemu_st_i64,
+    };
+#endif
 
     tci_reg[TCG_AREG0] = (tcg_target_ulong)env;
     tci_reg[TCG_REG_CALL_STACK] = sp_value;
@@ -491,15 +686,13 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
 #endif
         TCGMemOpIdx oi;
 
-#if defined(GETPC)
-        tci_tb_ptr = (uintptr_t)tb_ptr;
-#endif
+        TCI_SET_TB_PTR();
 
         /* Skip opcode and size entry. */
         tb_ptr += 2;
 
         switch (opc) {
-        case INDEX_op_call:
+        TCI_CASE(call):
             t0 = tci_read_ri(&tb_ptr);
 #if TCG_TARGET_REG_BITS == 32
             tmp64 = ((helper_function)t0)(tci_read_reg(TCG_REG_R0),
@@ -522,194 +715,194 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
                                           tci_read_reg(TCG_REG_R5));
             tci_write_reg(TCG_REG_R0, tmp64);
 #endif
-            break;
-        case INDEX_op_br:
+            TCI_NEXT();
+        TCI_CASE(br):
             label = tci_read_label(&tb_ptr);
             assert(tb_ptr == old_code_ptr + op_size);
             tb_ptr = (uint8_t *)label;
-            continue;
-        case INDEX_op_setcond_i32:
+            TCI_NEXT_JUMP();
+        TCI_CASE(setcond_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg32(t0, tci_compare32(t1, t2, condition));
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_setcond2_i32:
+        TCI_CASE(setcond2_i32):
             t0 = *tb_ptr++;
             tmp64 = tci_read_r64(&tb_ptr);
             v64 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg32(t0, tci_compare64(tmp64, v64, condition));
-            break;
+            TCI_NEXT();
 #elif TCG_TARGET_REG_BITS == 64
-        case INDEX_op_setcond_i64:
+        TCI_CASE(setcond_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
             tci_write_reg64(t0, tci_compare64(t1, t2, condition));
-            break;
+            TCI_NEXT();
 #endif
-        case INDEX_op_mov_i32:
+        TCI_CASE(mov_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
-        case INDEX_op_movi_i32:
+            TCI_NEXT();
+        TCI_CASE(movi_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_i32(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            TCI_NEXT();
 
             /* Load/store operations (32 bit). */
 
-        case INDEX_op_ld8u_i32:
+        TCI_CASE(ld8u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i32:
-        case INDEX_op_ld16u_i32:
+            TCI_NEXT();
+        TCI_CASE(ld8s_i32):
+        TCI_CASE(ld16u_i32):
             TODO();
-            break;
-        case INDEX_op_ld16s_i32:
+            TCI_NEXT();
+        TCI_CASE(ld16s_i32):
             TODO();
-            break;
-        case INDEX_op_ld_i32:
+            TCI_NEXT();
+        TCI_CASE(ld_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i32:
+            TCI_NEXT();
+        TCI_CASE(st8_i32):
             t0 = tci_read_r8(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i32:
+            TCI_NEXT();
+        TCI_CASE(st16_i32):
             t0 = tci_read_r16(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i32:
+            TCI_NEXT();
+        TCI_CASE(st_i32):
             t0 = tci_read_r32(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             assert(t1 != sp_value || (int32_t)t2 < 0);
             *(uint32_t *)(t1 + t2) = t0;
-            break;
+            TCI_NEXT();
 
             /* Arithmetic operations (32 bit). */
 
-        case INDEX_op_add_i32:
+        TCI_CASE(add_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i32:
+            TCI_NEXT();
+        TCI_CASE(sub_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i32:
+            TCI_NEXT();
+        TCI_CASE(mul_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 * t2);
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_div_i32
-        case INDEX_op_div_i32:
+        TCI_CASE(div_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, (int32_t)t1 / (int32_t)t2);
-            break;
-        case INDEX_op_divu_i32:
+            TCI_NEXT();
+        TCI_CASE(divu_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 / t2);
-            break;
-        case INDEX_op_rem_i32:
+            TCI_NEXT();
+        TCI_CASE(rem_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, (int32_t)t1 % (int32_t)t2);
-            break;
-        case INDEX_op_remu_i32:
+            TCI_NEXT();
+        TCI_CASE(remu_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 % t2);
-            break;
+            TCI_NEXT();
 #elif TCG_TARGET_HAS_div2_i32
-        case INDEX_op_div2_i32:
-        case INDEX_op_divu2_i32:
+        TCI_CASE(div2_i32):
+        TCI_CASE(divu2_i32):
             TODO();
-            break;
+            TCI_NEXT();
 #endif
-        case INDEX_op_and_i32:
+        TCI_CASE(and_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i32:
+            TCI_NEXT();
+        TCI_CASE(or_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i32:
+            TCI_NEXT();
+        TCI_CASE(xor_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 ^ t2);
-            break;
+            TCI_NEXT();
 
             /* Shift/rotate operations (32 bit). */
 
-        case INDEX_op_shl_i32:
+        TCI_CASE(shl_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 << (t2 & 31));
-            break;
-        case INDEX_op_shr_i32:
+            TCI_NEXT();
+        TCI_CASE(shr_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, t1 >> (t2 & 31));
-            break;
-        case INDEX_op_sar_i32:
+            TCI_NEXT();
+        TCI_CASE(sar_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, ((int32_t)t1 >> (t2 & 31)));
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_rot_i32
-        case INDEX_op_rotl_i32:
+        TCI_CASE(rotl_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, rol32(t1, t2 & 31));
-            break;
-        case INDEX_op_rotr_i32:
+            TCI_NEXT();
+        TCI_CASE(rotr_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_ri32(&tb_ptr);
             t2 = tci_read_ri32(&tb_ptr);
             tci_write_reg32(t0, ror32(t1, t2 & 31));
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_deposit_i32
-        case INDEX_op_deposit_i32:
+        TCI_CASE(deposit_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             t2 = tci_read_r32(&tb_ptr);
@@ -717,9 +910,9 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             tmp8 = *tb_ptr++;
             tmp32 = (((1 << tmp8) - 1) << tmp16);
             tci_write_reg32(t0, (t1 & ~tmp32) | ((t2 << tmp16) & tmp32));
-            break;
+            TCI_NEXT();
 #endif
-        case INDEX_op_brcond_i32:
+        TCI_CASE(brcond_i32):
             t0 = tci_read_r32(&tb_ptr);
             t1 = tci_read_ri32(&tb_ptr);
             condition = *tb_ptr++;
@@ -727,25 +920,25 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (tci_compare32(t0, t1, condition)) {
                 assert(tb_ptr == old_code_ptr + op_size);
                 tb_ptr = (uint8_t *)label;
-                continue;
+                TCI_NEXT_JUMP();
             }
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_REG_BITS == 32
-        case INDEX_op_add2_i32:
+        TCI_CASE(add2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             tmp64 = tci_read_r64(&tb_ptr);
             tmp64 += tci_read_r64(&tb_ptr);
             tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_sub2_i32:
+            TCI_NEXT();
+        TCI_CASE(sub2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             tmp64 = tci_read_r64(&tb_ptr);
             tmp64 -= tci_read_r64(&tb_ptr);
             tci_write_reg64(t1, t0, tmp64);
-            break;
-        case INDEX_op_brcond2_i32:
+            TCI_NEXT();
+        TCI_CASE(brcond2_i32):
             tmp64 = tci_read_r64(&tb_ptr);
             v64 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
@@ -753,230 +946,230 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (tci_compare64(tmp64, v64, condition)) {
                 assert(tb_ptr == old_code_ptr + op_size);
                 tb_ptr = (uint8_t *)label;
-                continue;
+                TCI_NEXT_JUMP();
             }
-            break;
-        case INDEX_op_mulu2_i32:
+            TCI_NEXT();
+        TCI_CASE(mulu2_i32):
             t0 = *tb_ptr++;
             t1 = *tb_ptr++;
             t2 = tci_read_r32(&tb_ptr);
             tmp64 = tci_read_r32(&tb_ptr);
             tci_write_reg64(t1, t0, t2 * tmp64);
-            break;
+            TCI_NEXT();
 #endif /* TCG_TARGET_REG_BITS == 32 */
 #if TCG_TARGET_HAS_ext8s_i32
-        case INDEX_op_ext8s_i32:
+        TCI_CASE(ext8s_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r8s(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16s_i32
-        case INDEX_op_ext16s_i32:
+        TCI_CASE(ext16s_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16s(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext8u_i32
-        case INDEX_op_ext8u_i32:
+        TCI_CASE(ext8u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r8(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16u_i32
-        case INDEX_op_ext16u_i32:
+        TCI_CASE(ext16u_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg32(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap16_i32
-        case INDEX_op_bswap16_i32:
+        TCI_CASE(bswap16_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg32(t0, bswap16(t1));
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap32_i32
-        case INDEX_op_bswap32_i32:
+        TCI_CASE(bswap32_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, bswap32(t1));
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_not_i32
-        case INDEX_op_not_i32:
+        TCI_CASE(not_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, ~t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_neg_i32
-        case INDEX_op_neg_i32:
+        TCI_CASE(neg_i32):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg32(t0, -t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_REG_BITS == 64
-        case INDEX_op_mov_i64:
+        TCI_CASE(mov_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
-        case INDEX_op_movi_i64:
+            TCI_NEXT();
+        TCI_CASE(movi_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_i64(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            TCI_NEXT();
 
             /* Load/store operations (64 bit). */
 
-        case INDEX_op_ld8u_i64:
+        TCI_CASE(ld8u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg8(t0, *(uint8_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld8s_i64:
-        case INDEX_op_ld16u_i64:
-        case INDEX_op_ld16s_i64:
+            TCI_NEXT();
+        TCI_CASE(ld8s_i64):
+        TCI_CASE(ld16u_i64):
+        TCI_CASE(ld16s_i64):
             TODO();
-            break;
-        case INDEX_op_ld32u_i64:
+            TCI_NEXT();
+        TCI_CASE(ld32u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32(t0, *(uint32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld32s_i64:
+            TCI_NEXT();
+        TCI_CASE(ld32s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg32s(t0, *(int32_t *)(t1 + t2));
-            break;
-        case INDEX_op_ld_i64:
+            TCI_NEXT();
+        TCI_CASE(ld_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             tci_write_reg64(t0, *(uint64_t *)(t1 + t2));
-            break;
-        case INDEX_op_st8_i64:
+            TCI_NEXT();
+        TCI_CASE(st8_i64):
             t0 = tci_read_r8(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint8_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st16_i64:
+            TCI_NEXT();
+        TCI_CASE(st16_i64):
             t0 = tci_read_r16(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint16_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st32_i64:
+            TCI_NEXT();
+        TCI_CASE(st32_i64):
             t0 = tci_read_r32(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             *(uint32_t *)(t1 + t2) = t0;
-            break;
-        case INDEX_op_st_i64:
+            TCI_NEXT();
+        TCI_CASE(st_i64):
             t0 = tci_read_r64(&tb_ptr);
             t1 = tci_read_r(&tb_ptr);
             t2 = tci_read_s32(&tb_ptr);
             assert(t1 != sp_value || (int32_t)t2 < 0);
             *(uint64_t *)(t1 + t2) = t0;
-            break;
+            TCI_NEXT();
 
             /* Arithmetic operations (64 bit). */
 
-        case INDEX_op_add_i64:
+        TCI_CASE(add_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 + t2);
-            break;
-        case INDEX_op_sub_i64:
+            TCI_NEXT();
+        TCI_CASE(sub_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 - t2);
-            break;
-        case INDEX_op_mul_i64:
+            TCI_NEXT();
+        TCI_CASE(mul_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 * t2);
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_div_i64
-        case INDEX_op_div_i64:
-        case INDEX_op_divu_i64:
-        case INDEX_op_rem_i64:
-        case INDEX_op_remu_i64:
+        TCI_CASE(div_i64):
+        TCI_CASE(divu_i64):
+        TCI_CASE(rem_i64):
+        TCI_CASE(remu_i64):
             TODO();
-            break;
+            TCI_NEXT();
 #elif TCG_TARGET_HAS_div2_i64
-        case INDEX_op_div2_i64:
-        case INDEX_op_divu2_i64:
+        TCI_CASE(div2_i64):
+        TCI_CASE(divu2_i64):
             TODO();
-            break;
+            TCI_NEXT();
 #endif
-        case INDEX_op_and_i64:
+        TCI_CASE(and_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 & t2);
-            break;
-        case INDEX_op_or_i64:
+            TCI_NEXT();
+        TCI_CASE(or_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 | t2);
-            break;
-        case INDEX_op_xor_i64:
+            TCI_NEXT();
+        TCI_CASE(xor_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 ^ t2);
-            break;
+            TCI_NEXT();
 
             /* Shift/rotate operations (64 bit). */
 
-        case INDEX_op_shl_i64:
+        TCI_CASE(shl_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 << (t2 & 63));
-            break;
-        case INDEX_op_shr_i64:
+            TCI_NEXT();
+        TCI_CASE(shr_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, t1 >> (t2 & 63));
-            break;
-        case INDEX_op_sar_i64:
+            TCI_NEXT();
+        TCI_CASE(sar_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, ((int64_t)t1 >> (t2 & 63)));
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_rot_i64
-        case INDEX_op_rotl_i64:
+        TCI_CASE(rotl_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, rol64(t1, t2 & 63));
-            break;
-        case INDEX_op_rotr_i64:
+            TCI_NEXT();
+        TCI_CASE(rotr_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_ri64(&tb_ptr);
             t2 = tci_read_ri64(&tb_ptr);
             tci_write_reg64(t0, ror64(t1, t2 & 63));
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_deposit_i64
-        case INDEX_op_deposit_i64:
+        TCI_CASE(deposit_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             t2 = tci_read_r64(&tb_ptr);
@@ -984,9 +1177,9 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             tmp8 = *tb_ptr++;
             tmp64 = (((1ULL << tmp8) - 1) << tmp16);
             tci_write_reg64(t0, (t1 & ~tmp64) | ((t2 << tmp16) & tmp64));
-            break;
+            TCI_NEXT();
 #endif
-        case INDEX_op_brcond_i64:
+        TCI_CASE(brcond_i64):
             t0 = tci_read_r64(&tb_ptr);
             t1 = tci_read_ri64(&tb_ptr);
             condition = *tb_ptr++;
@@ -994,103 +1187,103 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (tci_compare64(t0, t1, condition)) {
                 assert(tb_ptr == old_code_ptr + op_size);
                 tb_ptr = (uint8_t *)label;
-                continue;
+                TCI_NEXT_JUMP();
             }
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_ext8u_i64
-        case INDEX_op_ext8u_i64:
+        TCI_CASE(ext8u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r8(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext8s_i64
-        case INDEX_op_ext8s_i64:
+        TCI_CASE(ext8s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r8s(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16s_i64
-        case INDEX_op_ext16s_i64:
+        TCI_CASE(ext16s_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r16s(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext16u_i64
-        case INDEX_op_ext16u_i64:
+        TCI_CASE(ext16u_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_ext32s_i64
-        case INDEX_op_ext32s_i64:
+        TCI_CASE(ext32s_i64):
 #endif
-        case INDEX_op_ext_i32_i64:
+        TCI_CASE(ext_i32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32s(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_ext32u_i64
-        case INDEX_op_ext32u_i64:
+        TCI_CASE(ext32u_i64):
 #endif
-        case INDEX_op_extu_i32_i64:
+        TCI_CASE(extu_i32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg64(t0, t1);
-            break;
+            TCI_NEXT();
 #if TCG_TARGET_HAS_bswap16_i64
-        case INDEX_op_bswap16_i64:
+        TCI_CASE(bswap16_i64):
             TODO();
             t0 = *tb_ptr++;
             t1 = tci_read_r16(&tb_ptr);
             tci_write_reg64(t0, bswap16(t1));
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap32_i64
-        case INDEX_op_bswap32_i64:
+        TCI_CASE(bswap32_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r32(&tb_ptr);
             tci_write_reg64(t0, bswap32(t1));
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_bswap64_i64
-        case INDEX_op_bswap64_i64:
+        TCI_CASE(bswap64_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, bswap64(t1));
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_not_i64
-        case INDEX_op_not_i64:
+        TCI_CASE(not_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, ~t1);
-            break;
+            TCI_NEXT();
 #endif
 #if TCG_TARGET_HAS_neg_i64
-        case INDEX_op_neg_i64:
+        TCI_CASE(neg_i64):
             t0 = *tb_ptr++;
             t1 = tci_read_r64(&tb_ptr);
             tci_write_reg64(t0, -t1);
-            break;
+            TCI_NEXT();
 #endif
 #endif /* TCG_TARGET_REG_BITS == 64 */
 
             /* QEMU specific operations. */
 
-        case INDEX_op_exit_tb:
+        TCI_CASE(exit_tb):
             next_tb = *(uint64_t *)tb_ptr;
             goto exit;
-            break;
-        case INDEX_op_goto_tb:
+            TCI_NEXT();
+        TCI_CASE(goto_tb):
             t0 = tci_read_i32(&tb_ptr);
             assert(tb_ptr == old_code_ptr + op_size);
             tb_ptr += (int32_t)t0;
-            continue;
-        case INDEX_op_qemu_ld_i32:
+            TCI_NEXT_JUMP();
+        TCI_CASE(qemu_ld_i32):
             t0 = *tb_ptr++;
             taddr = tci_read_ulong(&tb_ptr);
             oi = tci_read_i(&tb_ptr);
@@ -1123,8 +1316,8 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
                 tcg_abort();
             }
             tci_write_reg(t0, tmp32);
-            break;
-        case INDEX_op_qemu_ld_i64:
+            TCI_NEXT();
+        TCI_CASE(qemu_ld_i64):
             t0 = *tb_ptr++;
             if (TCG_TARGET_REG_BITS == 32) {
                 t1 = *tb_ptr++;
@@ -1175,8 +1368,8 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             if (TCG_TARGET_REG_BITS == 32) {
                 tci_write_reg(t1, tmp64 >> 32);
             }
-            break;
-        case INDEX_op_qemu_st_i32:
+            TCI_NEXT();
+        TCI_CASE(qemu_st_i32):
             t0 = tci_read_r(&tb_ptr);
             taddr = tci_read_ulong(&tb_ptr);
             oi = tci_read_i(&tb_ptr);
@@ -1199,8 +1392,8 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             default:
                 tcg_abort();
             }
-            break;
-        case INDEX_op_qemu_st_i64:
+            TCI_NEXT();
+        TCI_CASE(qemu_st_i64):
             tmp64 = tci_read_r64(&tb_ptr);
             taddr = tci_read_ulong(&tb_ptr);
             oi = tci_read_i(&tb_ptr);
@@ -1229,10 +1422,10 @@ uintptr_t tcg_qemu_tb_exec(CPUArchState *env, uint8_t *tb_ptr)
             default:
                 tcg_abort();
             }
-            break;
-        default:
+            TCI_NEXT();
+        TCI_DEFAULT:
             TODO();
-            break;
+            TCI_NEXT();
         }
         assert(tb_ptr == old_code_ptr + op_size);
     }
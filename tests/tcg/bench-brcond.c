@@ -0,0 +1,177 @@
+/*
+ * Micro-benchmarks for TCG code with branches inside a translation block
+ *
+ * Each kernel stresses guest instructions that the x86 front end
+ * translates into conditional branches within a single TB (string ops
+ * with a REP prefix, LOOP, JECXZ), so that register allocation across
+ * those internal branches shows up in the run time.  Run it natively
+ * and under qemu-i386/qemu-x86_64 and compare, as with the sha1 test:
+ *
+ *   make -C tests/tcg speed
+ *
+ * Each result is checked against a plain C version of the kernel, so that
+ * a miscompilation across the branches makes the test fail.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#define BUF_SIZE 256
+
+static uint8_t src[BUF_SIZE], dst[BUF_SIZE];
+
+static double now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* repne scasb over a short buffer */
+static unsigned long bench_scas(unsigned long iters)
+{
+    unsigned long i, sum = 0;
+
+    for (i = 0; i < iters; i++) {
+        void *p = src;
+        unsigned long n = BUF_SIZE;
+        unsigned char c = i & 0xff;
+
+        asm volatile("repne scasb"
+                     : "+D" (p), "+c" (n)
+                     : "a" (c)
+                     : "cc", "memory");
+        sum += n;
+    }
+    return sum;
+}
+
+/* rep movsb of a short buffer */
+static unsigned long bench_movs(unsigned long iters)
+{
+    unsigned long i, sum = 0;
+
+    for (i = 0; i < iters; i++) {
+        void *s = src, *d = dst;
+        unsigned long n = (i & (BUF_SIZE - 1)) + 1;
+
+        asm volatile("rep movsb"
+                     : "+S" (s), "+D" (d), "+c" (n)
+                     :
+                     : "memory");
+        sum += dst[i & (BUF_SIZE - 1)];
+    }
+    return sum;
+}
+
+static unsigned long ref_scas(unsigned long iters)
+{
+    unsigned long i, sum = 0;
+
+    for (i = 0; i < iters; i++) {
+        unsigned char c = i & 0xff;
+        unsigned long k;
+
+        for (k = 0; k < BUF_SIZE && src[k] != c; k++) {
+            continue;
+        }
+        sum += k < BUF_SIZE ? BUF_SIZE - k - 1 : 0;
+    }
+    return sum;
+}
+
+/* Each iteration copies at least up to dst[i % BUF_SIZE] */
+static unsigned long ref_movs(unsigned long iters)
+{
+    unsigned long i, sum = 0;
+
+    for (i = 0; i < iters; i++) {
+        sum += src[i & (BUF_SIZE - 1)];
+    }
+    return sum;
+}
+
+/* LOOP and JECXZ keep the counter and accumulator live across the
+   branches they generate */
+static unsigned long bench_loop(unsigned long iters)
+{
+    unsigned long i, sum = 0;
+
+    for (i = 0; i < iters; i++) {
+        unsigned long n = 64, acc = i;
+
+        asm volatile("jecxz 2f\n"
+                     "1:\n\t"
+                     "add %%ecx, %%eax\n\t"
+                     "xor %%edx, %%eax\n\t"
+                     "loop 1b\n"
+                     "2:\n"
+                     : "+c" (n), "+a" (acc)
+                     : "d" (i)
+                     : "cc");
+        sum += acc;
+    }
+    return sum;
+}
+
+static unsigned long ref_loop(unsigned long iters)
+{
+    unsigned long i, sum = 0;
+
+    for (i = 0; i < iters; i++) {
+        uint32_t n, acc = i;
+
+        for (n = 64; n > 0; n--) {
+            acc = (acc + n) ^ (uint32_t)i;
+        }
+        sum += acc;
+    }
+    return sum;
+}
+
+static const struct {
+    const char *name;
+    unsigned long (*func)(unsigned long iters);
+    unsigned long (*ref)(unsigned long iters);
+    unsigned long iters;
+} benches[] = {
+    { "repne-scasb", bench_scas, ref_scas, 200000 },
+    { "rep-movsb",   bench_movs, ref_movs, 200000 },
+    { "loop-jecxz",  bench_loop, ref_loop, 500000 },
+};
+
+int main(int argc, char **argv)
+{
+    unsigned long scale = 1;
+    int i, ret = 0;
+
+    if (argc > 1) {
+        scale = strtoul(argv[1], NULL, 0);
+    }
+    for (i = 0; i < BUF_SIZE; i++) {
+        src[i] = i * 7;
+    }
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) {
+        double t = now();
+        unsigned long res = benches[i].func(benches[i].iters * scale);
+        unsigned long expected;
+
+        t = now() - t;
+        printf("%-12s %10.3f ms  (result %lx)\n",
+               benches[i].name, t * 1e3, res);
+
+        expected = benches[i].ref(benches[i].iters * scale);
+        if (res != expected) {
+            printf("%-12s FAILED: expected %lx\n", benches[i].name, expected);
+            ret = 1;
+        }
+    }
+    return ret;
+}
@@ -16,6 +16,7 @@
 #include "qemu/timer.h"
 #include "qemu/sockets.h"
 #include "qemu/error-report.h"
+#include "qapi/error.h"
 
 static AioContext *ctx;
 
@@ -504,6 +505,128 @@ static void test_timer_schedule(void)
     timer_del(&data.timer);
 }
 
+#ifndef _WIN32
+/* Adaptive polling.  The event notifier is never set, and its poll
+ * callback never finds work, so every aio_poll(ctx, true) below ends
+ * when the timer fires.
+ */
+
+typedef struct {
+    EventNotifier e;
+    int poll_calls;
+} PollTestData;
+
+static bool poll_no_progress(void *opaque)
+{
+    PollTestData *data = container_of(opaque, PollTestData, e);
+
+    data->poll_calls++;
+    return false;
+}
+
+static void poll_timer_cb(void *opaque)
+{
+    bool *fired = opaque;
+
+    *fired = true;
+}
+
+/* Block in aio_poll() until a timer expires after @ns nanoseconds.  */
+static void poll_wait_ns(int64_t ns)
+{
+    QEMUTimer timer;
+    bool fired = false;
+
+    aio_timer_init(ctx, &timer, QEMU_CLOCK_REALTIME, SCALE_NS,
+                   poll_timer_cb, &fired);
+    timer_mod(&timer, qemu_clock_get_ns(QEMU_CLOCK_REALTIME) + ns);
+    while (!fired) {
+        aio_poll(ctx, true);
+    }
+    timer_del(&timer);
+}
+
+static void poll_test_init(PollTestData *data, int64_t max_ns,
+                           int64_t grow, int64_t shrink)
+{
+    data->poll_calls = 0;
+    event_notifier_init(&data->e, false);
+    set_event_notifier(ctx, &data->e, dummy_io_handler_read);
+    aio_set_event_notifier_poll(ctx, &data->e, poll_no_progress);
+    aio_context_set_poll_params(ctx, max_ns, grow, shrink, &error_abort);
+    while (aio_poll(ctx, false));
+}
+
+static void poll_test_cleanup(PollTestData *data)
+{
+    aio_context_set_poll_params(ctx, 0, 0, 0, &error_abort);
+    set_event_notifier(ctx, &data->e, NULL);
+    event_notifier_cleanup(&data->e);
+}
+
+static void test_poll_grow_shrink(void)
+{
+    PollTestData data;
+    int64_t poll_ns;
+
+    poll_test_init(&data, 50 * SCALE_MS, 4, 2);
+    g_assert_cmpint(ctx->poll_ns, ==, 0);
+
+    /* waits shorter than poll_max_ns make polling longer */
+    poll_wait_ns(SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, >, 0);
+    poll_ns = ctx->poll_ns;
+    poll_wait_ns(SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, >=, poll_ns * 4);
+    g_assert_cmpint(ctx->poll_ns, <=, 50 * SCALE_MS);
+    g_assert_cmpint(data.poll_calls, >, 0);
+
+    /* a longer wait makes it shorter */
+    poll_ns = ctx->poll_ns;
+    poll_wait_ns(100 * SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, ==, poll_ns / 2);
+
+    /* and without a shrink factor, polling stops */
+    aio_context_set_poll_params(ctx, 50 * SCALE_MS, 4, 0, &error_abort);
+    poll_wait_ns(SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, >, 0);
+    poll_wait_ns(100 * SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, ==, 0);
+
+    poll_test_cleanup(&data);
+}
+
+static void test_poll_no_progress_blocks(void)
+{
+    PollTestData data;
+    QEMUTimer timer;
+    bool fired = false;
+    int64_t start;
+
+    poll_test_init(&data, 50 * SCALE_MS, 0, 0);
+    poll_wait_ns(SCALE_MS);
+    poll_wait_ns(SCALE_MS);
+    g_assert_cmpint(ctx->poll_ns, >, 0);
+
+    /* polling finds nothing, so aio_poll() must go on to block and only
+     * return once the timer has run
+     */
+    data.poll_calls = 0;
+    aio_timer_init(ctx, &timer, QEMU_CLOCK_REALTIME, SCALE_NS,
+                   poll_timer_cb, &fired);
+    start = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    timer_mod(&timer, start + 10 * SCALE_MS);
+    g_assert(aio_poll(ctx, true));
+    g_assert(fired);
+    g_assert_cmpint(qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start, >=,
+                    10 * SCALE_MS);
+    g_assert_cmpint(data.poll_calls, >, 0);
+    timer_del(&timer);
+
+    poll_test_cleanup(&data);
+}
+#endif
+
 /* Now the same tests, using the context as a GSource.  They are
  * very similar to the ones above, with g_main_context_iteration
  * replacing aio_poll.  However:
@@ -857,6 +980,10 @@ int main(int argc, char **argv)
     g_test_add_func("/aio/event/flush",             test_flush_event_notifier);
     g_test_add_func("/aio/external-client",         test_aio_external_client);
     g_test_add_func("/aio/timer/schedule",          test_timer_schedule);
+#ifndef _WIN32
+    g_test_add_func("/aio/poll/grow-shrink",        test_poll_grow_shrink);
+    g_test_add_func("/aio/poll/no-progress-blocks", test_poll_no_progress_blocks);
+#endif
 
     g_test_add_func("/aio-gsource/flush",                   test_source_flush);
     g_test_add_func("/aio-gsource/bh/schedule",             test_source_bh_schedule);
@@ -0,0 +1,221 @@
+/*
+ * Check the host FPU fast path of softfloat against the software path
+ *
+ * The fast path is only taken when the inexact flag is already set, so
+ * each operation is done twice: once with inexact set, which may use the
+ * host FPU, and once with no flags set, which always goes through the
+ * software implementation.  The results must be bit-for-bit identical,
+ * and so must the flags once inexact is added to the second set.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+#include "qemu/osdep.h"
+#include <glib.h>
+#include "fpu/softfloat.h"
+
+#define N_OPS 10000
+
+typedef enum {
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_SQRT,
+} Op;
+
+static const char *const op_names[] = {
+    [OP_ADD] = "add",
+    [OP_SUB] = "sub",
+    [OP_MUL] = "mul",
+    [OP_DIV] = "div",
+    [OP_SQRT] = "sqrt",
+};
+
+static const int rounding_modes[] = {
+    float_round_nearest_even,
+    float_round_down,
+    float_round_up,
+    float_round_to_zero,
+    float_round_ties_away,
+};
+
+static uint64_t rand64(void)
+{
+    return ((uint64_t)g_test_rand_int() << 32) | (uint32_t)g_test_rand_int();
+}
+
+/* Pick an operand with the given exponent range and a random sign and
+   fraction.  */
+static uint64_t make_operand(int exp_bits, int frac_bits, int exp_min,
+                             int exp_max)
+{
+    uint64_t sign = (uint64_t)g_test_rand_bit() << (exp_bits + frac_bits);
+    uint64_t exp = g_test_rand_int_range(exp_min, exp_max + 1);
+    uint64_t frac = rand64() & ((1ULL << frac_bits) - 1);
+
+    return sign | (exp << frac_bits) | frac;
+}
+
+/* Operands are drawn from classes that exercise the edges of the fast
+   path: zeros and denormals, which it must leave to software, and
+   exponents for which sums, products and quotients land close to the
+   overflow and underflow thresholds.  */
+static uint64_t random_operand(int exp_bits, int frac_bits)
+{
+    int bias = (1 << (exp_bits - 1)) - 1;
+    int exp_max = (1 << exp_bits) - 1;
+
+    switch (g_test_rand_int_range(0, 9)) {
+    case 0:
+        /* anything, including infinities and NaNs */
+        return rand64() >> (63 - exp_bits - frac_bits);
+    case 1:
+        return make_operand(exp_bits, frac_bits, 0, 0);
+    case 2:
+        /* zero */
+        return (uint64_t)g_test_rand_bit() << (exp_bits + frac_bits);
+    case 3:
+        /* near the largest normal */
+        return make_operand(exp_bits, frac_bits, exp_max - 3, exp_max - 1);
+    case 4:
+        /* near the smallest normal */
+        return make_operand(exp_bits, frac_bits, 1, 3);
+    case 5:
+        /* products and quotients near the overflow threshold */
+        return make_operand(exp_bits, frac_bits, bias + bias / 2 - 2,
+                            bias + bias / 2 + 2);
+    case 6:
+        /* products and quotients near the underflow threshold */
+        return make_operand(exp_bits, frac_bits, bias / 2 - 2, bias / 2 + 2);
+    case 7:
+        /* around one */
+        return make_operand(exp_bits, frac_bits, bias - 2, bias + 2);
+    default:
+        return make_operand(exp_bits, frac_bits, 1, exp_max - 1);
+    }
+}
+
+static float32 float32_op(Op op, float32 a, float32 b, float_status *s)
+{
+    switch (op) {
+    case OP_ADD:
+        return float32_add(a, b, s);
+    case OP_SUB:
+        return float32_sub(a, b, s);
+    case OP_MUL:
+        return float32_mul(a, b, s);
+    case OP_DIV:
+        return float32_div(a, b, s);
+    case OP_SQRT:
+        return float32_sqrt(a, s);
+    }
+    g_assert_not_reached();
+}
+
+static float64 float64_op(Op op, float64 a, float64 b, float_status *s)
+{
+    switch (op) {
+    case OP_ADD:
+        return float64_add(a, b, s);
+    case OP_SUB:
+        return float64_sub(a, b, s);
+    case OP_MUL:
+        return float64_mul(a, b, s);
+    case OP_DIV:
+        return float64_div(a, b, s);
+    case OP_SQRT:
+        return float64_sqrt(a, s);
+    }
+    g_assert_not_reached();
+}
+
+/* Run OP on A and B in both paths under every status combination, and
+   compare.  */
+static void check_op(Op op, bool is_float64, uint64_t a, uint64_t b)
+{
+    int r, ftz, tininess;
+
+    for (r = 0; r < ARRAY_SIZE(rounding_modes); r++) {
+        for (ftz = 0; ftz < 2; ftz++) {
+            for (tininess = 0; tininess < 2; tininess++) {
+                float_status hard = { 0 }, soft;
+                uint64_t rh, rs;
+
+                set_float_rounding_mode(rounding_modes[r], &hard);
+                set_flush_to_zero(ftz, &hard);
+                set_flush_inputs_to_zero(ftz, &hard);
+                set_float_detect_tininess(tininess, &hard);
+                soft = hard;
+                set_float_exception_flags(float_flag_inexact, &hard);
+
+                if (is_float64) {
+                    rh = float64_val(float64_op(op, make_float64(a),
+                                                make_float64(b), &hard));
+                    rs = float64_val(float64_op(op, make_float64(a),
+                                                make_float64(b), &soft));
+                } else {
+                    rh = float32_val(float32_op(op, make_float32(a),
+                                                make_float32(b), &hard));
+                    rs = float32_val(float32_op(op, make_float32(a),
+                                                make_float32(b), &soft));
+                }
+
+                if (rh != rs ||
+                    get_float_exception_flags(&hard) !=
+                    (get_float_exception_flags(&soft) | float_flag_inexact)) {
+                    g_test_message("float%d_%s(%#" PRIx64 ", %#" PRIx64
+                                   ") rounding %d ftz %d tininess %d: "
+                                   "%#" PRIx64 "/%#x vs %#" PRIx64 "/%#x",
+                                   is_float64 ? 64 : 32, op_names[op], a, b,
+                                   rounding_modes[r], ftz, tininess,
+                                   rh,
+                                   (uint8_t)get_float_exception_flags(&hard),
+                                   rs,
+                                   (uint8_t)get_float_exception_flags(&soft));
+                    g_assert_not_reached();
+                }
+            }
+        }
+    }
+}
+
+static void test_float32(const void *opaque)
+{
+    Op op = (uintptr_t)opaque;
+    int i;
+
+    for (i = 0; i < N_OPS; i++) {
+        check_op(op, false, random_operand(8, 23), random_operand(8, 23));
+    }
+}
+
+static void test_float64(const void *opaque)
+{
+    Op op = (uintptr_t)opaque;
+    int i;
+
+    for (i = 0; i < N_OPS; i++) {
+        check_op(op, true, random_operand(11, 52), random_operand(11, 52));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    uintptr_t op;
+
+    g_test_init(&argc, &argv, NULL);
+    for (op = 0; op < ARRAY_SIZE(op_names); op++) {
+        char *path;
+
+        path = g_strdup_printf("/softfloat/hardfloat/float32/%s",
+                               op_names[op]);
+        g_test_add_data_func(path, (void *)op, test_float32);
+        g_free(path);
+        path = g_strdup_printf("/softfloat/hardfloat/float64/%s",
+                               op_names[op]);
+        g_test_add_data_func(path, (void *)op, test_float64);
+        g_free(path);
+    }
+    return g_test_run();
+}
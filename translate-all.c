@@ -48,6 +48,7 @@
 #endif
 #else
 #include "exec/address-spaces.h"
+#include "qmp-commands.h"
 #endif
 
 #include "exec/cputlb.h"
@@ -77,6 +78,7 @@ typedef struct PageDesc {
     unsigned int code_write_count;
     unsigned long *code_bitmap;
 #if defined(CONFIG_USER_ONLY)
+    /* written with mmap_lock held, but read locklessly */
     unsigned long flags;
 #endif
 } PageDesc;
@@ -121,36 +123,30 @@ static void *l1_map[V_L1_SIZE];
 TCGContext tcg_ctx;
 
 /* translation block context */
-#ifdef CONFIG_USER_ONLY
 __thread int have_tb_lock;
-#endif
+
+bool tb_profile_enabled;
 
 void tb_lock(void)
 {
-#ifdef CONFIG_USER_ONLY
     assert(!have_tb_lock);
     qemu_mutex_lock(&tcg_ctx.tb_ctx.tb_lock);
     have_tb_lock++;
-#endif
 }
 
 void tb_unlock(void)
 {
-#ifdef CONFIG_USER_ONLY
     assert(have_tb_lock);
     have_tb_lock--;
     qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
-#endif
 }
 
 void tb_lock_reset(void)
 {
-#ifdef CONFIG_USER_ONLY
     if (have_tb_lock) {
         qemu_mutex_unlock(&tcg_ctx.tb_ctx.tb_lock);
         have_tb_lock = 0;
     }
-#endif
 }
 
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
@@ -300,7 +296,18 @@ static int cpu_restore_state_from_tb(CPUState *cpu, TranslationBlock *tb,
 bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
 {
     TranslationBlock *tb;
+    bool r = false;
 
+    /* A retaddr outside of the code buffer cannot belong to a TB.  This
+       also covers faults raised while translating, when tb_lock is
+       already held.  */
+    if (retaddr < (uintptr_t)tcg_ctx.code_gen_buffer ||
+        retaddr >= (uintptr_t)tcg_ctx.code_gen_buffer +
+                    tcg_ctx.code_gen_buffer_size) {
+        return false;
+    }
+
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (tb) {
         cpu_restore_state_from_tb(cpu, tb, retaddr);
@@ -310,9 +317,11 @@ bool cpu_restore_state(CPUState *cpu, uintptr_t retaddr)
             tb_phys_invalidate(tb, -1);
             tb_free(tb);
         }
-        return true;
+        r = true;
     }
-    return false;
+    tb_unlock();
+
+    return r;
 }
 
 void page_size_init(void)
@@ -399,8 +408,10 @@ static void page_init(void)
 #endif
 }
 
-/* If alloc=1:
- * Called with mmap_lock held for user-mode emulation.
+/* Levels of the page table are never freed, so lookups need no lock.
+ * Missing levels are installed with a compare-and-swap; a thread that
+ * loses the race frees its copy and uses the winner's, so concurrent
+ * allocation does not need mmap_lock either.
  */
 static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
 {
@@ -416,11 +427,18 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
         void **p = atomic_rcu_read(lp);
 
         if (p == NULL) {
+            void *existing;
+
             if (!alloc) {
                 return NULL;
             }
             p = g_new0(void *, V_L2_SIZE);
-            atomic_rcu_set(lp, p);
+            smp_wmb();
+            existing = atomic_cmpxchg(lp, NULL, p);
+            if (unlikely(existing)) {
+                g_free(p);
+                p = existing;
+            }
         }
 
         lp = p + ((index >> (i * V_L2_BITS)) & (V_L2_SIZE - 1));
@@ -428,11 +446,18 @@ static PageDesc *page_find_alloc(tb_page_addr_t index, int alloc)
 
     pd = atomic_rcu_read(lp);
     if (pd == NULL) {
+        void *existing;
+
         if (!alloc) {
             return NULL;
         }
         pd = g_new0(PageDesc, V_L2_SIZE);
-        atomic_rcu_set(lp, pd);
+        smp_wmb();
+        existing = atomic_cmpxchg(lp, NULL, pd);
+        if (unlikely(existing)) {
+            g_free(pd);
+            pd = existing;
+        }
     }
 
     return pd + (index & (V_L2_SIZE - 1));
@@ -735,6 +760,13 @@ static inline void code_gen_alloc(size_t tb_size)
     qemu_mutex_init(&tcg_ctx.tb_ctx.tb_lock);
 }
 
+static void tb_htable_init(void)
+{
+    unsigned int mode = QHT_MODE_AUTO_RESIZE;
+
+    qht_init(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE, mode);
+}
+
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
    (in bytes) allocated to the translation buffer. Zero means default
    size. */
@@ -742,6 +774,7 @@ void tcg_exec_init(unsigned long tb_size)
 {
     cpu_gen_init();
     page_init();
+    tb_htable_init();
     code_gen_alloc(tb_size);
 #if defined(CONFIG_SOFTMMU)
     /* There's no guest base to take into account, so go ahead and
@@ -755,30 +788,107 @@ bool tcg_enabled(void)
     return tcg_ctx.code_gen_buffer != NULL;
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+static void tb_region_switch(int i)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &tb_ctx->regions[i];
+
+    tb_ctx->cur_region = i;
+    r->gen = ++tb_ctx->region_gen;
+    tcg_ctx.code_gen_ptr = r->start;
+    tcg_ctx.code_gen_highwater = r->end - TCG_HIGHWATER;
+}
+
+/* Split the translation buffer into regions.  The prologue sits at the
+   start of the buffer, and for user-mode it is only generated once
+   guest_base is known, so this is done when the first TB is allocated
+   rather than in code_gen_alloc.  */
+static void tb_regions_init(void)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    size_t size = tcg_ctx.code_gen_buffer_size;
+    size_t region_size;
+    int i, n;
+
+    n = CODE_GEN_REGIONS;
+    while (n > 1 && size / n < CODE_GEN_MIN_REGION_SIZE) {
+        n--;
+    }
+    region_size = (size / n) & ~(size_t)(CODE_GEN_ALIGN - 1);
+
+    tb_ctx->nb_regions = n;
+    tb_ctx->region_max_tbs = tcg_ctx.code_gen_max_blocks / n;
+    for (i = 0; i < n; i++) {
+        TBRegion *r = &tb_ctx->regions[i];
+
+        r->start = tcg_ctx.code_gen_buffer + i * region_size;
+        r->end = i == n - 1 ? tcg_ctx.code_gen_buffer + size
+                            : r->start + region_size;
+        r->ptr = r->start;
+        r->tbs = &tb_ctx->tbs[i * tb_ctx->region_max_tbs];
+        r->nb_tbs = 0;
+    }
+    tb_ctx->nb_tbs = 0;
+    tb_region_switch(0);
+}
+
+static void *tb_region_code_end(TBRegion *r)
+{
+    if (r == &tcg_ctx.tb_ctx.regions[tcg_ctx.tb_ctx.cur_region]) {
+        return tcg_ctx.code_gen_ptr;
+    }
+    return r->ptr;
+}
+
+static inline size_t tb_code_size(void)
+{
+    size_t size = 0;
+    int i;
+
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+        size += tb_region_code_end(r) - r->start;
+    }
+    return size;
+}
+
+/* Allocate a new translation block in the current region.  Return NULL
+   if the region has run out of TBs; the caller then moves on to the
+   next region.  */
 static TranslationBlock *tb_alloc(target_ulong pc)
 {
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r;
     TranslationBlock *tb;
 
-    if (tcg_ctx.tb_ctx.nb_tbs >= tcg_ctx.code_gen_max_blocks) {
+    if (unlikely(tb_ctx->nb_regions == 0)) {
+        tb_regions_init();
+    }
+    r = &tb_ctx->regions[tb_ctx->cur_region];
+    if (r->nb_tbs >= tb_ctx->region_max_tbs) {
         return NULL;
     }
-    tb = &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs++];
+    tb = &r->tbs[r->nb_tbs++];
+    tb_ctx->nb_tbs++;
     tb->pc = pc;
     tb->cflags = 0;
+    tb->invalid = false;
     return tb;
 }
 
 void tb_free(TranslationBlock *tb)
 {
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    TBRegion *r = &tb_ctx->regions[tb_ctx->cur_region];
+
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (tcg_ctx.tb_ctx.nb_tbs > 0 &&
-            tb == &tcg_ctx.tb_ctx.tbs[tcg_ctx.tb_ctx.nb_tbs - 1]) {
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
         tcg_ctx.code_gen_ptr = tb->tc_ptr;
-        tcg_ctx.tb_ctx.nb_tbs--;
+        r->nb_tbs--;
+        tb_ctx->nb_tbs--;
     }
 }
 
@@ -823,90 +933,112 @@ static void page_flush_tb(void)
 }
 
 /* flush all the translation blocks */
-/* XXX: tb_flush is currently not thread safe */
-void tb_flush(CPUState *cpu)
+static void do_tb_flush(CPUState *cpu)
 {
 #if defined(DEBUG_FLUSH)
     printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
-           (unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer),
+           (unsigned long)tb_code_size(),
            tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.tb_ctx.nb_tbs > 0 ?
-           ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)) /
-           tcg_ctx.tb_ctx.nb_tbs : 0);
+           (unsigned long)tb_code_size() / tcg_ctx.tb_ctx.nb_tbs : 0);
 #endif
     if ((unsigned long)(tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer)
         > tcg_ctx.code_gen_buffer_size) {
         cpu_abort(cpu, "Internal error: code buffer overflow\n");
     }
-    tcg_ctx.tb_ctx.nb_tbs = 0;
 
     CPU_FOREACH(cpu) {
         memset(cpu->tb_jmp_cache, 0, sizeof(cpu->tb_jmp_cache));
     }
 
-    memset(tcg_ctx.tb_ctx.tb_phys_hash, 0, sizeof(tcg_ctx.tb_ctx.tb_phys_hash));
+    qht_reset_size(&tcg_ctx.tb_ctx.htable, CODE_GEN_HTABLE_SIZE);
     page_flush_tb();
 
-    tcg_ctx.code_gen_ptr = tcg_ctx.code_gen_buffer;
+    tb_regions_init();
     /* XXX: flush processor icache at this point if cache flush is
        expensive */
     tcg_ctx.tb_ctx.tb_flush_count++;
 }
 
-#ifdef DEBUG_TB_CHECK
+#ifndef CONFIG_USER_ONLY
+typedef struct TBFlushRequest {
+    CPUState *cpu;
+    unsigned int flush_count;
+} TBFlushRequest;
 
-static void tb_invalidate_check(target_ulong address)
+/* Run as safe work: no other vCPU is executing translated code.  */
+static void do_tb_flush_safe(void *data)
 {
-    TranslationBlock *tb;
-    int i;
+    TBFlushRequest *req = data;
 
-    address &= TARGET_PAGE_MASK;
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tb_ctx.tb_phys_hash[i]; tb != NULL; tb = tb->phys_hash_next) {
-            if (!(address + TARGET_PAGE_SIZE <= tb->pc ||
-                  address >= tb->pc + tb->size)) {
-                printf("ERROR invalidate: address=" TARGET_FMT_lx
-                       " PC=%08lx size=%04x\n",
-                       address, (long)tb->pc, tb->size);
-            }
-        }
+    tb_lock();
+    /* If several vCPUs asked for a flush, only the first one does it */
+    if (tcg_ctx.tb_ctx.tb_flush_count == req->flush_count) {
+        do_tb_flush(req->cpu);
     }
+    tb_unlock();
+    g_free(req);
 }
+#endif
 
-/* verify that all the pages have correct rights for code */
-static void tb_page_check(void)
+void tb_flush(CPUState *cpu)
 {
-    TranslationBlock *tb;
-    int i, flags1, flags2;
-
-    for (i = 0; i < CODE_GEN_PHYS_HASH_SIZE; i++) {
-        for (tb = tcg_ctx.tb_ctx.tb_phys_hash[i]; tb != NULL;
-                tb = tb->phys_hash_next) {
-            flags1 = page_get_flags(tb->pc);
-            flags2 = page_get_flags(tb->pc + tb->size - 1);
-            if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
-                printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
-                       (long)tb->pc, tb->size, flags1, flags2);
-            }
-        }
+#ifndef CONFIG_USER_ONLY
+    if (qemu_tcg_mttcg_enabled()) {
+        TBFlushRequest *req = g_new(TBFlushRequest, 1);
+
+        /* Other vCPUs may be executing from the code buffer, so the
+           flush is deferred until they have all left cpu_exec.  */
+        req->cpu = cpu;
+        req->flush_count = atomic_read(&tcg_ctx.tb_ctx.tb_flush_count);
+        async_safe_run_on_cpu(cpu, do_tb_flush_safe, req);
+        return;
     }
+#endif
+    do_tb_flush(cpu);
 }
 
-#endif
+#ifdef DEBUG_TB_CHECK
 
-static inline void tb_hash_remove(TranslationBlock **ptb, TranslationBlock *tb)
+static void
+do_tb_invalidate_check(struct qht *ht, void *p, uint32_t hash, void *userp)
 {
-    TranslationBlock *tb1;
+    TranslationBlock *tb = p;
+    target_ulong addr = *(target_ulong *)userp;
 
-    for (;;) {
-        tb1 = *ptb;
-        if (tb1 == tb) {
-            *ptb = tb1->phys_hash_next;
-            break;
-        }
-        ptb = &tb1->phys_hash_next;
+    if (!(addr + TARGET_PAGE_SIZE <= tb->pc || addr >= tb->pc + tb->size)) {
+        printf("ERROR invalidate: address=" TARGET_FMT_lx
+               " PC=%08lx size=%04x\n", addr, (long)tb->pc, tb->size);
     }
 }
 
+static void tb_invalidate_check(target_ulong address)
+{
+    address &= TARGET_PAGE_MASK;
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_invalidate_check, &address);
+}
+
+static void
+do_tb_page_check(struct qht *ht, void *p, uint32_t hash, void *userp)
+{
+    TranslationBlock *tb = p;
+    int flags1, flags2;
+
+    flags1 = page_get_flags(tb->pc);
+    flags2 = page_get_flags(tb->pc + tb->size - 1);
+    if ((flags1 & PAGE_WRITE) || (flags2 & PAGE_WRITE)) {
+        printf("ERROR page flags: PC=%08lx size=%04x f1=%x f2=%x\n",
+               (long)tb->pc, tb->size, flags1, flags2);
+    }
+}
+
+/* verify that all the pages have correct rights for code */
+static void tb_page_check(void)
+{
+    qht_iter(&tcg_ctx.tb_ctx.htable, do_tb_page_check, NULL);
+}
+
+#endif
+
 static inline void tb_page_remove(TranslationBlock **ptb, TranslationBlock *tb)
 {
     TranslationBlock *tb1;
@@ -960,19 +1092,20 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
     tb_set_jmp_target(tb, n, (uintptr_t)(tb->tc_ptr + tb->tb_next_offset[n]));
 }
 
-/* invalidate one TB */
-void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+static void do_tb_phys_invalidate(TranslationBlock *tb,
+                                  tb_page_addr_t page_addr)
 {
     CPUState *cpu;
     PageDesc *p;
-    unsigned int h, n1;
+    unsigned int n1;
+    uint32_t h;
     tb_page_addr_t phys_pc;
     TranslationBlock *tb1, *tb2;
 
     /* remove the TB from the hash list */
     phys_pc = tb->page_addr[0] + (tb->pc & ~TARGET_PAGE_MASK);
-    h = tb_phys_hash_func(phys_pc);
-    tb_hash_remove(&tcg_ctx.tb_ctx.tb_phys_hash[h], tb);
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags);
+    qht_remove(&tcg_ctx.tb_ctx.htable, tb, h);
 
     /* remove the TB from the page list */
     if (tb->page_addr[0] != page_addr) {
@@ -986,13 +1119,14 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
         invalidate_page_bitmap(p);
     }
 
-    tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
+    atomic_set(&tcg_ctx.tb_ctx.tb_invalidated_gen,
+               tcg_ctx.tb_ctx.tb_invalidated_gen + 1);
 
     /* remove the TB from the hash list */
     h = tb_jmp_cache_hash_func(tb->pc);
     CPU_FOREACH(cpu) {
-        if (cpu->tb_jmp_cache[h] == tb) {
-            cpu->tb_jmp_cache[h] = NULL;
+        if (atomic_read(&cpu->tb_jmp_cache[h]) == tb) {
+            atomic_set(&cpu->tb_jmp_cache[h], NULL);
         }
     }
 
@@ -1015,9 +1149,108 @@ void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
     }
     tb->jmp_first = (TranslationBlock *)((uintptr_t)tb | 2); /* fail safe */
 
+    tb->invalid = true;
+}
+
+/* invalidate one TB */
+void tb_phys_invalidate(TranslationBlock *tb, tb_page_addr_t page_addr)
+{
+    do_tb_phys_invalidate(tb, page_addr);
     tcg_ctx.tb_ctx.tb_phys_invalidate_count++;
 }
 
+/* Drop every TB in region @r.  Jumps into the region from TBs in other
+   regions are reset to go back to the main loop.  */
+static void tb_region_evict(TBRegion *r)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    int i;
+
+    for (i = 0; i < r->nb_tbs; i++) {
+        TranslationBlock *tb = &r->tbs[i];
+
+        if (!tb->invalid) {
+            do_tb_phys_invalidate(tb, -1);
+        }
+    }
+    tb_ctx->nb_tbs -= r->nb_tbs;
+    tb_ctx->tb_evicted_tbs += r->nb_tbs;
+    tb_ctx->tb_region_evict_count++;
+    r->nb_tbs = 0;
+    r->ptr = r->start;
+}
+
+/* Move on to the next region, evicting its contents.  Regions are
+   filled in order, so this is always the one holding the oldest code;
+   TBs in the other regions stay valid and chained.  */
+static void tb_region_advance(void)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    int next = (tb_ctx->cur_region + 1) % tb_ctx->nb_regions;
+
+    tb_ctx->regions[tb_ctx->cur_region].ptr = tcg_ctx.code_gen_ptr;
+    if (tb_ctx->regions[next].nb_tbs) {
+        tb_region_evict(&tb_ctx->regions[next]);
+    }
+    tb_region_switch(next);
+    atomic_set(&tb_ctx->tb_invalidated_gen, tb_ctx->tb_invalidated_gen + 1);
+}
+
+#ifndef CONFIG_USER_ONLY
+/* Run as safe work: no other vCPU is executing translated code.  */
+static void do_tb_region_advance_safe(void *data)
+{
+    unsigned int gen = (uintptr_t)data;
+
+    tb_lock();
+    /* If several vCPUs ran out of space, only the first one moves on */
+    if (tcg_ctx.tb_ctx.region_gen == gen) {
+        tb_region_advance();
+    }
+    tb_unlock();
+}
+#else
+/* Called by the user-mode cpu loop between start_exclusive() and
+   end_exclusive(), i.e. while no guest thread executes translated code.  */
+void tb_region_advance_exclusive(void)
+{
+    tb_lock();
+    /* If several threads ran out of space, only the first one moves on */
+    if (tcg_ctx.tb_ctx.region_advance_pending) {
+        tb_region_advance();
+        atomic_set(&tcg_ctx.tb_ctx.region_advance_pending, false);
+    }
+    tb_unlock();
+}
+#endif
+
+/* Called with tb_lock held when the current region is full.  Return
+   false if the eviction has been deferred until all vCPUs have left
+   the execution loop.  */
+static bool tb_region_full(CPUState *cpu)
+{
+    TBContext *tb_ctx = &tcg_ctx.tb_ctx;
+    int next = (tb_ctx->cur_region + 1) % tb_ctx->nb_regions;
+
+#ifndef CONFIG_USER_ONLY
+    if (qemu_tcg_mttcg_enabled() && tb_ctx->regions[next].nb_tbs) {
+        async_safe_run_on_cpu(cpu, do_tb_region_advance_safe,
+                              (void *)(uintptr_t)tb_ctx->region_gen);
+        return false;
+    }
+#else
+    /* Other guest threads may be executing code from the region.  Only
+       this thread can create new ones, so with a single CPU there is
+       nobody else to stop.  */
+    if (CPU_NEXT(first_cpu) && tb_ctx->regions[next].nb_tbs) {
+        atomic_set(&tb_ctx->region_advance_pending, true);
+        return false;
+    }
+#endif
+    tb_region_advance();
+    return true;
+}
+
 static void build_page_bitmap(PageDesc *p)
 {
     int n, tb_start, tb_end;
@@ -1047,10 +1280,251 @@ static void build_page_bitmap(PageDesc *p)
     }
 }
 
+/* A trace: the blocks following the head block, along with the jump
+   slot through which the previous block of the trace reaches them.  The
+   blocks are recorded by value, as the TBs they come from may be evicted
+   while the trace is being translated.  */
+typedef struct TBTraceBlock {
+    target_ulong pc;
+    target_ulong cs_base;
+    uint64_t flags;
+    int slot;
+} TBTraceBlock;
+
+typedef struct TBTrace {
+    int nb_blocks;
+    TBTraceBlock blocks[TB_TRACE_MAX_BLOCKS - 1];
+    /* jump slot through which the last block loops back to the head,
+       or -1 */
+    int close_slot;
+} TBTrace;
+
+/* Return the TB that jump slot @n of @tb is chained to, if any.  */
+static TranslationBlock *tb_jmp_target(TranslationBlock *tb, int n)
+{
+    TranslationBlock *tb1 = tb->jmp_next[n];
+    unsigned int n1;
+
+    if (tb1 == NULL) {
+        return NULL;
+    }
+    for (;;) {
+        n1 = (uintptr_t)tb1 & 3;
+        tb1 = (TranslationBlock *)((uintptr_t)tb1 & ~3);
+        if (n1 == 2) {
+            return tb1;
+        }
+        tb1 = tb1->jmp_next[n1];
+    }
+}
+
+/* Pick the hottest successor of @tb that can be appended to a trace
+   headed by @head, and return the jump slot leading to it, or -1.
+   Only blocks that lie after the head in the same page are considered,
+   so that the range [head->pc, end of the last block) covers the whole
+   trace for the purpose of invalidation.  A jump back to the head closes
+   the trace: it is recorded in trace->close_slot and -1 is returned.  */
+static int tb_trace_next(TranslationBlock *head, TranslationBlock *tb,
+                         TBTrace *trace, TranslationBlock **pnext)
+{
+    int n, i, best = -1;
+
+    for (n = 0; n < 2; n++) {
+        if (tb_jmp_target(tb, n) == head) {
+            trace->close_slot = n;
+            return -1;
+        }
+    }
+
+    for (n = 0; n < 2; n++) {
+        TranslationBlock *next = tb_jmp_target(tb, n);
+
+        if (next == NULL || next->invalid || !tb_hot_counted(next) ||
+            next->pc <= head->pc ||
+            (next->pc & TARGET_PAGE_MASK) != (head->pc & TARGET_PAGE_MASK) ||
+            next->page_addr[0] != head->page_addr[0] ||
+            next->page_addr[1] != -1) {
+            continue;
+        }
+        /* not worth it unless the path is taken a fair share of the time */
+        if (atomic_read(&next->hot_count) >
+            TB_HOT_THRESHOLD - TB_HOT_THRESHOLD / 4) {
+            continue;
+        }
+        for (i = 0; i < trace->nb_blocks; i++) {
+            if (trace->blocks[i].pc == next->pc) {
+                break;
+            }
+        }
+        if (i < trace->nb_blocks) {
+            continue;
+        }
+        if (best < 0 ||
+            atomic_read(&next->hot_count) < atomic_read(&pnext[0]->hot_count)) {
+            best = n;
+            *pnext = next;
+        }
+    }
+    return best;
+}
+
+/* Find the "goto_tb @slot" op emitted in the op index range [@lo, @hi]
+   and replace it, along with the ops up to the matching exit_tb, with the
+   ops [@first, @last], which are not linked into the op list yet.  */
+static bool tb_trace_splice(TCGContext *s, int lo, int hi, int slot,
+                            int first, int last)
+{
+    TCGOp *op;
+    int oi, prev, next;
+
+    for (oi = lo; oi <= hi; oi++) {
+        op = &s->gen_op_buf[oi];
+        if (op->opc == INDEX_op_goto_tb &&
+            s->gen_opparam_buf[op->args] == slot) {
+            break;
+        }
+    }
+    if (oi > hi) {
+        return false;
+    }
+    prev = op->prev;
+    while (op->opc != INDEX_op_exit_tb) {
+        op = &s->gen_op_buf[op->next];
+    }
+    next = op->next;
+
+    s->gen_op_buf[prev].next = first;
+    s->gen_op_buf[first].prev = prev;
+    s->gen_op_buf[last].next = next;
+    if (next >= 0) {
+        s->gen_op_buf[next].prev = last;
+    } else {
+        s->gen_last_op_idx = last;
+    }
+    return true;
+}
+
+/* Give the goto_tb op @op, and the exit_tb that follows it, jump slot
+   @slot of @tb; a negative @slot turns it into a plain exit to the main
+   loop.  */
+static void tb_trace_set_exit(TCGContext *s, TranslationBlock *tb,
+                              TCGOp *op, int slot)
+{
+    TCGOp *exit = op;
+
+    while (exit->opc != INDEX_op_exit_tb) {
+        exit = &s->gen_op_buf[exit->next];
+    }
+    if (slot >= 0) {
+        s->gen_opparam_buf[op->args] = slot;
+        s->gen_opparam_buf[exit->args] = (uintptr_t)tb + slot;
+    } else {
+        s->gen_opparam_buf[exit->args] = 0;
+        tcg_op_remove(s, op);
+    }
+}
+
+/* The stitched blocks keep their own goto_tb exits, but a TB only has
+   two jump slots.  The exit at @close_oi, which loops back to the head,
+   gets the first one so that the loop stays inside the trace; the next
+   exits of the trace get the remaining slots and the others become plain
+   exits to the main loop.  */
+static void tb_trace_renumber_exits(TCGContext *s, TranslationBlock *tb,
+                                    int close_oi)
+{
+    int oi, oi_next, slot = 0;
+
+    if (close_oi >= 0) {
+        tb_trace_set_exit(s, tb, &s->gen_op_buf[close_oi], slot++);
+    }
+
+    for (oi = s->gen_first_op_idx; oi >= 0; oi = oi_next) {
+        TCGOp *op = &s->gen_op_buf[oi];
+
+        oi_next = op->next;
+        if (op->opc != INDEX_op_goto_tb || oi == close_oi) {
+            continue;
+        }
+        tb_trace_set_exit(s, tb, op, slot < 2 ? slot++ : -1);
+    }
+}
+
+/* Generate the ops of the head block of @tb followed by those of the
+   blocks in @trace, each one replacing the exit through which the
+   previous block jumped to it.  */
+static void gen_trace_intermediate_code(CPUArchState *env,
+                                        TranslationBlock *tb,
+                                        TBTrace *trace)
+{
+    TCGContext *s = &tcg_ctx;
+    target_ulong pc = tb->pc, cs_base = tb->cs_base;
+    uint64_t flags = tb->flags;
+    int cflags = tb->cflags;
+    target_ulong end;
+    int icount, lo, hi, last, i, oi, close_oi = -1;
+
+    gen_intermediate_code(env, tb);
+    end = pc + tb->size;
+    icount = tb->icount;
+    lo = s->gen_first_op_idx;
+    hi = s->gen_last_op_idx;
+
+    for (i = 0; i < trace->nb_blocks && icount < TCG_MAX_INSNS; i++) {
+        TBTraceBlock *b = &trace->blocks[i];
+        int last_op = s->gen_last_op_idx;
+        int first = s->gen_next_op_idx;
+        int parm = s->gen_next_parm_idx;
+
+        tb->pc = b->pc;
+        tb->cs_base = b->cs_base;
+        tb->flags = b->flags;
+        tb->cflags = cflags | CF_TRACE_TAIL | (TCG_MAX_INSNS - icount);
+#ifdef CONFIG_DEBUG_TCG
+        s->goto_tb_issue_mask = 0;
+#endif
+        gen_intermediate_code(env, tb);
+        last = s->gen_last_op_idx;
+        s->gen_last_op_idx = last_op;
+
+        if (((b->pc + tb->size - 1) & TARGET_PAGE_MASK)
+            != (pc & TARGET_PAGE_MASK) ||
+            !tb_trace_splice(s, lo, hi, b->slot, first, last)) {
+            /* drop the block, and stop the trace here */
+            s->gen_next_op_idx = first;
+            s->gen_next_parm_idx = parm;
+            break;
+        }
+        lo = first;
+        hi = s->gen_next_op_idx - 1;
+        end = MAX(end, b->pc + tb->size);
+        icount += tb->icount;
+    }
+
+    /* If every block made it in, find the exit that loops back */
+    if (i == trace->nb_blocks && trace->close_slot >= 0) {
+        for (oi = lo; oi <= hi; oi++) {
+            TCGOp *op = &s->gen_op_buf[oi];
+            if (op->opc == INDEX_op_goto_tb &&
+                s->gen_opparam_buf[op->args] == trace->close_slot) {
+                close_oi = oi;
+                break;
+            }
+        }
+    }
+
+    tb->pc = pc;
+    tb->cs_base = cs_base;
+    tb->flags = flags;
+    tb->cflags = cflags;
+    tb->size = end - pc;
+    tb->icount = icount;
+    tb_trace_renumber_exits(s, tb, close_oi);
+}
+
 /* Called with mmap_lock held for user mode emulation.  */
-TranslationBlock *tb_gen_code(CPUState *cpu,
-                              target_ulong pc, target_ulong cs_base,
-                              int flags, int cflags)
+static TranslationBlock *do_tb_gen_code(CPUState *cpu,
+                                        target_ulong pc, target_ulong cs_base,
+                                        int flags, int cflags, TBTrace *trace)
 {
     CPUArchState *env = cpu->env_ptr;
     TranslationBlock *tb;
@@ -1070,13 +1544,20 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb = tb_alloc(pc);
     if (unlikely(!tb)) {
  buffer_overflow:
-        /* flush must be done */
-        tb_flush(cpu);
+        if (tb) {
+            /* drop the partially generated TB before evicting */
+            tb_free(tb);
+        }
+        if (!tb_region_full(cpu)) {
+            /* The eviction only happens once every vCPU has left the
+               execution loop, so leave it now.  tb_lock and mmap_lock
+               are released on the siglongjmp path.  */
+            cpu->exception_index = EXCP_INTERRUPT;
+            cpu_loop_exit(cpu);
+        }
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         assert(tb != NULL);
-        /* Don't forget to invalidate previous TB info.  */
-        tcg_ctx.tb_ctx.tb_invalidated_flag = 1;
     }
 
     gen_code_buf = tcg_ctx.code_gen_ptr;
@@ -1084,6 +1565,9 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->hot_count = TB_HOT_THRESHOLD;
+    tb->hot_backoff = 0;
+    tb->exec_count = 0;
 
 #ifdef CONFIG_PROFILER
     tcg_ctx.tb_count1++; /* includes aborted translations because of
@@ -1093,7 +1577,11 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
 
     tcg_func_start(&tcg_ctx);
 
-    gen_intermediate_code(env, tb);
+    if (trace) {
+        gen_trace_intermediate_code(env, tb, trace);
+    } else {
+        gen_intermediate_code(env, tb);
+    }
 
     trace_translate_block(tb, tb->pc, tb->tc_ptr);
 
@@ -1145,6 +1633,15 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     }
 #endif
 
+    tb->tc_size = gen_code_size;
+    if (tcg_perf_map_enabled()) {
+        char name[64];
+
+        snprintf(name, sizeof(name), "guest-0x" TARGET_FMT_lx "%s",
+                 tb->pc, trace ? "-trace" : "");
+        tcg_perf_map_add(tb->tc_ptr, gen_code_size, name);
+    }
+
     tcg_ctx.code_gen_ptr = (void *)
         ROUND_UP((uintptr_t)gen_code_buf + gen_code_size + search_size,
                  CODE_GEN_ALIGN);
@@ -1159,6 +1656,73 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     return tb;
 }
 
+/* Called with mmap_lock held for user mode emulation.  */
+TranslationBlock *tb_gen_code(CPUState *cpu,
+                              target_ulong pc, target_ulong cs_base,
+                              int flags, int cflags)
+{
+    return do_tb_gen_code(cpu, pc, cs_base, flags, cflags, NULL);
+}
+
+/* Translate the hot TB @tb again, as a single TB covering it and the
+   hot blocks it chains to.  Within the trace the blocks fall through
+   into each other, so the chaining jumps disappear and, across direct
+   jumps, values stay in host registers and the optimizer sees the
+   blocks as a whole.  A hot TB that has no suitable successor is left
+   alone, and counts twice as many executions as last time before it is
+   considered again: its successors may still warm up, but a block that
+   loops on itself must not keep leaving the generated code.
+ *
+ * Called with tb_lock held, and with mmap_lock held for user mode
+ * emulation.
+ */
+void tb_gen_trace(CPUState *cpu, TranslationBlock *tb)
+{
+    TranslationBlock *cur = tb, *next = NULL;
+    target_ulong pc = tb->pc, cs_base = tb->cs_base;
+    uint64_t flags = tb->flags;
+    int cflags = tb->cflags | CF_TRACE;
+    TBTrace trace;
+    uint64_t execs;
+    int slot;
+
+    if (tb->invalid || !tb_hot_counted(tb)) {
+        return;
+    }
+
+    trace.nb_blocks = 0;
+    trace.close_slot = -1;
+    while ((slot = tb_trace_next(tb, cur, &trace, &next)) >= 0 &&
+           trace.nb_blocks < ARRAY_SIZE(trace.blocks)) {
+        TBTraceBlock *b = &trace.blocks[trace.nb_blocks++];
+
+        b->pc = next->pc;
+        b->cs_base = next->cs_base;
+        b->flags = next->flags;
+        b->slot = slot;
+        cur = next;
+    }
+
+    if (trace.nb_blocks == 0) {
+        /* Translating the block alone again would only duplicate it */
+        if (tb->hot_backoff < TB_HOT_MAX_BACKOFF) {
+            tb->hot_backoff++;
+        }
+        atomic_set(&tb->hot_count, TB_HOT_THRESHOLD << tb->hot_backoff);
+        return;
+    }
+
+    /* the trace replaces the hot TB */
+    tb_phys_invalidate(tb, -1);
+    execs = tb->exec_count;
+    tb = do_tb_gen_code(cpu, pc, cs_base, flags, cflags, &trace);
+    tb->hot_count = 0;
+    tb->exec_count = execs;
+
+    tcg_ctx.tb_ctx.tb_trace_count++;
+    tcg_ctx.tb_ctx.tb_trace_blocks += trace.nb_blocks + 1;
+}
+
 /*
  * Invalidate all TBs which intersect with the target physical address range
  * [start;end[. NOTE: start and end may refer to *different* physical pages.
@@ -1442,7 +2006,7 @@ static inline void tb_alloc_page(TranslationBlock *tb,
                 continue;
             }
             prot |= p2->flags;
-            p2->flags &= ~PAGE_WRITE;
+            atomic_set(&p2->flags, p2->flags & ~PAGE_WRITE);
           }
         mprotect(g2h(page_addr), qemu_host_page_size,
                  (prot & PAGE_BITS) & ~PAGE_WRITE);
@@ -1469,14 +2033,7 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
                          tb_page_addr_t phys_page2)
 {
-    unsigned int h;
-    TranslationBlock **ptb;
-
-    /* add in the physical hash table */
-    h = tb_phys_hash_func(phys_pc);
-    ptb = &tcg_ctx.tb_ctx.tb_phys_hash[h];
-    tb->phys_hash_next = *ptb;
-    *ptb = tb;
+    uint32_t h;
 
     /* add in the page list */
     tb_alloc_page(tb, 0, phys_pc & TARGET_PAGE_MASK);
@@ -1498,6 +2055,11 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
         tb_reset_jump(tb, 1);
     }
 
+    /* add in the hash table last: lookups do not take tb_lock, so the TB
+       must be fully set up before it becomes visible */
+    h = tb_hash_func(phys_pc, tb->pc, tb->flags);
+    qht_insert(&tcg_ctx.tb_ctx.htable, tb, h);
+
 #ifdef DEBUG_TB_CHECK
     tb_page_check();
 #endif
@@ -1507,23 +2069,30 @@ static void tb_link_page(TranslationBlock *tb, tb_page_addr_t phys_pc,
    tb[1].tc_ptr. Return NULL if not found */
 static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
 {
+    TBRegion *r = NULL;
     int m_min, m_max, m;
     uintptr_t v;
     TranslationBlock *tb;
+    int i;
 
-    if (tcg_ctx.tb_ctx.nb_tbs <= 0) {
-        return NULL;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *ri = &tcg_ctx.tb_ctx.regions[i];
+
+        if (tc_ptr >= (uintptr_t)ri->start &&
+            tc_ptr < (uintptr_t)tb_region_code_end(ri)) {
+            r = ri;
+            break;
+        }
     }
-    if (tc_ptr < (uintptr_t)tcg_ctx.code_gen_buffer ||
-        tc_ptr >= (uintptr_t)tcg_ctx.code_gen_ptr) {
+    if (r == NULL || r->nb_tbs <= 0) {
         return NULL;
     }
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = tcg_ctx.tb_ctx.nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tcg_ctx.tb_ctx.tbs[m];
+        tb = &r->tbs[m];
         v = (uintptr_t)tb->tc_ptr;
         if (v == tc_ptr) {
             return tb;
@@ -1533,7 +2102,7 @@ static TranslationBlock *tb_find_pc(uintptr_t tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tcg_ctx.tb_ctx.tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 #if !defined(CONFIG_USER_ONLY)
@@ -1552,11 +2121,14 @@ void tb_invalidate_phys_addr(AddressSpace *as, hwaddr addr)
     }
     ram_addr = (memory_region_get_ram_addr(mr) & TARGET_PAGE_MASK)
         + addr;
+    tb_lock();
     tb_invalidate_phys_page_range(ram_addr, ram_addr + 1, 0);
+    tb_unlock();
     rcu_read_unlock();
 }
 #endif /* !defined(CONFIG_USER_ONLY) */
 
+/* Called with tb_lock held.  */
 void tb_check_watchpoint(CPUState *cpu)
 {
     TranslationBlock *tb;
@@ -1585,14 +2157,15 @@ void tb_check_watchpoint(CPUState *cpu)
    must be at the end of the TB */
 void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
 {
-#if defined(TARGET_MIPS) || defined(TARGET_SH4)
     CPUArchState *env = cpu->env_ptr;
-#endif
-    TranslationBlock *tb;
+    TranslationBlock *tb, *io_tb;
     uint32_t n, cflags;
     target_ulong pc, cs_base;
     uint64_t flags;
+    int io_flags;
 
+    /* Released by tb_lock_reset() when cpu_exec regains control.  */
+    tb_lock();
     tb = tb_find_pc(retaddr);
     if (!tb) {
         cpu_abort(cpu, "cpu_io_recompile: could not find TB for pc=%p",
@@ -1644,11 +2217,26 @@ void cpu_io_recompile(CPUState *cpu, uintptr_t retaddr)
     /* FIXME: In theory this could raise an exception.  In practice
        we have already translated the block once so it's probably ok.  */
     tb_gen_code(cpu, pc, cs_base, flags, cflags);
-    /* TODO: If env->pc != tb->pc (i.e. the faulting instruction was not
-       the first in the TB) then we end up generating a whole new TB and
-       repeating the fault, which is horribly inefficient.
-       Better would be to execute just this insn uncached, or generate a
-       second new TB.  */
+    tcg_ctx.tb_ctx.tb_io_recompile_count++;
+
+    /* Execution resumes at the I/O instruction.  Unless it was the first
+       in the TB, the TB found there would start with it and fault in
+       turn, so translate the TB that ends on it now.  Both TBs stay
+       cached: the next pass through the same code runs them without
+       faulting.  */
+    if (n > 1) {
+        cpu_get_tb_cpu_state(env, &pc, &cs_base, &io_flags);
+        io_tb = tb_find_physical(cpu, pc, cs_base, io_flags);
+        if (io_tb == NULL ||
+            (io_tb->cflags & (CF_COUNT_MASK | CF_LAST_IO)) !=
+            (1 | CF_LAST_IO)) {
+            if (io_tb) {
+                tb_phys_invalidate(io_tb, -1);
+            }
+            tb_gen_code(cpu, pc, cs_base, io_flags, 1 | CF_LAST_IO);
+            tcg_ctx.tb_ctx.tb_io_recompile_count++;
+        }
+    }
     cpu_resume_from_signal(cpu, NULL);
 }
 
@@ -1667,51 +2255,68 @@ void tb_flush_jmp_cache(CPUState *cpu, target_ulong addr)
            TB_JMP_PAGE_SIZE * sizeof(TranslationBlock *));
 }
 
+static void print_qht_statistics(FILE *f, fprintf_function cpu_fprintf,
+                                 struct qht_stats hst)
+{
+    cpu_fprintf(f, "TB hash buckets     %zu/%zu (%0.2f%% head buckets used)\n",
+                hst.used_head_buckets, hst.head_buckets,
+                hst.head_buckets ?
+                (double)hst.used_head_buckets / hst.head_buckets * 100 : 0);
+    cpu_fprintf(f, "TB hash occupancy   %0.2f%% avg chain occ.\n",
+                hst.occupancy * 100);
+    cpu_fprintf(f, "TB hash avg chain   %0.3f buckets (max=%zu)\n",
+                hst.avg_chain, hst.max_chain);
+}
+
 void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
 {
-    int i, target_code_size, max_target_code_size;
+    int i, j, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
     TranslationBlock *tb;
+    struct qht_stats hst;
+    size_t code_size = tb_code_size();
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for (i = 0; i < tcg_ctx.tb_ctx.nb_tbs; i++) {
-        tb = &tcg_ctx.tb_ctx.tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size) {
-            max_target_code_size = tb->size;
-        }
-        if (tb->page_addr[1] != -1) {
-            cross_page++;
-        }
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+        for (j = 0; j < r->nb_tbs; j++) {
+            tb = &r->tbs[j];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size) {
+                max_target_code_size = tb->size;
+            }
+            if (tb->page_addr[1] != -1) {
+                cross_page++;
+            }
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
-    cpu_fprintf(f, "gen code size       %td/%zd\n",
-                tcg_ctx.code_gen_ptr - tcg_ctx.code_gen_buffer,
-                tcg_ctx.code_gen_highwater - tcg_ctx.code_gen_buffer);
+    cpu_fprintf(f, "gen code size       %zd/%zd\n",
+                code_size, tcg_ctx.code_gen_buffer_size);
+    cpu_fprintf(f, "TB regions          %d (current %d, generation %u)\n",
+                tcg_ctx.tb_ctx.nb_regions, tcg_ctx.tb_ctx.cur_region,
+                tcg_ctx.tb_ctx.region_gen);
     cpu_fprintf(f, "TB count            %d/%d\n",
             tcg_ctx.tb_ctx.nb_tbs, tcg_ctx.code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
             tcg_ctx.tb_ctx.nb_tbs ? target_code_size /
                     tcg_ctx.tb_ctx.nb_tbs : 0,
             max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %td bytes (expansion ratio: %0.1f)\n",
-            tcg_ctx.tb_ctx.nb_tbs ? (tcg_ctx.code_gen_ptr -
-                                     tcg_ctx.code_gen_buffer) /
-                                     tcg_ctx.tb_ctx.nb_tbs : 0,
-                target_code_size ? (double) (tcg_ctx.code_gen_ptr -
-                                             tcg_ctx.code_gen_buffer) /
-                                             target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %zd bytes (expansion ratio: %0.1f)\n",
+            tcg_ctx.tb_ctx.nb_tbs ? code_size / tcg_ctx.tb_ctx.nb_tbs : 0,
+            target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n", cross_page,
             tcg_ctx.tb_ctx.nb_tbs ? (cross_page * 100) /
                                     tcg_ctx.tb_ctx.nb_tbs : 0);
@@ -1722,10 +2327,26 @@ void dump_exec_info(FILE *f, fprintf_function cpu_fprintf)
                 direct_jmp2_count,
                 tcg_ctx.tb_ctx.nb_tbs ? (direct_jmp2_count * 100) /
                         tcg_ctx.tb_ctx.nb_tbs : 0);
+
+    rcu_read_lock();
+    qht_statistics(&tcg_ctx.tb_ctx.htable, &hst);
+    rcu_read_unlock();
+    print_qht_statistics(f, cpu_fprintf, hst);
+
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tcg_ctx.tb_ctx.tb_flush_count);
+    cpu_fprintf(f, "TB region evictions %d (%d TBs)\n",
+            tcg_ctx.tb_ctx.tb_region_evict_count,
+            tcg_ctx.tb_ctx.tb_evicted_tbs);
+    cpu_fprintf(f, "TB trace count      %d (avg %0.1f blocks)\n",
+            tcg_ctx.tb_ctx.tb_trace_count,
+            tcg_ctx.tb_ctx.tb_trace_count ?
+            (double)tcg_ctx.tb_ctx.tb_trace_blocks /
+                    tcg_ctx.tb_ctx.tb_trace_count : 0);
     cpu_fprintf(f, "TB invalidate count %d\n",
             tcg_ctx.tb_ctx.tb_phys_invalidate_count);
+    cpu_fprintf(f, "TB I/O recompiles   %d\n",
+            tcg_ctx.tb_ctx.tb_io_recompile_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
     tcg_dump_info(f, cpu_fprintf);
 }
@@ -1735,6 +2356,75 @@ void dump_opcount_info(FILE *f, fprintf_function cpu_fprintf)
     tcg_dump_op_count(f, cpu_fprintf);
 }
 
+typedef struct TBProfileEntry {
+    TranslationBlock *tb;
+    uint64_t execs;
+} TBProfileEntry;
+
+static int tb_profile_cmp(const void *a, const void *b)
+{
+    const TBProfileEntry *pa = a, *pb = b;
+
+    return pa->execs < pb->execs ? 1 : pa->execs > pb->execs ? -1 : 0;
+}
+
+TbProfileList *qmp_query_tb_profile(bool has_top, int64_t top, Error **errp)
+{
+    TbProfileList *head = NULL, **tail = &head;
+    TBProfileEntry *entries;
+    int i, j, n = 0;
+
+    if (!tb_profile_enabled) {
+        error_setg(errp, "TB profiling is not enabled, "
+                   "use -accel tcg,profile=on");
+        return NULL;
+    }
+    if (!has_top) {
+        top = 20;
+    } else if (top < 0) {
+        error_setg(errp, "Parameter 'top' expects a non-negative number");
+        return NULL;
+    }
+
+    tb_lock();
+    entries = g_new(TBProfileEntry, tcg_ctx.tb_ctx.nb_tbs);
+    for (i = 0; i < tcg_ctx.tb_ctx.nb_regions; i++) {
+        TBRegion *r = &tcg_ctx.tb_ctx.regions[i];
+
+        for (j = 0; j < r->nb_tbs; j++) {
+            TranslationBlock *tb = &r->tbs[j];
+            /* Snapshot the count for sorting, the TB may be running
+               right now.  */
+            uint64_t execs = tb->exec_count;
+
+            if (!tb->invalid && execs) {
+                entries[n].tb = tb;
+                entries[n].execs = execs;
+                n++;
+            }
+        }
+    }
+    qsort(entries, n, sizeof(*entries), tb_profile_cmp);
+
+    for (i = 0; i < n && i < top; i++) {
+        TranslationBlock *tb = entries[i].tb;
+        TbProfileList *elem = g_new0(TbProfileList, 1);
+
+        elem->value = g_new0(TbProfile, 1);
+        elem->value->pc = tb->pc;
+        elem->value->count = entries[i].execs;
+        elem->value->guest_size = tb->size;
+        elem->value->host_size = tb->tc_size;
+        elem->value->trace = !!(tb->cflags & CF_TRACE);
+        *tail = elem;
+        tail = &elem->next;
+    }
+    tb_unlock();
+
+    g_free(entries);
+    return head;
+}
+
 #else /* CONFIG_USER_ONLY */
 
 void cpu_interrupt(CPUState *cpu, int mask)
@@ -1863,7 +2553,7 @@ int page_get_flags(target_ulong address)
     if (!p) {
         return 0;
     }
-    return p->flags;
+    return atomic_read(&p->flags);
 }
 
 /* Modify the flags of a page and invalidate the code if necessary.
@@ -1900,7 +2590,7 @@ void page_set_flags(target_ulong start, target_ulong end, int flags)
             p->first_tb) {
             tb_invalidate_phys_page(addr, 0, NULL, false);
         }
-        p->flags = flags;
+        atomic_set(&p->flags, flags);
     }
 }
 
@@ -1932,24 +2622,27 @@ int page_check_range(target_ulong start, target_ulong len, int flags)
     for (addr = start, len = end - start;
          len != 0;
          len -= TARGET_PAGE_SIZE, addr += TARGET_PAGE_SIZE) {
+        unsigned long page_flags;
+
         p = page_find(addr >> TARGET_PAGE_BITS);
         if (!p) {
             return -1;
         }
-        if (!(p->flags & PAGE_VALID)) {
+        page_flags = atomic_read(&p->flags);
+        if (!(page_flags & PAGE_VALID)) {
             return -1;
         }
 
-        if ((flags & PAGE_READ) && !(p->flags & PAGE_READ)) {
+        if ((flags & PAGE_READ) && !(page_flags & PAGE_READ)) {
             return -1;
         }
         if (flags & PAGE_WRITE) {
-            if (!(p->flags & PAGE_WRITE_ORG)) {
+            if (!(page_flags & PAGE_WRITE_ORG)) {
                 return -1;
             }
             /* unprotect the page if it was put read-only because it
                contains translated code */
-            if (!(p->flags & PAGE_WRITE)) {
+            if (!(page_flags & PAGE_WRITE)) {
                 if (!page_unprotect(addr, 0, NULL)) {
                     return -1;
                 }
@@ -1987,7 +2680,7 @@ int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
         prot = 0;
         for (addr = host_start ; addr < host_end ; addr += TARGET_PAGE_SIZE) {
             p = page_find(addr >> TARGET_PAGE_BITS);
-            p->flags |= PAGE_WRITE;
+            atomic_set(&p->flags, p->flags | PAGE_WRITE);
             prot |= p->flags;
 
             /* and since the content will be modified, we must invalidate
@@ -2003,6 +2696,13 @@ int page_unprotect(target_ulong address, uintptr_t pc, void *puc)
         mmap_unlock();
         return 1;
     }
+
+    /* Another thread may have unprotected the page between our fault
+       and taking mmap_lock; the access can simply be restarted.  */
+    if (p->flags & PAGE_WRITE_ORG) {
+        mmap_unlock();
+        return 1;
+    }
     mmap_unlock();
     return 0;
 }
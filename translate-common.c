@@ -20,6 +20,7 @@
 #include "qemu/osdep.h"
 #include "qemu-common.h"
 #include "qom/cpu.h"
+#include "qemu/main-loop.h"
 
 uintptr_t qemu_real_host_page_size;
 intptr_t qemu_real_host_page_mask;
@@ -29,9 +30,18 @@ intptr_t qemu_real_host_page_mask;
 static void tcg_handle_interrupt(CPUState *cpu, int mask)
 {
     int old_mask;
+    bool need_lock = !qemu_mutex_iothread_locked();
 
+    /* interrupt_request is protected by the BQL, which multi-threaded
+       TCG vCPUs do not hold while executing guest code */
+    if (need_lock) {
+        qemu_mutex_lock_iothread();
+    }
     old_mask = cpu->interrupt_request;
     cpu->interrupt_request |= mask;
+    if (need_lock) {
+        qemu_mutex_unlock_iothread();
+    }
 
     /*
      * If called from iothread context, wake the target cpu in
@@ -22,6 +22,7 @@
 #include "tcg.h"
 #include "qemu/bitops.h"
 #include "exec/cpu_ldst.h"
+#include "exec/helper-proto.h"
 #include "translate-all.h"
 
 #undef EAX
@@ -39,6 +40,16 @@
 
 //#define DEBUG_SIGNAL
 
+/* Return address of the generated code while an atomic helper touches
+   guest memory directly, so that a fault there can be unwound to the
+   guest instruction that called the helper.  */
+static __thread uintptr_t helper_retaddr;
+
+/* Serializes atomic operations that cannot use the host atomics, see
+   atomic_slow_lock().  */
+static QemuMutex atomic_slow_mutex;
+static __thread bool atomic_slow_held;
+
 static void exception_action(CPUState *cpu)
 {
 #if defined(TARGET_I386)
@@ -88,15 +99,24 @@ static inline int handle_cpu_signal(uintptr_t pc, unsigned long address,
 {
     CPUState *cpu;
     CPUClass *cc;
+    uintptr_t retaddr = helper_retaddr;
     int ret;
 
 #if defined(DEBUG_SIGNAL)
     printf("qemu: SIGSEGV pc=0x%08lx address=%08lx w=%d oldset=0x%08lx\n",
            pc, address, is_write, *(unsigned long *)old_set);
 #endif
+    /* A fault inside an atomic helper is reported against the guest
+       instruction that called it.  */
+    if (retaddr) {
+        pc = retaddr;
+        helper_retaddr = 0;
+    }
+
     /* XXX: locking issue */
     if (is_write && h2g_valid(address)
         && page_unprotect(h2g(address), pc, puc)) {
+        helper_retaddr = retaddr;
         return 1;
     }
 
@@ -113,9 +133,15 @@ static inline int handle_cpu_signal(uintptr_t pc, unsigned long address,
         return 0; /* not an MMU fault */
     }
     if (ret == 0) {
-        return 1; /* the MMU fault was handled without causing real CPU fault */
+        /* the MMU fault was handled without causing real CPU fault */
+        helper_retaddr = retaddr;
+        return 1;
     }
     /* now we have a real cpu fault */
+    if (atomic_slow_held) {
+        atomic_slow_held = false;
+        qemu_mutex_unlock(&atomic_slow_mutex);
+    }
     cpu_restore_state(cpu, pc);
 
     /* we restore the process signal mask as the sigreturn should
@@ -675,3 +701,124 @@ int cpu_signal_handler(int host_signum, void *pinfo,
 #error host CPU specific signal handler needed
 
 #endif
+
+/* Atomic operations on guest memory.  Guest memory is mapped directly,
+   so the host atomics can always be used unless the access is not
+   naturally aligned; as for qemu_ld/st, alignment is not enforced in
+   user mode.  */
+
+static void *atomic_mmu_lookup(CPUArchState *env, target_ulong addr,
+                               TCGMemOpIdx oi, int size, uintptr_t retaddr)
+{
+    if (unlikely(addr & (size - 1))) {
+        return NULL;
+    }
+    helper_retaddr = retaddr;
+    return g2h(addr);
+}
+
+#define atomic_mmu_cleanup()  (helper_retaddr = 0)
+
+/* All threads doing an atomic operation on the same misaligned address
+   come through the slow path, so a single lock makes it atomic.  */
+static bool atomic_slow_lock(void)
+{
+    qemu_mutex_lock(&atomic_slow_mutex);
+    atomic_slow_held = true;
+    return true;
+}
+
+static void atomic_slow_unlock(bool locked)
+{
+    atomic_slow_held = false;
+    qemu_mutex_unlock(&atomic_slow_mutex);
+}
+
+static void __attribute__((constructor)) atomic_slow_init(void)
+{
+    qemu_mutex_init(&atomic_slow_mutex);
+}
+
+static uint64_t atomic_slow_ld(CPUArchState *env, target_ulong addr,
+                               TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    void *haddr = g2h(addr);
+    uint64_t ret;
+
+    helper_retaddr = retaddr;
+    switch (get_memop(oi) & (MO_BSWAP | MO_SIZE)) {
+    case MO_UB:
+        ret = ldub_p(haddr);
+        break;
+    case MO_LEUW:
+        ret = lduw_le_p(haddr);
+        break;
+    case MO_LEUL:
+        ret = (uint32_t)ldl_le_p(haddr);
+        break;
+    case MO_LEQ:
+        ret = ldq_le_p(haddr);
+        break;
+    case MO_BEUW:
+        ret = lduw_be_p(haddr);
+        break;
+    case MO_BEUL:
+        ret = (uint32_t)ldl_be_p(haddr);
+        break;
+    case MO_BEQ:
+        ret = ldq_be_p(haddr);
+        break;
+    default:
+        tcg_abort();
+    }
+    helper_retaddr = 0;
+    return ret;
+}
+
+static void atomic_slow_st(CPUArchState *env, target_ulong addr, uint64_t val,
+                           TCGMemOpIdx oi, uintptr_t retaddr)
+{
+    void *haddr = g2h(addr);
+
+    helper_retaddr = retaddr;
+    switch (get_memop(oi) & (MO_BSWAP | MO_SIZE)) {
+    case MO_UB:
+        stb_p(haddr, val);
+        break;
+    case MO_LEUW:
+        stw_le_p(haddr, val);
+        break;
+    case MO_LEUL:
+        stl_le_p(haddr, val);
+        break;
+    case MO_LEQ:
+        stq_le_p(haddr, val);
+        break;
+    case MO_BEUW:
+        stw_be_p(haddr, val);
+        break;
+    case MO_BEUL:
+        stl_be_p(haddr, val);
+        break;
+    case MO_BEQ:
+        stq_be_p(haddr, val);
+        break;
+    default:
+        tcg_abort();
+    }
+    helper_retaddr = 0;
+}
+
+#define DATA_SIZE 1
+#include "atomic_template.h"
+
+#define DATA_SIZE 2
+#include "atomic_template.h"
+
+#define DATA_SIZE 4
+#include "atomic_template.h"
+
+#ifdef CONFIG_ATOMIC64
+#define DATA_SIZE 8
+#include "atomic_template.h"
+#endif